@@ -0,0 +1,792 @@
+// Benchmarks for the game's kernels. The game is compiled straight into this
+// executable (unity build), so everything in main.cpp can be called directly.
+//
+// Every configuration is warmed up, then timed over several repetitions that each run long
+// enough to swamp the timer's overhead. Results are written as CSV (to stdout, or the file
+// given with '--csv'), one row per configuration:
+//
+//     kernel,variant,width,height,frames,voices,calls,ns_per_call,cycles_per_call,cycles_per_unit,unit,
+//     ipc,instructions_per_unit,branch_misses_per_unit,l1d_misses_per_unit,llc_misses_per_unit,dtlb_misses_per_unit
+//
+// 'ns_per_call' and 'cycles_per_call' are medians over the repetitions. 'cycles_per_unit' is per
+// pixel for render kernels, per call for the overlay and per sample frame for audio kernels. Cycles
+// are what the platform's 'CycleCount' counts, which on x86 is the constant rate time stamp counter.
+//
+// The rest come from the hardware performance counters (see shared/perf_counters.cpp), averaged
+// over all timed repetitions, and are left empty where the counters aren't available. 'ipc' is
+// instructions per core cycle.
+//
+// Before timing anything, the sRGB blending is checked against the exact transfer functions
+// (see 'CheckBlendAccuracy'); the run fails if it's off by more than color.cpp promises. It
+// also fails if the gamma correct blend costs more than BLEND_GOAL_RATIO times the naive one
+// (see 'RunBlendBenchmarks').
+//
+//     benchmark [--csv <path>] [--filter <kernel>] [--quick]
+//
+// Build with CMake (see CMakeLists.txt), or from this directory:
+//     clang++ -O2 -I ../ -o benchmark benchmark.cpp
+
+#include "main.cpp"
+
+#if defined(__APPLE__) && defined(__MACH__)
+#include "macosx/source/clock.cpp"
+#elif defined(__linux__)
+#include "linux/source/clock.cpp"
+#endif
+
+#include "shared/virtual_memory.cpp"
+#include "shared/mapped_file.cpp"
+#include "shared/linearize.cpp"
+#include "shared/perf_counters.cpp"
+#include "shared/metrics.cpp"
+#include "shared/profiler.cpp"
+#include "shared/overlay.cpp"
+
+
+#define BENCHMARK_WARM_UP_REPETITIONS 3
+#define BENCHMARK_REPETITIONS         15
+#define BENCHMARK_REPETITION_NS       2000000  // Each repetition runs the kernel for at least this long.
+
+#define BLEND_GOAL_RATIO              2.0      // The linear blend may cost at most this many naive blends.
+#define BLEND_GOAL_TRIES              3        // Best of, so a busy machine doesn't fail the goal.
+
+
+struct BenchmarkResult
+{
+    u64 calls;             // Per repetition.
+    f64 ns_per_call;
+    f64 cycles_per_call;
+
+    u32 counters_available;                   // Bit per 'PerfCounter'.
+    f64 counters_per_call[PERF_COUNTER_COUNT];  // Mean over the repetitions.
+};
+
+static FILE*       csv;
+static const char* filter;
+static bool        quick;
+
+
+static int CompareF64(const void* a, const void* b)
+{
+    f64 x = *cast(a, const f64*);
+    f64 y = *cast(b, const f64*);
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+// Runs 'kernel()' 'calls' times per repetition, where 'calls' is picked so a repetition takes
+// at least BENCHMARK_REPETITION_NS. Reports the median repetition.
+template <typename Kernel>
+static BenchmarkResult RunBenchmark(Kernel kernel)
+{
+    // The first call touches fresh memory (page faults), so it's not part of the calibration.
+    kernel();
+
+    // Calibrate (this doubles as the first warm up).
+    u64 calls = 1;
+    while (true)
+    {
+        u64 start = NanoTime();
+        for (u64 i = 0; i < calls; ++i)
+            kernel();
+        u64 elapsed = NanoTime() - start;
+        if (elapsed >= BENCHMARK_REPETITION_NS / 4 || calls >= (1ULL << 30))
+        {
+            if (elapsed < BENCHMARK_REPETITION_NS)
+                calls = calls * BENCHMARK_REPETITION_NS / (elapsed + 1) + 1;
+            break;
+        }
+        calls *= 2;
+    }
+
+    u32 repetitions = quick ? 3 : BENCHMARK_REPETITIONS;
+    u32 warm_up     = quick ? 1 : BENCHMARK_WARM_UP_REPETITIONS;
+    f64 ns[BENCHMARK_REPETITIONS];
+    f64 cycles[BENCHMARK_REPETITIONS];
+    u64 counters[PERF_COUNTER_COUNT] = {0};
+    u32 counters_available = 0;
+
+    for (u32 repetition = 0; repetition < warm_up + repetitions; ++repetition)
+    {
+        PerfSample start_counters, stop_counters;
+        counters_available = ReadPerfCounters(start_counters);
+
+        u64 start_time   = NanoTime();
+        u64 start_cycles = CycleCount();
+        for (u64 i = 0; i < calls; ++i)
+            kernel();
+        u64 stop_cycles  = CycleCount();
+        u64 stop_time    = NanoTime();
+
+        ReadPerfCounters(stop_counters);
+
+        if (repetition >= warm_up)
+        {
+            ns[repetition - warm_up]     = cast(stop_time - start_time, f64) / calls;
+            cycles[repetition - warm_up] = cast(stop_cycles - start_cycles, f64) / calls;
+            for (u32 i = 0; i < PERF_COUNTER_COUNT; ++i)
+                counters[i] += stop_counters.values[i] - start_counters.values[i];
+        }
+    }
+
+    qsort(ns,     repetitions, sizeof(f64), CompareF64);
+    qsort(cycles, repetitions, sizeof(f64), CompareF64);
+
+    BenchmarkResult result;
+    result.calls           = calls;
+    result.ns_per_call     = ns[repetitions / 2];
+    result.cycles_per_call = cycles[repetitions / 2];
+    result.counters_available = counters_available;
+    for (u32 i = 0; i < PERF_COUNTER_COUNT; ++i)
+        result.counters_per_call[i] = cast(counters[i], f64) / (cast(calls, f64) * repetitions);
+    return result;
+}
+
+static const char* kernels[] = { "update", "rectangle", "blend", "layout", "overlay", "sound", "mixer" };
+
+static void PrintUsage()
+{
+    fprintf(stderr, "Usage: benchmark [--csv <path>] [--filter <kernel>] [--quick]\n    kernels:");
+    for (const char* kernel : kernels)
+        fprintf(stderr, " %s", kernel);
+    fprintf(stderr, "\n");
+}
+
+static bool ShouldRun(const char* kernel)
+{
+    return !filter || strcmp(filter, kernel) == 0;
+}
+
+static void WriteResult(const char* kernel, const char* variant, s32 width, s32 height, u32 frames, u32 voices,
+                        BenchmarkResult result, u64 units, const char* unit)
+{
+    fprintf(csv, "%s,%s,%d,%d,%u,%u,%llu,%.1f,%.1f,%.4f,%s", kernel, variant, width, height, frames, voices,
+            cast(result.calls, unsigned long long), result.ns_per_call, result.cycles_per_call,
+            result.cycles_per_call / units, unit);
+
+    // Counters, empty if not available. Cycles are already there, as time stamp counter ticks.
+    u32 available = result.counters_available;
+    const f64* counters = result.counters_per_call;
+    if ((available & (1u << PERF_INSTRUCTIONS)) && counters[PERF_CYCLES] > 0)
+        fprintf(csv, ",%.3f", counters[PERF_INSTRUCTIONS] / counters[PERF_CYCLES]);
+    else
+        fprintf(csv, ",");
+    for (u32 i = PERF_INSTRUCTIONS; i < PERF_COUNTER_COUNT; ++i)
+    {
+        if (available & (1u << i))
+            fprintf(csv, ",%.4f", counters[i] / units);
+        else
+            fprintf(csv, ",");
+    }
+    fprintf(csv, "\n");
+    fflush(csv);
+}
+
+
+// ---- RENDERING ----
+struct Resolution { s32 width; s32 height; const char* name; };
+
+static const Resolution resolutions[] =
+{
+    {  320,  240, "320x240"   },
+    {  640,  480, "640x480"   },
+    { 1280,  720, "1280x720"  },
+    { 1920, 1080, "1920x1080" },
+    { 3840, 2160, "3840x2160" },
+};
+
+static FrameBuffer CreateFrameBuffer(s32 width, s32 height)
+{
+    FrameBuffer framebuffer;
+    framebuffer.width  = width;
+    framebuffer.height = height;
+    framebuffer.layout = FRAMEBUFFER_LINEAR;
+    framebuffer.pixels = cast(calloc(cast(width, u64) * height, sizeof(Pixel)), Pixel*);
+    return framebuffer;
+}
+
+// The full update, which is dominated by clearing the screen.
+static void RunUpdateBenchmarks(Memory& memory)
+{
+    if (!ShouldRun("update"))
+        return;
+
+    KeyBoard keyboard = {0};
+    for (const Resolution& resolution : resolutions)
+    {
+        FrameBuffer framebuffer = CreateFrameBuffer(resolution.width, resolution.height);
+        BenchmarkResult result = RunBenchmark([&]() { Update(memory, framebuffer, keyboard); });
+        WriteResult("update", "clear", resolution.width, resolution.height, 0, 0, result,
+                    cast(resolution.width, u64) * resolution.height, "pixel");
+        free(framebuffer.pixels);
+    }
+}
+
+// Squares of increasing size, in the largest framebuffer.
+static void RunRectangleBenchmarks()
+{
+    if (!ShouldRun("rectangle"))
+        return;
+
+    FrameBuffer framebuffer = CreateFrameBuffer(3840, 2160);
+    s32 sizes[] = { 8, 32, 128, 512, 2048 };
+    for (s32 size : sizes)
+    {
+        BenchmarkResult result = RunBenchmark([&]() { DrawRectangle(framebuffer, 16, 16, 16 + size, 16 + size); });
+        WriteResult("rectangle", "square", size, size, 0, 0, result, cast(size, u64) * size, "pixel");
+    }
+    free(framebuffer.pixels);
+}
+
+// Blending a translucent square the naive way (on the stored sRGB bytes), as the baseline for
+// the gamma correct 'BlendRectangle'. Same rounding, integer math. Not inlined, so it's a call
+// with the color and alpha only known at run time, like 'BlendRectangle' is; inlined into the
+// benchmark, the compiler specializes it for the constant alpha, which the game never gets.
+__attribute__((noinline)) static void BlendRectangleNaive(FrameBuffer& framebuffer, s32 left, s32 top, s32 right, s32 bottom, Pixel color, f32 alpha)
+{
+    u8 channels[4];
+    memcpy(channels, &color, sizeof(channels));
+    u32 weight = cast(alpha * 255.0f + 0.5f, u32);
+    u32 source[3];
+    for (u32 channel = 0; channel < 3; ++channel)
+        source[channel] = channels[channel] * weight + 128;
+
+    for (s32 y = top; y < bottom; ++y)
+    {
+        u8* row = reinterpret_cast<u8*>(framebuffer.pixels + y * framebuffer.width + left);
+        for (s32 x = 0; x < right - left; ++x)
+        {
+            for (u32 channel = 0; channel < 3; ++channel)
+            {
+                u32 t = row[x * 4 + channel] * (255 - weight) + source[channel];
+                row[x * 4 + channel] = cast((t + (t >> 8)) >> 8, u8);
+            }
+        }
+    }
+}
+
+// Times the linear blend against the naive one, and checks it against BLEND_GOAL_RATIO. Each
+// is measured BLEND_GOAL_TRIES times, interleaved, and the fastest median is kept, as noise only
+// ever makes a kernel slower.
+static bool RunBlendBenchmarks()
+{
+    if (!ShouldRun("blend"))
+        return true;
+
+    FrameBuffer framebuffer = CreateFrameBuffer(3840, 2160);
+    // Not a flat color, so the table lookups don't all hit the same entries.
+    for (u64 i = 0; i < cast(framebuffer.width, u64) * framebuffer.height; ++i)
+    {
+        framebuffer.pixels[i].r = cast(i * 7, u8);
+        framebuffer.pixels[i].g = cast(i * 13, u8);
+        framebuffer.pixels[i].b = cast(i >> 4, u8);
+    }
+
+    Pixel color = {0};
+    color.r = 255;
+    color.b = 64;
+
+    bool      within_goal = true;
+    const s32 sizes[]     = { 8, 32, 128, 512, 2048 };
+    const u32 size_count  = sizeof(sizes) / sizeof(sizes[0]);
+    f64       ratios[size_count];
+    for (u32 i = 0; i < size_count; ++i)
+    {
+        s32 size = sizes[i];
+        BenchmarkResult naive  = {0};
+        BenchmarkResult linear = {0};
+        for (u32 attempt = 0; attempt < (quick ? 1 : BLEND_GOAL_TRIES); ++attempt)
+        {
+            BenchmarkResult result = RunBenchmark([&]() { BlendRectangleNaive(framebuffer, 16, 16, 16 + size, 16 + size, color, 0.5f); });
+            if (attempt == 0 || result.cycles_per_call < naive.cycles_per_call)
+                naive = result;
+            result = RunBenchmark([&]() { BlendRectangle(framebuffer, 16, 16, 16 + size, 16 + size, color, 0.5f); });
+            if (attempt == 0 || result.cycles_per_call < linear.cycles_per_call)
+                linear = result;
+        }
+        WriteResult("blend", "srgb-naive", size, size, 0, 0, naive,  cast(size, u64) * size, "pixel");
+        WriteResult("blend", "linear",     size, size, 0, 0, linear, cast(size, u64) * size, "pixel");
+
+        ratios[i] = linear.cycles_per_call / naive.cycles_per_call;
+        within_goal = within_goal && ratios[i] <= BLEND_GOAL_RATIO;
+    }
+    free(framebuffer.pixels);
+
+    fprintf(stderr, "Blend cost (linear / naive) for squares of");
+    for (u32 i = 0; i < size_count; ++i)
+        fprintf(stderr, " %d: %.2f%s", sizes[i], ratios[i], i + 1 < size_count ? "," : "");
+    fprintf(stderr, " (at most %.1f). %s\n", BLEND_GOAL_RATIO, within_goal ? "OK" : "FAILED");
+    return within_goal;
+}
+
+// Checks the sRGB tables and the blend against the exact transfer functions (in doubles), and
+// fails the run if they're off by more than the documented error. Not timed.
+static f64 ExactSrgbToLinear(f64 x) { return x <= 0.04045   ? x / 12.92 : pow((x + 0.055) / 1.055, 2.4); }
+static f64 ExactLinearToSrgb(f64 x) { return x <= 0.0031308 ? x * 12.92 : 1.055 * pow(x, 1.0 / 2.4) - 0.055; }
+
+static bool CheckBlendAccuracy()
+{
+    if (!ShouldRun("blend"))
+        return true;
+
+    // Decoding is a table of the exact values rounded to floats.
+    f64 decode_error = 0;
+    for (u32 i = 0; i < 256; ++i)
+    {
+        f64 error = fabs(SrgbToLinear(cast(i, u8)) - ExactSrgbToLinear(i / 255.0));
+        decode_error = error > decode_error ? error : decode_error;
+    }
+
+    u32 round_trip_failures = 0;
+    for (u32 i = 0; i < 256; ++i)
+        round_trip_failures += LinearToSrgb(SrgbToLinear(cast(i, u8))) != i ? 1 : 0;
+
+    // Every float in [0, 1] (every 64th with --quick). The exactly rounded result only changes
+    // where the value crosses the midpoint between two steps, so compare against those rather
+    // than calling pow a billion times.
+    f64 thresholds[256];
+    for (u32 i = 0; i < 255; ++i)
+        thresholds[i] = ExactSrgbToLinear((i + 0.5) / 255.0);
+    thresholds[255] = 2.0;
+
+    u32 step = quick ? 64 : 1;
+    u64 checked = 0, mismatches = 0;
+    f64 encode_error = 0;
+    u32 expected = 0;
+    for (u32 bits = 0; bits <= 0x3F800000u; bits += step)
+    {
+        f32 x;
+        memcpy(&x, &bits, sizeof(x));
+        while (x >= thresholds[expected])
+            ++expected;
+
+        u8 result = LinearToSrgb(x);
+        ++checked;
+        if (result != expected)
+        {
+            ++mismatches;
+            f64 error = fabs(result - ExactLinearToSrgb(x) * 255.0);
+            encode_error = error > encode_error ? error : encode_error;
+        }
+    }
+
+    // The full pipeline, SIMD rows included, on random pixels.
+    u32 width = 67, height = 64;  // Not a multiple of 4, so the scalar tail runs too.
+    FrameBuffer framebuffer = CreateFrameBuffer(width, height);
+    Pixel* original = cast(malloc(width * height * sizeof(Pixel)), Pixel*);
+    u32 random = 12345;
+    f64 blend_error = 0;
+    for (u32 round = 0; round < 64; ++round)
+    {
+        for (u32 i = 0; i < width * height * sizeof(Pixel); ++i)
+        {
+            random = random * 1664525u + 1013904223u;
+            reinterpret_cast<u8*>(framebuffer.pixels)[i] = cast(random >> 24, u8);
+        }
+        memcpy(original, framebuffer.pixels, width * height * sizeof(Pixel));
+
+        random = random * 1664525u + 1013904223u;
+        Pixel color;
+        memcpy(&color, &random, sizeof(color));
+        f32 alpha = round / 63.0f;
+        BlendRectangle(framebuffer, 0, 0, width, height, color, alpha);
+
+        const u8* source = reinterpret_cast<const u8*>(&color);
+        for (u32 i = 0; i < width * height; ++i)
+        {
+            const u8* before = reinterpret_cast<const u8*>(original + i);
+            const u8* after  = reinterpret_cast<const u8*>(framebuffer.pixels + i);
+            for (u32 channel = 0; channel < 3; ++channel)
+            {
+                f64 linear = ExactSrgbToLinear(before[channel] / 255.0) * (1.0 - alpha) + ExactSrgbToLinear(source[channel] / 255.0) * alpha;
+                f64 error  = fabs(after[channel] - ExactLinearToSrgb(linear) * 255.0);
+                blend_error = error > blend_error ? error : blend_error;
+            }
+            if (before[3] != after[3])
+                blend_error = 255.0;
+        }
+    }
+    free(original);
+    free(framebuffer.pixels);
+
+    bool passed = decode_error < 1e-7 && round_trip_failures == 0 && encode_error < 0.6 && blend_error < 0.6;
+    fprintf(stderr, "Blend accuracy (in sRGB8 steps): encode off by %.3f at most, rounded differently for %llu of %llu floats, "
+                    "blend off by %.3f at most, %u of 256 bytes don't round trip, decode off by %.1e. %s\n",
+            encode_error, cast(mismatches, unsigned long long), cast(checked, unsigned long long),
+            blend_error, round_trip_failures, decode_error, passed ? "OK" : "FAILED");
+    return passed;
+}
+
+
+// The same drawing in every framebuffer layout: tall thin bars, squares down the diagonal and
+// many small translucent sprites, plus the cost of linearizing the result for presenting.
+// Besides the timings, prints how many cache lines and pages each workload writes to (to
+// stderr), which is what the tiled layouts are meant to cut down.
+struct LayoutWorkload
+{
+    const char* name;
+    u64 pixels;  // Drawn per call.
+    void (*draw)(FrameBuffer& framebuffer);
+};
+
+static void DrawVerticalBars(FrameBuffer& framebuffer)
+{
+    for (s32 x = 0; x + 4 <= framebuffer.width; x += 40)
+        DrawRectangle(framebuffer, x, 0, x + 4, framebuffer.height);
+}
+
+static void DrawDiagonal(FrameBuffer& framebuffer)
+{
+    for (s32 i = 0; i + 16 <= framebuffer.height; i += 8)
+        DrawRectangle(framebuffer, i, i, i + 16, i + 16);
+}
+
+static void DrawSprites(FrameBuffer& framebuffer)
+{
+    Pixel color = {0};
+    color.r = 200;
+    color.g = 64;
+    u32 random = 1;
+    for (u32 i = 0; i < 512; ++i)
+    {
+        random = random * 1664525u + 1013904223u;
+        s32 x = cast((random >> 8) % cast(framebuffer.width  - 24, u32), s32);
+        s32 y = cast((random >> 20) % cast(framebuffer.height - 24, u32), s32);
+        BlendRectangle(framebuffer, x, y, x + 24, y + 24, color, 0.5f);
+    }
+}
+
+static void RunLayoutBenchmarks()
+{
+    if (!ShouldRun("layout"))
+        return;
+
+    const s32 width = 1920, height = 1080;
+    LayoutWorkload workloads[] =
+    {
+        { "vertical", cast(width / 40, u64) * 4 * height,     DrawVerticalBars },
+        { "diagonal", cast((height - 16) / 8 + 1, u64) * 256, DrawDiagonal     },
+        { "sprites",  512ULL * 24 * 24,                       DrawSprites      },
+    };
+    struct { FrameBufferLayout layout; const char* name; } layouts[] =
+    {
+        { FRAMEBUFFER_LINEAR,    "linear"   },
+        { FRAMEBUFFER_TILED_8,   "tiled8"   },
+        { FRAMEBUFFER_TILED_32,  "tiled32"  },
+        { FRAMEBUFFER_MORTON_32, "morton32" },
+    };
+
+    FrameBuffer present = CreateFrameBuffer(width, height);
+    fprintf(stderr, "Layout footprint (cache lines / pages written per call):\n");
+    for (auto& layout : layouts)
+    {
+        FrameBuffer framebuffer = present;
+        framebuffer.layout = layout.layout;
+        u64 pixel_count    = FrameBufferPixelCount(framebuffer);
+        framebuffer.pixels = cast(calloc(pixel_count, sizeof(Pixel)), Pixel*);
+
+        fprintf(stderr, "    %-9s", layout.name);
+        for (LayoutWorkload& workload : workloads)
+        {
+            // Count what a single call writes to, in a cleared framebuffer.
+            memset(framebuffer.pixels, 0, pixel_count * sizeof(Pixel));
+            workload.draw(framebuffer);
+            const u8* bytes = reinterpret_cast<const u8*>(framebuffer.pixels);
+            u64 lines = 0, pages = 0;
+            for (u64 page = 0; page < pixel_count * sizeof(Pixel); page += 4096)
+            {
+                bool page_written = false;
+                for (u64 line = page; line < page + 4096 && line < pixel_count * sizeof(Pixel); line += 64)
+                {
+                    u64 chunk[8];
+                    memcpy(chunk, bytes + line, sizeof(chunk));
+                    bool written = (chunk[0] | chunk[1] | chunk[2] | chunk[3] | chunk[4] | chunk[5] | chunk[6] | chunk[7]) != 0;
+                    lines += written ? 1 : 0;
+                    page_written |= written;
+                }
+                pages += page_written ? 1 : 0;
+            }
+            fprintf(stderr, "  %s %6llu / %-5llu", workload.name, cast(lines, unsigned long long), cast(pages, unsigned long long));
+        }
+        fprintf(stderr, "\n");
+
+        for (LayoutWorkload& workload : workloads)
+        {
+            char variant[64];
+            snprintf(variant, sizeof(variant), "%s-%s", layout.name, workload.name);
+            BenchmarkResult result = RunBenchmark([&]() { workload.draw(framebuffer); });
+            WriteResult("layout", variant, width, height, 0, 0, result, workload.pixels, "pixel");
+        }
+
+        char variant[64];
+        snprintf(variant, sizeof(variant), "%s-present", layout.name);
+        BenchmarkResult result = RunBenchmark([&]() { LinearizeFrameBuffer(framebuffer, present); });
+        WriteResult("layout", variant, width, height, 0, 0, result, cast(width, u64) * height, "pixel");
+
+        free(framebuffer.pixels);
+    }
+    free(present.pixels);
+}
+
+#define OVERLAY_FRAMEBUFFERS 16
+
+// The debug overlay, with a full graph and profiler. 'cached' draws into the same framebuffer
+// every call, 'uncached' goes round OVERLAY_FRAMEBUFFERS of them, so the rows it draws on are
+// no longer in L2, like after the game has drawn the whole frame.
+static void RunOverlayBenchmarks(Memory& memory)
+{
+    if (!ShouldRun("overlay"))
+        return;
+
+    Buffer arena;
+    Overlay overlay;
+    if (!AllocateArena(arena, MEGABYTES(2)) || !InitializeOverlay(overlay, arena, MILLI_TO_NANO(16)))
+        return;
+
+    // Frame times around the budget, with a few overruns, so the bars have all sorts of heights.
+    u32 state = 1;
+    for (u32 i = 0; i < OVERLAY_GRAPH_SIZE; ++i)
+    {
+        state = state * 1664525 + 1013904223;
+        OverlayRecordFrame(overlay, MILLI_TO_NANO(8) + (state >> 8) % MILLI_TO_NANO(12));
+    }
+
+    // A frame's worth of blocks for the profiler lines.
+    {
+        TIMED_BLOCK("update");
+        {
+            TIMED_BLOCK("sound");
+        }
+        {
+            TIMED_BLOCK("capture");
+        }
+    }
+    ProfilerEndFrame();
+
+    const Resolution sizes[] = { resolutions[1], resolutions[3] };
+    for (const Resolution& resolution : sizes)
+    {
+        FrameBuffer framebuffers[OVERLAY_FRAMEBUFFERS];
+        for (FrameBuffer& framebuffer : framebuffers)
+        {
+            // Touched up front, so page faults aren't part of the first repetitions.
+            framebuffer = CreateFrameBuffer(resolution.width, resolution.height);
+            memset(framebuffer.pixels, 0x40, cast(resolution.width, u64) * resolution.height * sizeof(Pixel));
+        }
+
+        BenchmarkResult result = RunBenchmark([&]() { DrawOverlay(overlay, framebuffers[0], memory); });
+        WriteResult("overlay", "cached", resolution.width, resolution.height, 0, 0, result, 1, "call");
+
+        u32 next = 0;
+        result = RunBenchmark([&]() { DrawOverlay(overlay, framebuffers[next++ % OVERLAY_FRAMEBUFFERS], memory); });
+        WriteResult("overlay", "uncached", resolution.width, resolution.height, 0, 0, result, 1, "call");
+
+        for (FrameBuffer& framebuffer : framebuffers)
+            free(framebuffer.pixels);
+    }
+}
+
+
+// ---- AUDIO ----
+// The game's own 'Sound', with whatever it's playing after 'Initialize'.
+static void RunSoundBenchmarks(Memory& memory)
+{
+    if (!ShouldRun("sound"))
+        return;
+
+    u32 sizes[] = { 64, 256, 512, 1024, 4096 };
+    s16* samples = cast(malloc(4096 * sizeof(Sample)), s16*);
+    for (u32 frames : sizes)
+    {
+        SoundBuffer buffer;
+        buffer.size = frames * sizeof(Sample);
+        buffer.data = samples;
+        buffer.samples_per_second = 44100;
+
+        BenchmarkResult result = RunBenchmark([&]() { Sound(memory, buffer); });
+        WriteResult("sound", "game", 0, 0, frames, 2, result, frames, "frame");
+    }
+    free(samples);
+}
+
+#define MIXER_CALLBACK_FRAMES 512
+
+// Generates a stereo test tone with some harmonics, so the samples aren't trivially predictable.
+static void GenerateTestWave(s16* samples, u32 frame_count, u32 samples_per_second)
+{
+    for (u32 i = 0; i < frame_count; ++i)
+    {
+        f32 t = cast(i, f32) / samples_per_second;
+        f32 x = 0.6f * sinf(2.0f * PI32 * 220.0f * t) + 0.3f * sinf(2.0f * PI32 * 660.0f * t);
+        samples[i * 2 + 0] = cast(x * 16000.0f, s16);
+        samples[i * 2 + 1] = cast(x * 12000.0f, s16);
+    }
+}
+
+static bool WriteTestWaveFile(const char* path, const s16* samples, u32 frame_count, u32 samples_per_second)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    u32 data_size = frame_count * sizeof(Sample);
+    u32 riff_size = 36 + data_size;
+    u32 format_size = 16;
+    u16 format = 1, channels = 2, block_align = sizeof(Sample), bits = 16;
+    u32 byte_rate = samples_per_second * sizeof(Sample);
+
+    fwrite("RIFF", 4, 1, file); fwrite(&riff_size, 4, 1, file); fwrite("WAVE", 4, 1, file);
+    fwrite("fmt ", 4, 1, file); fwrite(&format_size, 4, 1, file);
+    fwrite(&format, 2, 1, file); fwrite(&channels, 2, 1, file);
+    fwrite(&samples_per_second, 4, 1, file); fwrite(&byte_rate, 4, 1, file);
+    fwrite(&block_align, 2, 1, file); fwrite(&bits, 2, 1, file);
+    fwrite("data", 4, 1, file); fwrite(&data_size, 4, 1, file);
+    fwrite(samples, data_size, 1, file);
+    fclose(file);
+    return true;
+}
+
+static BenchmarkResult BenchmarkMixer(const WaveFile& wave, u32 voice_count, Resampling resampling, u32 samples_per_second)
+{
+    static Mixer mixer;
+    static s16   output[MIXER_CALLBACK_FRAMES * 2];
+
+    memset(&mixer, 0, sizeof(mixer));
+    mixer.master_volume = 1.0f / voice_count;
+
+    for (u32 i = 0; i < voice_count; ++i)
+    {
+        Voice* voice = PlayVoice(mixer, wave);
+        voice->pitch      = 0.5f + cast(i % 16, f32) / 16.0f;  // Non-integer steps through the source.
+        voice->pan        = cast(i % 9, f32) / 4.0f - 1.0f;
+        voice->resampling = resampling;
+        voice->looping    = true;
+    }
+
+    SoundBuffer buffer;
+    buffer.size = sizeof(output);
+    buffer.data = output;
+    buffer.samples_per_second = samples_per_second;
+
+    return RunBenchmark([&]() { MixVoices(mixer, buffer); });
+}
+
+static void RunMixerBenchmarks()
+{
+    if (!ShouldRun("mixer"))
+        return;
+
+    u32 source_rate  = 44100;
+    u32 source_count = source_rate * 10;
+    s16* samples = cast(malloc(source_count * sizeof(Sample)), s16*);  // LEAK(ted): Lives until exit.
+    GenerateTestWave(samples, source_count, source_rate);
+
+    WaveFile memory_wave;
+    memory_wave.samples            = samples;
+    memory_wave.frame_count        = source_count;
+    memory_wave.channels           = 2;
+    memory_wave.samples_per_second = source_rate;
+
+    // Same data, but streamed from a memory mapped file.
+    const char* path = "benchmark_stream.wav";
+    WaveFile   mapped_wave = {0};
+    MappedFile file        = {0};
+    if (WriteTestWaveFile(path, samples, source_count, source_rate))
+    {
+        file = MapFile(path);
+        if (!file.data || !ParseWave(file.data, file.size, mapped_wave))
+            REPORT_ERROR("Couldn't map '%s'.\n", path);
+    }
+
+    u32 rates[]  = { 44100, 48000 };
+    u32 voices[] = { 1, 8, 32, 64 };
+
+    for (u32 rate : rates)
+    {
+        for (u32 count : voices)
+        {
+            for (u32 mapped = 0; mapped < 2; ++mapped)
+            {
+                const WaveFile& wave = mapped ? mapped_wave : memory_wave;
+                if (wave.frame_count == 0)
+                    continue;
+
+                char linear_name[32], cubic_name[32];
+                snprintf(linear_name, sizeof(linear_name), "%s-linear-%u", mapped ? "mapped" : "memory", rate);
+                snprintf(cubic_name,  sizeof(cubic_name),  "%s-cubic-%u",  mapped ? "mapped" : "memory", rate);
+
+                BenchmarkResult linear = BenchmarkMixer(wave, count, RESAMPLE_LINEAR, rate);
+                BenchmarkResult cubic  = BenchmarkMixer(wave, count, RESAMPLE_CUBIC,  rate);
+                WriteResult("mixer", linear_name, 0, 0, MIXER_CALLBACK_FRAMES, count, linear, cast(MIXER_CALLBACK_FRAMES, u64) * count, "voice-frame");
+                WriteResult("mixer", cubic_name,  0, 0, MIXER_CALLBACK_FRAMES, count, cubic,  cast(MIXER_CALLBACK_FRAMES, u64) * count, "voice-frame");
+            }
+        }
+    }
+
+    UnmapFile(file);
+    remove(path);
+}
+
+
+int main(int argc, char* argv[])
+{
+    csv = stdout;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+            quick = true;
+        else if (i + 1 < argc && strcmp(argv[i], "--filter") == 0)
+            filter = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--csv") == 0)
+        {
+            csv = fopen(argv[++i], "w");
+            if (!csv)
+            {
+                REPORT_ERROR("Couldn't create '%s'.\n", argv[i]);
+                return 1;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown argument '%s'.\n", argv[i]);
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    bool known_filter = !filter;
+    for (const char* kernel : kernels)
+        known_filter = known_filter || strcmp(filter, kernel) == 0;
+    if (!known_filter)
+    {
+        fprintf(stderr, "Unknown kernel '%s'.\n", filter);
+        PrintUsage();
+        return 1;
+    }
+
+    // The game's kernels run on the game's state, like in the hosts.
+    Memory memory = {0};
+    if (!AllocateGameMemory(memory, MEGABYTES(64), MEGABYTES(64), 0))
+        return 1;
+    Initialize(memory);
+
+    if (!CheckBlendAccuracy())
+        return 1;
+
+    const char* status = PerfCountersStatus();
+    if (status[0])
+        fprintf(stderr, "[Warning]: %s.\n", status);
+
+    fprintf(csv, "kernel,variant,width,height,frames,voices,calls,ns_per_call,cycles_per_call,cycles_per_unit,unit,"
+                 "ipc,instructions_per_unit,branch_misses_per_unit,l1d_misses_per_unit,llc_misses_per_unit,dtlb_misses_per_unit\n");
+    RunUpdateBenchmarks(memory);
+    RunRectangleBenchmarks();
+    bool blend_within_goal = RunBlendBenchmarks();
+    RunLayoutBenchmarks();
+    RunOverlayBenchmarks(memory);
+    RunSoundBenchmarks(memory);
+    RunMixerBenchmarks();
+
+    if (csv != stdout)
+        fclose(csv);
+    return blend_within_goal ? 0 : 1;
+}
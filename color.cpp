@@ -0,0 +1,337 @@
+// Gamma correct blending.
+//
+// Framebuffer pixels are sRGB encoded, so averaging the stored bytes (what a plain alpha blend
+// does) mixes perceptual values and not light: half-transparent edges come out too dark and
+// bright colors lose saturation where they overlap. Here pixels are decoded to linear light,
+// blended there and encoded back to sRGB.
+//
+//     Decode: a 256 entry table of floats, as there are only 256 inputs. Exact.
+//     Encode: linear interpolation in one of 104 buckets picked by the float's exponent and top
+//             mantissa bits (the table is 416 bytes, so it stays in L1). Within 0.6 of a step
+//             from the exact result, and round trips every byte exactly.
+//
+// Both tables are constant (generated offline from the sRGB transfer functions), so the game
+// has no tables to build or keep in its memory.
+//
+// With a given color and alpha each channel's result only depends on that channel's byte, so
+// larger rectangles first blend the 256 possible bytes (on the stack) and then look every
+// pixel's result up there. Same results, a third of the work of a naive blend per pixel.
+
+#include "simd.h"
+#include "framebuffer.h"
+
+
+static const f32 srgb_to_linear_table[256] =
+{
+    0.000000000e+00f, 3.035269910e-04f, 6.070539821e-04f, 9.105809731e-04f, 1.214107964e-03f, 1.517634955e-03f, 1.821161946e-03f, 2.124688821e-03f,
+    2.428215928e-03f, 2.731742803e-03f, 3.035269910e-03f, 3.346535843e-03f, 3.676507389e-03f, 4.024717025e-03f, 4.391442053e-03f, 4.776953254e-03f,
+    5.181516521e-03f, 5.605391692e-03f, 6.048833020e-03f, 6.512090564e-03f, 6.995410193e-03f, 7.499032188e-03f, 8.023193106e-03f, 8.568125777e-03f,
+    9.134058841e-03f, 9.721217677e-03f, 1.032982301e-02f, 1.096009370e-02f, 1.161224488e-02f, 1.228648797e-02f, 1.298303250e-02f, 1.370208338e-02f,
+    1.444384363e-02f, 1.520851441e-02f, 1.599629410e-02f, 1.680737548e-02f, 1.764195412e-02f, 1.850022003e-02f, 1.938236132e-02f, 2.028856240e-02f,
+    2.121900953e-02f, 2.217388526e-02f, 2.315336652e-02f, 2.415763214e-02f, 2.518685907e-02f, 2.624122240e-02f, 2.732089162e-02f, 2.842603996e-02f,
+    2.955683507e-02f, 3.071344458e-02f, 3.189603239e-02f, 3.310476616e-02f, 3.433980793e-02f, 3.560131416e-02f, 3.688944876e-02f, 3.820437193e-02f,
+    3.954623640e-02f, 4.091519862e-02f, 4.231141135e-02f, 4.373503104e-02f, 4.518620297e-02f, 4.666508734e-02f, 4.817182571e-02f, 4.970656708e-02f,
+    5.126945674e-02f, 5.286064744e-02f, 5.448027700e-02f, 5.612849072e-02f, 5.780543014e-02f, 5.951123685e-02f, 6.124605238e-02f, 6.301001459e-02f,
+    6.480326504e-02f, 6.662593782e-02f, 6.847816706e-02f, 7.036009431e-02f, 7.227185369e-02f, 7.421357185e-02f, 7.618538290e-02f, 7.818742096e-02f,
+    8.021982014e-02f, 8.228270710e-02f, 8.437620848e-02f, 8.650045842e-02f, 8.865558356e-02f, 9.084171057e-02f, 9.305896610e-02f, 9.530746937e-02f,
+    9.758734703e-02f, 9.989872575e-02f, 1.022417322e-01f, 1.046164855e-01f, 1.070231050e-01f, 1.094617099e-01f, 1.119324267e-01f, 1.144353747e-01f,
+    1.169706658e-01f, 1.195384264e-01f, 1.221387759e-01f, 1.247718185e-01f, 1.274376810e-01f, 1.301364750e-01f, 1.328683197e-01f, 1.356333345e-01f,
+    1.384316087e-01f, 1.412632912e-01f, 1.441284716e-01f, 1.470272690e-01f, 1.499597877e-01f, 1.529261470e-01f, 1.559264660e-01f, 1.589608341e-01f,
+    1.620293707e-01f, 1.651321948e-01f, 1.682693958e-01f, 1.714411080e-01f, 1.746474057e-01f, 1.778884232e-01f, 1.811642498e-01f, 1.844749898e-01f,
+    1.878207773e-01f, 1.912016869e-01f, 1.946178377e-01f, 1.980693191e-01f, 2.015562505e-01f, 2.050787359e-01f, 2.086368650e-01f, 2.122307569e-01f,
+    2.158605009e-01f, 2.195262015e-01f, 2.232279629e-01f, 2.269658744e-01f, 2.307400554e-01f, 2.345505804e-01f, 2.383975685e-01f, 2.422811240e-01f,
+    2.462013215e-01f, 2.501582801e-01f, 2.541520894e-01f, 2.581828535e-01f, 2.622506618e-01f, 2.663556039e-01f, 2.704977989e-01f, 2.746773064e-01f,
+    2.788942754e-01f, 2.831487358e-01f, 2.874408364e-01f, 2.917706370e-01f, 2.961382568e-01f, 3.005437851e-01f, 3.049873114e-01f, 3.094689250e-01f,
+    3.139887154e-01f, 3.185467720e-01f, 3.231432140e-01f, 3.277781010e-01f, 3.324515224e-01f, 3.371636271e-01f, 3.419144154e-01f, 3.467040658e-01f,
+    3.515326083e-01f, 3.564001322e-01f, 3.613067865e-01f, 3.662526011e-01f, 3.712376952e-01f, 3.762621284e-01f, 3.813260198e-01f, 3.864294291e-01f,
+    3.915724754e-01f, 3.967552185e-01f, 4.019777775e-01f, 4.072402120e-01f, 4.125426114e-01f, 4.178850651e-01f, 4.232676625e-01f, 4.286904931e-01f,
+    4.341536462e-01f, 4.396571815e-01f, 4.452011883e-01f, 4.507857859e-01f, 4.564110339e-01f, 4.620769918e-01f, 4.677838087e-01f, 4.735314846e-01f,
+    4.793201685e-01f, 4.851499498e-01f, 4.910208583e-01f, 4.969329834e-01f, 5.028864741e-01f, 5.088813305e-01f, 5.149176717e-01f, 5.209955573e-01f,
+    5.271151066e-01f, 5.332763791e-01f, 5.394794941e-01f, 5.457244515e-01f, 5.520114303e-01f, 5.583403707e-01f, 5.647115111e-01f, 5.711248517e-01f,
+    5.775804520e-01f, 5.840784311e-01f, 5.906188488e-01f, 5.972017646e-01f, 6.038273573e-01f, 6.104955673e-01f, 6.172065735e-01f, 6.239603758e-01f,
+    6.307571530e-01f, 6.375968456e-01f, 6.444796920e-01f, 6.514056325e-01f, 6.583748460e-01f, 6.653872728e-01f, 6.724431515e-01f, 6.795424819e-01f,
+    6.866853237e-01f, 6.938717365e-01f, 7.011018991e-01f, 7.083757520e-01f, 7.156934738e-01f, 7.230551243e-01f, 7.304607630e-01f, 7.379103899e-01f,
+    7.454041839e-01f, 7.529422045e-01f, 7.605245113e-01f, 7.681511641e-01f, 7.758222222e-01f, 7.835378051e-01f, 7.912979126e-01f, 7.991027236e-01f,
+    8.069522381e-01f, 8.148465753e-01f, 8.227857351e-01f, 8.307698965e-01f, 8.387989998e-01f, 8.468732238e-01f, 8.549926281e-01f, 8.631572127e-01f,
+    8.713670969e-01f, 8.796223998e-01f, 8.879231215e-01f, 8.962693810e-01f, 9.046611786e-01f, 9.130986333e-01f, 9.215818644e-01f, 9.301108718e-01f,
+    9.386857152e-01f, 9.473065138e-01f, 9.559733272e-01f, 9.646862745e-01f, 9.734452963e-01f, 9.822505713e-01f, 9.911020994e-01f, 1.000000000e+00f,
+};
+
+// (bias << 16) | scale for each bucket, where sRGB8 = (bias * 512 + scale * t) >> 16 and 't' is
+// the 8 mantissa bits below the ones that picked the bucket. Buckets start at 2^-13; anything
+// smaller encodes to 0.
+static const u32 linear_to_srgb_table[104] =
+{
+    0x0073000d, 0x007a000d, 0x0080000d, 0x0087000d, 0x008d000d, 0x0094000d, 0x009a000d, 0x00a1000d,
+    0x00a7001a, 0x00b4001a, 0x00c1001a, 0x00ce001a, 0x00da001a, 0x00e7001a, 0x00f4001a, 0x0101001a,
+    0x010e0033, 0x01280033, 0x01410033, 0x015b0033, 0x01750033, 0x018f0033, 0x01a80033, 0x01c20033,
+    0x01dc0067, 0x020f0067, 0x02430067, 0x02760067, 0x02aa0067, 0x02dd0067, 0x03110067, 0x03440067,
+    0x037800ce, 0x03df00ce, 0x044600ce, 0x04ad00ce, 0x051400ce, 0x057b00c5, 0x05dd00bc, 0x063b00b5,
+    0x06970158, 0x07420142, 0x07e30130, 0x087b0120, 0x090b0112, 0x09940106, 0x0a1700fc, 0x0a9500f2,
+    0x0b0f01cb, 0x0bf401ae, 0x0ccb0195, 0x0d950180, 0x0e56016e, 0x0f0d015e, 0x0fbc0150, 0x10630143,
+    0x11070264, 0x1238023e, 0x1357021d, 0x14660201, 0x156601e9, 0x165a01d3, 0x174401c0, 0x182401af,
+    0x18fe0331, 0x1a9602fe, 0x1c1502d2, 0x1d7e02ad, 0x1ed4028d, 0x201a0270, 0x21520256, 0x227d0240,
+    0x239f0443, 0x25c003fe, 0x27bf03c4, 0x29a10392, 0x2b6a0367, 0x2d1d0341, 0x2ebe031f, 0x304d0300,
+    0x31d105b0, 0x34a80555, 0x37520507, 0x39d504c5, 0x3c37048b, 0x3e7c0458, 0x40a8042a, 0x42bd0401,
+    0x44c20798, 0x488e071e, 0x4c1c06b6, 0x4f76065d, 0x52a50610, 0x55ac05cc, 0x5892058f, 0x5b590559,
+    0x5e0c0a23, 0x631c0980, 0x67db08f6, 0x6c55087f, 0x70940818, 0x74a007bd, 0x787d076c, 0x7c330723,
+};
+
+#define LINEAR_TO_SRGB_MIN_BITS      ((127u - 13u) << 23)  // 2^-13.
+#define LINEAR_TO_SRGB_ALMOST_ONE    0x3F7FFFFFu           // Largest float below 1.
+
+#define BLEND_TABLE_MIN_PIXELS       1024  // Blending the 256 entries costs about as much as this many pixels the direct way.
+
+
+inline f32 SrgbToLinear(u8 value)
+{
+    return srgb_to_linear_table[value];
+}
+
+inline u8 LinearToSrgb(f32 value)
+{
+    u32 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    if (bits < LINEAR_TO_SRGB_MIN_BITS)
+        bits = LINEAR_TO_SRGB_MIN_BITS;
+    // Negative values and NaN land here too, as integers they're above 1.0f.
+    if (bits > LINEAR_TO_SRGB_ALMOST_ONE)
+        bits = value > 0.0f ? LINEAR_TO_SRGB_ALMOST_ONE : LINEAR_TO_SRGB_MIN_BITS;
+
+    u32 entry = linear_to_srgb_table[(bits - LINEAR_TO_SRGB_MIN_BITS) >> 20];
+    u32 bias  = (entry >> 16) << 9;
+    u32 scale = entry & 0xFFFF;
+    u32 t     = (bits >> 12) & 0xFF;
+    return cast((bias + scale * t) >> 16, u8);
+}
+
+
+// ---- BLENDING ----
+// Every pixel becomes 'pixel * keep + color', in linear light, where 'color' is the linear
+// source color already multiplied by its alpha and 'keep' is 1 - alpha. Color channels are the
+// first three bytes of a pixel on every platform; alpha (the fourth) is left as it is.
+static void BlendRowLinearScalar(u8* row, u32 count, const f32 color[3], f32 keep)
+{
+    for (u32 i = 0; i < count; ++i)
+    {
+        u8* pixel = row + i * 4;
+        for (u32 channel = 0; channel < 3; ++channel)
+            pixel[channel] = LinearToSrgb(SrgbToLinear(pixel[channel]) * keep + color[channel]);
+    }
+}
+
+#if defined(SIMD_SSE2)
+
+// Four linear values to sRGB8, one in the low byte of each 32-bit lane.
+static inline __m128i LinearToSrgb4(__m128 value)
+{
+    const __m128 min_value = _mm_castsi128_ps(_mm_set1_epi32(LINEAR_TO_SRGB_MIN_BITS));
+    const __m128 max_value = _mm_castsi128_ps(_mm_set1_epi32(LINEAR_TO_SRGB_ALMOST_ONE));
+
+    // max first, so NaN becomes the minimum.
+    __m128i bits = _mm_castps_si128(_mm_min_ps(_mm_max_ps(value, min_value), max_value));
+    __m128i index = _mm_srli_epi32(_mm_sub_epi32(bits, _mm_set1_epi32(LINEAR_TO_SRGB_MIN_BITS)), 20);
+
+    // No gathers in SSE2.
+    u32 indices[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(indices), index);
+    __m128i entry = _mm_setr_epi32(cast(linear_to_srgb_table[indices[0]], s32), cast(linear_to_srgb_table[indices[1]], s32),
+                                   cast(linear_to_srgb_table[indices[2]], s32), cast(linear_to_srgb_table[indices[3]], s32));
+
+    __m128i bias  = _mm_slli_epi32(_mm_srli_epi32(entry, 16), 9);
+    __m128i scale = _mm_and_si128(entry, _mm_set1_epi32(0xFFFF));
+    __m128i t     = _mm_and_si128(_mm_srli_epi32(bits, 12), _mm_set1_epi32(0xFF));
+    // Both fit in the low 16 bits of each lane (scale < 2^15), so this is scale * t.
+    __m128i product = _mm_madd_epi16(scale, t);
+    return _mm_srli_epi32(_mm_add_epi32(bias, product), 16);
+}
+
+static void BlendRowLinear(u8* row, u32 count, const f32 color[3], f32 keep)
+{
+    const f32* table = srgb_to_linear_table;
+    __m128 keep4  = _mm_set1_ps(keep);
+    __m128 red    = _mm_set1_ps(color[0]);
+    __m128 green  = _mm_set1_ps(color[1]);
+    __m128 blue   = _mm_set1_ps(color[2]);
+    __m128i alpha_mask = _mm_set1_epi32(cast(0xFF000000u, s32));
+
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        u8* p = row + i * 4;
+        __m128 c0 = _mm_setr_ps(table[p[0]], table[p[4]], table[p[8]],  table[p[12]]);
+        __m128 c1 = _mm_setr_ps(table[p[1]], table[p[5]], table[p[9]],  table[p[13]]);
+        __m128 c2 = _mm_setr_ps(table[p[2]], table[p[6]], table[p[10]], table[p[14]]);
+
+        c0 = _mm_add_ps(_mm_mul_ps(c0, keep4), red);
+        c1 = _mm_add_ps(_mm_mul_ps(c1, keep4), green);
+        c2 = _mm_add_ps(_mm_mul_ps(c2, keep4), blue);
+
+        __m128i* address = reinterpret_cast<__m128i*>(p);
+        __m128i result = _mm_and_si128(_mm_loadu_si128(address), alpha_mask);
+        result = _mm_or_si128(result, LinearToSrgb4(c0));
+        result = _mm_or_si128(result, _mm_slli_epi32(LinearToSrgb4(c1), 8));
+        result = _mm_or_si128(result, _mm_slli_epi32(LinearToSrgb4(c2), 16));
+        _mm_storeu_si128(address, result);
+    }
+    BlendRowLinearScalar(row + i * 4, count - i, color, keep);
+}
+
+#elif defined(SIMD_NEON)
+
+static inline uint32x4_t LinearToSrgb4(float32x4_t value)
+{
+    const float32x4_t min_value = vreinterpretq_f32_u32(vdupq_n_u32(LINEAR_TO_SRGB_MIN_BITS));
+    const float32x4_t max_value = vreinterpretq_f32_u32(vdupq_n_u32(LINEAR_TO_SRGB_ALMOST_ONE));
+
+    // vmaxnm returns the number when the other operand is NaN.
+    uint32x4_t bits  = vreinterpretq_u32_f32(vminq_f32(vmaxnmq_f32(value, min_value), max_value));
+    uint32x4_t index = vshrq_n_u32(vsubq_u32(bits, vdupq_n_u32(LINEAR_TO_SRGB_MIN_BITS)), 20);
+
+    u32 indices[4];
+    vst1q_u32(indices, index);
+    u32 entries[4] = { linear_to_srgb_table[indices[0]], linear_to_srgb_table[indices[1]],
+                       linear_to_srgb_table[indices[2]], linear_to_srgb_table[indices[3]] };
+    uint32x4_t entry = vld1q_u32(entries);
+
+    uint32x4_t bias  = vshlq_n_u32(vshrq_n_u32(entry, 16), 9);
+    uint32x4_t scale = vandq_u32(entry, vdupq_n_u32(0xFFFF));
+    uint32x4_t t     = vandq_u32(vshrq_n_u32(bits, 12), vdupq_n_u32(0xFF));
+    return vshrq_n_u32(vmlaq_u32(bias, scale, t), 16);
+}
+
+static void BlendRowLinear(u8* row, u32 count, const f32 color[3], f32 keep)
+{
+    const f32* table = srgb_to_linear_table;
+    float32x4_t keep4 = vdupq_n_f32(keep);
+    float32x4_t red   = vdupq_n_f32(color[0]);
+    float32x4_t green = vdupq_n_f32(color[1]);
+    float32x4_t blue  = vdupq_n_f32(color[2]);
+
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        u8* p = row + i * 4;
+        f32 l0[4] = { table[p[0]], table[p[4]], table[p[8]],  table[p[12]] };
+        f32 l1[4] = { table[p[1]], table[p[5]], table[p[9]],  table[p[13]] };
+        f32 l2[4] = { table[p[2]], table[p[6]], table[p[10]], table[p[14]] };
+
+        float32x4_t c0 = vmlaq_f32(red,   vld1q_f32(l0), keep4);
+        float32x4_t c1 = vmlaq_f32(green, vld1q_f32(l1), keep4);
+        float32x4_t c2 = vmlaq_f32(blue,  vld1q_f32(l2), keep4);
+
+        u32* address = reinterpret_cast<u32*>(p);
+        uint32x4_t result = vandq_u32(vld1q_u32(address), vdupq_n_u32(0xFF000000u));
+        result = vorrq_u32(result, LinearToSrgb4(c0));
+        result = vorrq_u32(result, vshlq_n_u32(LinearToSrgb4(c1), 8));
+        result = vorrq_u32(result, vshlq_n_u32(LinearToSrgb4(c2), 16));
+        vst1q_u32(address, result);
+    }
+    BlendRowLinearScalar(row + i * 4, count - i, color, keep);
+}
+
+#else
+
+static void BlendRowLinear(u8* row, u32 count, const f32 color[3], f32 keep)
+{
+    BlendRowLinearScalar(row, count, color, keep);
+}
+
+#endif
+
+
+// Blends runs of pixels that are contiguous in the layout, so rows of linear and tiled
+// framebuffers still go through the SIMD path.
+template <typename Layout>
+static void BlendRectangleIn(FrameBuffer& framebuffer, s32 left, s32 top, s32 right, s32 bottom, const f32 source[3], f32 keep)
+{
+    for (s32 y = top; y < bottom; ++y)
+    {
+        Pixel* row = framebuffer.pixels + Layout::RowOffset(framebuffer, y);
+        for (s32 x = left; x < right; )
+        {
+            s32 end = (x / Layout::SPAN + 1) * Layout::SPAN;
+            if (end > right || end < x)
+                end = right;
+            BlendRowLinear(reinterpret_cast<u8*>(row + Layout::ColumnOffset(x)), cast(end - x, u32), source, keep);
+            x = end;
+        }
+    }
+}
+
+// Every channel's result for every byte, by blending a row of 256 pixels with all channels
+// set to the byte, so it's exactly what 'BlendRowLinear' gives.
+static void BuildBlendTable(Pixel table[256], const f32 source[3], f32 keep)
+{
+    u8* bytes = reinterpret_cast<u8*>(table);
+    for (u32 i = 0; i < 256; ++i)
+        memset(bytes + i * 4, cast(i, int), 4);
+    BlendRowLinear(bytes, 256, source, keep);
+}
+
+template <typename Layout>
+static void BlendRectangleTableIn(FrameBuffer& framebuffer, s32 left, s32 top, s32 right, s32 bottom, const Pixel table[256])
+{
+    const u8* results = reinterpret_cast<const u8*>(table);
+    for (s32 y = top; y < bottom; ++y)
+    {
+        Pixel* row = framebuffer.pixels + Layout::RowOffset(framebuffer, y);
+        for (s32 x = left; x < right; )
+        {
+            s32 end = (x / Layout::SPAN + 1) * Layout::SPAN;
+            if (end > right || end < x)
+                end = right;
+            u8* pixel = reinterpret_cast<u8*>(row + Layout::ColumnOffset(x));
+            for (s32 i = 0; i < end - x; ++i, pixel += 4)
+            {
+                pixel[0] = results[pixel[0] * 4 + 0];
+                pixel[1] = results[pixel[1] * 4 + 1];
+                pixel[2] = results[pixel[2] * 4 + 2];
+            }
+            x = end;
+        }
+    }
+}
+
+// Draws 'color' over the framebuffer with 'alpha' (0 is invisible, 1 is opaque), blending in
+// linear light.
+void BlendRectangle(FrameBuffer& framebuffer, s32 left, s32 top, s32 right, s32 bottom, Pixel color, f32 alpha)
+{
+    if (left < 0) left = 0;
+    if (top  < 0) top  = 0;
+    if (right  > framebuffer.width)  right  = framebuffer.width;
+    if (bottom > framebuffer.height) bottom = framebuffer.height;
+    if (left >= right || top >= bottom || !(alpha > 0.0f))
+        return;
+    if (alpha > 1.0f)
+        alpha = 1.0f;
+
+    u8 channels[4];
+    memcpy(channels, &color, sizeof(channels));
+    f32 source[3];
+    for (u32 channel = 0; channel < 3; ++channel)
+        source[channel] = SrgbToLinear(channels[channel]) * alpha;
+
+    f32 keep = 1.0f - alpha;
+    if (cast(right - left, u64) * (bottom - top) >= BLEND_TABLE_MIN_PIXELS)
+    {
+        Pixel table[256];
+        BuildBlendTable(table, source, keep);
+        switch (framebuffer.layout)
+        {
+            case FRAMEBUFFER_LINEAR:    BlendRectangleTableIn<LinearLayout> (framebuffer, left, top, right, bottom, table); break;
+            case FRAMEBUFFER_TILED_8:   BlendRectangleTableIn<Tiled8Layout> (framebuffer, left, top, right, bottom, table); break;
+            case FRAMEBUFFER_TILED_32:  BlendRectangleTableIn<Tiled32Layout>(framebuffer, left, top, right, bottom, table); break;
+            case FRAMEBUFFER_MORTON_32: BlendRectangleTableIn<MortonLayout> (framebuffer, left, top, right, bottom, table); break;
+        }
+        return;
+    }
+
+    switch (framebuffer.layout)
+    {
+        case FRAMEBUFFER_LINEAR:    BlendRectangleIn<LinearLayout> (framebuffer, left, top, right, bottom, source, keep); break;
+        case FRAMEBUFFER_TILED_8:   BlendRectangleIn<Tiled8Layout> (framebuffer, left, top, right, bottom, source, keep); break;
+        case FRAMEBUFFER_TILED_32:  BlendRectangleIn<Tiled32Layout>(framebuffer, left, top, right, bottom, source, keep); break;
+        case FRAMEBUFFER_MORTON_32: BlendRectangleIn<MortonLayout> (framebuffer, left, top, right, bottom, source, keep); break;
+    }
+}
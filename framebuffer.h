@@ -0,0 +1,103 @@
+#pragma once
+
+// Addressing of the framebuffer layouts (see 'FrameBufferLayout' in main.h).
+//
+// With rows one after another, a tall shape touches a new cache line on every row, and a new
+// page every row or two at common widths. Tiled layouts keep a small square of pixels together
+// instead, so tall, diagonal and small shapes touch a fraction of the lines and pages:
+//
+//     Tiled:  tiles of SIZE x SIZE pixels, each stored row after row; tiles row after row.
+//     Morton: tiles of 32 x 32 pixels, each stored in Z-order (the bits of x and y interleaved),
+//             so every aligned 2x2, 4x4, 8x8... block in a tile is contiguous.
+//
+// In every layout the index of a pixel separates into 'RowOffset(y) + ColumnOffset(x)'. Draw
+// routines are templates on the layout, work out the row part once per row and only pay for the
+// column part per pixel, which for linear is just 'x'. 'SPAN' is how many pixels of a row are
+// contiguous starting at a multiple of 'SPAN', for routines that work on runs of pixels.
+//
+// The window wants rows, so a host that renders tiled linearizes at present time (see
+// shared/linearize.cpp).
+
+#include "main.h"
+
+
+struct LinearLayout
+{
+    static const s32 SPAN = 1 << 30;
+
+    static inline u64 RowOffset(const FrameBuffer& framebuffer, s32 y)  { return cast(y, u64) * framebuffer.width; }
+    static inline u64 ColumnOffset(s32 x)                               { return cast(x, u64); }
+};
+
+template <u32 LOG2_SIZE>
+struct TiledLayout
+{
+    static const s32 SIZE = 1 << LOG2_SIZE;
+    static const s32 SPAN = SIZE;
+
+    static inline u64 RowOffset(const FrameBuffer& framebuffer, s32 y)
+    {
+        u64 tiles_per_row = cast(framebuffer.width + SIZE - 1, u64) >> LOG2_SIZE;
+        return ((cast(y, u64) >> LOG2_SIZE) * tiles_per_row << (2 * LOG2_SIZE)) + (cast(y & (SIZE - 1), u64) << LOG2_SIZE);
+    }
+    static inline u64 ColumnOffset(s32 x)
+    {
+        return (cast(x, u64) >> LOG2_SIZE << (2 * LOG2_SIZE)) + (x & (SIZE - 1));
+    }
+};
+
+// Spreads the low 5 bits of 'x' to the even bits: 0b11111 becomes 0b0101010101.
+inline u32 SpreadBits5(u32 x)
+{
+    x &= 0x1F;
+    x = (x | (x << 4)) & 0x10F;
+    x = (x | (x << 2)) & 0x133;
+    x = (x | (x << 1)) & 0x155;
+    return x;
+}
+
+struct MortonLayout
+{
+    static const s32 SIZE = 32;
+    static const s32 SPAN = 2;  // x's lowest bit is the index's lowest bit.
+
+    static inline u64 RowOffset(const FrameBuffer& framebuffer, s32 y)
+    {
+        u64 tiles_per_row = cast(framebuffer.width + SIZE - 1, u64) >> 5;
+        return ((cast(y, u64) >> 5) * tiles_per_row << 10) + (SpreadBits5(cast(y, u32)) << 1);
+    }
+    static inline u64 ColumnOffset(s32 x)
+    {
+        return (cast(x, u64) >> 5 << 10) + SpreadBits5(cast(x, u32));
+    }
+};
+
+typedef TiledLayout<3> Tiled8Layout;
+typedef TiledLayout<5> Tiled32Layout;
+
+
+// Side of the tiles of 'layout', 1 for linear.
+inline s32 FrameBufferTileSize(FrameBufferLayout layout)
+{
+    switch (layout)
+    {
+        case FRAMEBUFFER_TILED_8:   return 8;
+        case FRAMEBUFFER_TILED_32:  return 32;
+        case FRAMEBUFFER_MORTON_32: return 32;
+        default:                    return 1;
+    }
+}
+
+// Number of pixels to allocate for a framebuffer, with the size padded up to whole tiles.
+inline u64 FrameBufferPixelCount(s32 width, s32 height, FrameBufferLayout layout)
+{
+    s32 tile = FrameBufferTileSize(layout);
+    u64 padded_width  = cast((width  + tile - 1) / tile * tile, u64);
+    u64 padded_height = cast((height + tile - 1) / tile * tile, u64);
+    return padded_width * padded_height;
+}
+
+inline u64 FrameBufferPixelCount(const FrameBuffer& framebuffer)
+{
+    return FrameBufferPixelCount(framebuffer.width, framebuffer.height, framebuffer.layout);
+}
@@ -0,0 +1,63 @@
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+#define SECONDS_TO_MILLI(x) ((x)*1000)
+#define SECONDS_TO_MICRO(x) ((x)*1000000)
+#define SECONDS_TO_NANO(x)  ((x)*1000000000)
+#define MILLI_TO_SECONDS(x) ((x)/1000)
+#define MILLI_TO_MICRO(x)   ((x)*1000)
+#define MILLI_TO_NANO(x)    ((x)*1000000)
+#define MICRO_TO_SECONDS(x) ((x)/1000000)
+#define MICRO_TO_MILLI(x)   ((x)/1000)
+#define MICRO_TO_NANO(x)    ((x)*1000)
+#define NANO_TO_SECONDS(x)  ((x)/1000000000)
+#define NANO_TO_MILLI(x)    ((x)/1000000)
+#define NANO_TO_MICRO(x)    ((x)/1000)
+
+
+// Monotonic nanoseconds since some unspecified point. Safe to call from any thread.
+u64 NanoTime()
+{
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return cast(time.tv_sec, u64) * 1000000000ULL + time.tv_nsec;
+}
+
+// NOTE(ted): On x86 this is the time stamp counter, which ticks at a constant rate regardless
+// of the current clock speed, so it's "reference cycles" rather than core cycles.
+u64 CycleCount()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    u64 ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return NanoTime();
+#endif
+}
+
+// Sleeps until 'period' nanoseconds have passed since the last call (if it hasn't already), and
+// returns how long it actually was.
+u64 Tick(u64& last_time, u64 period)
+{
+    u64 now = NanoTime();
+    if (now - last_time < period)
+    {
+        u64 remaining = period - (now - last_time);
+        timespec sleep_time;
+        sleep_time.tv_sec  = NANO_TO_SECONDS(remaining);
+        sleep_time.tv_nsec = remaining % SECONDS_TO_NANO(1);
+        nanosleep(&sleep_time, 0);
+        now = NanoTime();
+    }
+
+    u64 duration = now - last_time;
+    last_time = now;
+    return duration;
+}
@@ -0,0 +1,63 @@
+#include <dlfcn.h>     // dlopen, dlsym, dlerror
+#include <limits.h>    // PATH_MAX
+#include <unistd.h>    // readlink
+#include <sys/stat.h>
+
+
+// RESULT MUST BE FREED
+const char* GetNameByExecutable(const char* name)
+{
+    char* path = cast(malloc(PATH_MAX + strlen(name) + 1), char*);
+
+    ssize_t size = readlink("/proc/self/exe", path, PATH_MAX);
+    if (size < 0)
+        size = 0;
+    path[size] = '\0';
+
+    // Cut off executable name.
+    char* slash = strrchr(path, '/');
+    char* end   = slash ? slash + 1 : path;
+    strcpy(end, name);
+
+    return path;
+}
+
+static void* LoadDLLFunction(void* dll, const char* name)
+{
+    void* function = dlsym(dll, name);
+    if (!function)
+        printf("Couldn't load function '%s'. %s\n", name, dlerror());
+    return function;
+}
+
+Game TryLoadGame(const char* path)
+{
+    static void* dll_handle = nullptr;
+
+    if (dll_handle)
+        ASSERT(!dlclose(dll_handle), "Couldn't close dll. %s\n", dlerror());
+
+    dll_handle = dlopen(path, RTLD_LOCAL|RTLD_NOW);
+    ASSERT(dll_handle, "Couldn't load dll. %s\n", dlerror());
+
+    Game result;
+    result.initialize = reinterpret_cast<InitializeFunction>(LoadDLLFunction(dll_handle, "Initialize"));
+    result.update     = reinterpret_cast<UpdateFunction>(LoadDLLFunction(dll_handle, "Update"));
+    result.sound      = reinterpret_cast<SoundFunction>(LoadDLLFunction(dll_handle, "Sound"));
+
+    if (!result.initialize) result.initialize = DEFAULT_Initialize;
+    if (!result.update)     result.update     = DEFAULT_Update;
+    if (!result.sound)      result.sound      = DEFAULT_Sound;
+
+    return result;
+}
+
+// Returns the modification time of 'path', or 0 if it doesn't exist. Compare it between frames
+// to know when the game has been rebuilt.
+u64 GetFileTime(const char* path)
+{
+    struct stat info;
+    if (stat(path, &info) != 0)
+        return 0;
+    return cast(info.st_mtim.tv_sec, u64) * 1000000000ULL + info.st_mtim.tv_nsec;
+}
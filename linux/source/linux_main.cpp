@@ -0,0 +1,362 @@
+// Headless host. Runs the game without a window or sound card, so it can be run on build
+// machines and over ssh: frames are rendered into a framebuffer in memory, audio is written
+// to a wave file, and frames can be recorded with '--capture'.
+//
+// By default the game runs as fast as it can on a simulated clock (every frame is exactly one
+// frame period later than the previous one), so runs are reproducible and audio stays in sync.
+// '--realtime' sleeps between frames like the windowed hosts do.
+//
+// '--counters' samples the hardware performance counters around the timed blocks (update,
+// sound, ...), writes them per block and frame to a CSV file and prints a summary with
+// instructions per cycle and miss rates. Without hardware counters it's cycles only.
+//
+// '--layout' has the game render into a tiled framebuffer (see framebuffer.h), which is turned
+// into rows before it's captured, like a windowed host would before presenting.
+//
+// '--flight' keeps the last few seconds of frames in a flight recorder (see
+// shared/flight_recorder.cpp), which dumps them when a frame takes longer than the budget
+// ('--flight-budget', a frame period by default). '--replay' runs a dump again: the same frames,
+// from the same memory and with the same input, reporting how long they take now.
+//
+// The game's bitmaps are reloaded when their files change (see shared/assets.cpp), so run with
+// '--realtime' and edit them to see it. '--assets' points it at another directory.
+//
+// '--metrics' exports percentiles of the frame time, the timed blocks, the audio fill level and
+// the I/O latency every '--metrics-period' to a file or a Unix socket (see shared/metrics.cpp).
+//
+// '--overlay' draws the debug overlay (see shared/overlay.cpp) on the presented frame, so it's
+// in the captures, and its cost shows up as the 'overlay' block.
+
+#include "main.h"
+#include "clock.cpp"
+#include "shared/metrics.cpp"
+#include "shared/perf_counters.cpp"
+#include "shared/profiler.cpp"
+
+#include <string.h>
+
+
+struct Game
+{
+    InitializeFunction initialize;
+    UpdateFunction     update;
+    SoundFunction      sound;
+};
+static Game game;
+static Memory memory;
+
+#include "hotloader.cpp"
+
+#include "shared/audio_latency.cpp"
+#include "shared/wave_sink.cpp"
+#include "shared/virtual_memory.cpp"
+#include "shared/overlay.cpp"
+#include "shared/async_io.cpp"
+#include "shared/mapped_file.cpp"
+#include "shared/lz.cpp"
+#include "shared/frame_capture.cpp"
+#include "shared/linearize.cpp"
+#include "shared/assets.cpp"
+#include "shared/flight_recorder.cpp"
+
+
+
+int main(int argc, char* argv[])
+{
+    // ---- PARSE ARGUMENTS ----
+    //     --frames <n>            Frames to run before exiting (default 600).
+    //     --width <n>             Framebuffer size (default 512x512).
+    //     --height <n>
+    //     --fps <n>               Frame rate of the simulated clock (default 30).
+    //     --realtime              Run at the frame rate instead of as fast as possible.
+    //     --game <path>           Game library (default libGame.so next to the executable).
+    //     --audio-file <path>     Write the game's audio to a wave file.
+    //     --capture <path>        Record every frame to a capture file.
+    //     --layout <name>         linear (default), tiled8, tiled32 or morton32.
+    //     --counters <path>       Sample hardware counters per timed block, write them to a CSV file.
+    //     --assets <path>         Directory the game's assets are loaded from (default the source tree's resources).
+    //     --flight <prefix>       Dump the last frames to '<prefix>-<n>.flight' when a frame is over budget.
+    //     --flight-budget <ms>    Budget for '--flight' (default a frame period).
+    //     --replay <path>         Replay a flight recorder dump instead of running from the start.
+    //     --metrics <path>        Export the metrics periodically to a file, or 'unix:<path>' for a socket.
+    //     --metrics-period <ms>   Period for '--metrics' (default 1000).
+    //     --overlay               Draw the debug overlay on every frame.
+    u32  frame_count  = 600;
+    s32  width        = 512;
+    s32  height       = 512;
+    u32  fps          = 30;
+    bool realtime     = false;
+    bool show_overlay = false;
+    const char* game_path    = 0;
+    const char* audio_file   = 0;
+    const char* capture_file = 0;
+    const char* counters_file = 0;
+    const char* asset_directory = 0;
+    const char* flight_prefix   = 0;
+    const char* replay_file     = 0;
+    const char* metrics_destination = 0;
+    f64  flight_budget_ms  = 0;
+    u64  metrics_period_ms = 1000;
+    FrameBufferLayout layout = FRAMEBUFFER_LINEAR;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--realtime") == 0)
+            realtime = true;
+        else if (strcmp(argv[i], "--overlay") == 0)
+            show_overlay = true;
+        else if (i + 1 < argc && strcmp(argv[i], "--frames") == 0)
+            frame_count = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--width") == 0)
+            width = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--height") == 0)
+            height = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--fps") == 0)
+            fps = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--game") == 0)
+            game_path = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--audio-file") == 0)
+            audio_file = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--capture") == 0)
+            capture_file = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--counters") == 0)
+            counters_file = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--assets") == 0)
+            asset_directory = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--flight") == 0)
+            flight_prefix = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--flight-budget") == 0)
+            flight_budget_ms = atof(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--replay") == 0)
+            replay_file = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--metrics") == 0)
+            metrics_destination = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--metrics-period") == 0)
+            metrics_period_ms = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--layout") == 0)
+        {
+            const char* name = argv[++i];
+            if      (strcmp(name, "linear")   == 0) layout = FRAMEBUFFER_LINEAR;
+            else if (strcmp(name, "tiled8")   == 0) layout = FRAMEBUFFER_TILED_8;
+            else if (strcmp(name, "tiled32")  == 0) layout = FRAMEBUFFER_TILED_32;
+            else if (strcmp(name, "morton32") == 0) layout = FRAMEBUFFER_MORTON_32;
+            else
+                fprintf(stderr, "Unknown layout '%s'.\n", name);
+        }
+        else
+            fprintf(stderr, "Unknown argument '%s'.\n", argv[i]);
+    }
+    if (fps == 0 || width <= 0 || height <= 0)
+    {
+        fprintf(stderr, "Invalid size or frame rate.\n");
+        return 1;
+    }
+    u64 frame_period = SECONDS_TO_NANO(1ULL) / fps;
+
+    // A replay runs the recorded frames, at the recorded size.
+    FlightDump replay = {};
+    if (replay_file)
+    {
+        if (!LoadFlightDump(replay, replay_file))
+            return 1;
+        frame_count = replay.header.frame_count;
+        width       = replay.header.width;
+        height      = replay.header.height;
+        layout      = cast(replay.header.layout, FrameBufferLayout);
+    }
+
+    // ---- INITIALIZE MEMORY ----
+    // LEAK(ted): Never freed, as it'll likely live to the end of the program.
+    if (!AllocateGameMemory(memory, GIGABYTES(8), GIGABYTES(8), TERABYTES(2)))
+        return 1;
+
+    // ---- INITIALIZE METRICS ----
+    u32 frame_time_metric = RegisterMetric("frame_time", "ns");
+    if (metrics_destination && !StartMetricsExport(metrics_destination, MILLI_TO_NANO(metrics_period_ms)))
+        return 1;
+
+    // ---- INITIALIZE PLATFORM SERVICES ----
+    InitializeAsyncIO(memory.platform);
+    InitializeMappedFiles(memory.platform);
+    if (!InitializeAssets(memory.platform, asset_directory))
+        return 1;
+
+    // ---- INITIALIZE GAME ----
+    if (!game_path)
+        game_path = GetNameByExecutable("libGame.so");  // LEAK(ted): Making static for now.
+    game = TryLoadGame(game_path);
+    u64 game_time = GetFileTime(game_path);
+
+    game.initialize(memory);
+
+    // After 'Initialize', so the host has loaded the assets the recorded state refers to.
+    if (replay_file && !RestoreFlightSnapshot(memory, replay))
+        return 1;
+
+    // ---- INITIALIZE FRAMEBUFFER ----
+    FrameBuffer framebuffer;
+    framebuffer.width  = width;
+    framebuffer.height = height;
+    framebuffer.layout = layout;
+    framebuffer.pixels = cast(calloc(FrameBufferPixelCount(framebuffer), sizeof(Pixel)), Pixel*);  // LEAK(ted): Lives until exit.
+    KeyBoard keyboard  = {0};
+
+    // What a window would show. The game's framebuffer itself unless it's tiled.
+    FrameBuffer present = framebuffer;
+    if (layout != FRAMEBUFFER_LINEAR)
+    {
+        present.layout = FRAMEBUFFER_LINEAR;
+        present.pixels = cast(calloc(cast(width, u64) * height, sizeof(Pixel)), Pixel*);  // LEAK(ted): Lives until exit.
+    }
+
+    // ---- INITIALIZE OUTPUTS ----
+    WaveSink wave_sink = {0};
+    if (audio_file && !OpenWaveSink(wave_sink, audio_file, DefaultAudioSettings()))
+        return 1;
+
+    FrameCapture capture = {0};
+    if (capture_file && !OpenFrameCapture(capture, capture_file, width, height))
+        return 1;
+    capture.wait_when_full = !realtime;  // Time is simulated, so keep every frame instead.
+
+    if (counters_file)
+    {
+        if (!ProfilerExport(counters_file))
+            return 1;
+        EnablePerfCounters();
+        const char* status = PerfCountersStatus();
+        if (status[0])
+            fprintf(stderr, "[Warning]: %s.\n", status);
+    }
+
+    FlightRecorder* flight = cast(calloc(1, sizeof(FlightRecorder)), FlightRecorder*);  // LEAK(ted): Lives until exit.
+    if (flight_prefix)
+    {
+        u64 budget = flight_budget_ms > 0 ? cast(flight_budget_ms * 1000000.0, u64) : frame_period;
+        if (!OpenFlightRecorder(*flight, flight_prefix, budget, framebuffer))
+            return 1;
+    }
+
+    // The overlay's atlas lives in an arena of its own, so it's not part of the game's memory.
+    Overlay overlay = {0};
+    Buffer  debug_arena;
+    if (show_overlay && (!AllocateArena(debug_arena, MEGABYTES(2)) || !InitializeOverlay(overlay, debug_arena, frame_period)))
+        return 1;
+
+    // ---- RUN ----
+    u64 spike_time = 0;  // Of the recorded spike, when replaying.
+    u64 start      = NanoTime();
+    u64 last_time  = start;
+    for (u32 frame = 0; frame < frame_count; ++frame)
+    {
+        u64 frame_start = NanoTime();
+        u64 now = realtime ? frame_start : start + frame * frame_period;
+
+        // Rebuilding the game replaces the library, so pick it up like the windowed hosts.
+        u64 time = GetFileTime(game_path);
+        if (time != game_time && time != 0)
+        {
+            game      = TryLoadGame(game_path);
+            game_time = time;
+        }
+        SwapAssets();
+        if (replay_file)
+            FlightReplayKeyboard(replay, frame, keyboard);
+
+        FlightBeginFrame(*flight, memory);
+
+        {
+            TIMED_BLOCK("update");
+            game.update(memory, framebuffer, keyboard);
+        }
+        if (layout != FRAMEBUFFER_LINEAR)
+        {
+            TIMED_BLOCK("linearize");
+            LinearizeFrameBuffer(framebuffer, present);
+        }
+        if (show_overlay)
+        {
+            // On the rows, as the overlay can't draw tiles.
+            TIMED_BLOCK("overlay");
+            DrawOverlay(overlay, present, memory);
+        }
+        {
+            TIMED_BLOCK("capture");
+            CaptureFrame(capture, present, now);
+        }
+        if (audio_file)
+        {
+            TIMED_BLOCK("sound");
+            UpdateWaveSink(wave_sink, memory, game.sound, now);
+        }
+        ProfilerEndFrame();
+
+        u64 frame_time = NanoTime() - frame_start;
+        RecordMetric(frame_time_metric, frame_time);
+        OverlayRecordFrame(overlay, frame_time);
+        FlightEndFrame(*flight, memory, keyboard, frame_time);
+        if (replay_file && frame == replay.header.spike)
+            spike_time = frame_time;
+        if (realtime)
+            Tick(last_time, frame_period);
+    }
+    u64 elapsed = NanoTime() - start;
+
+    CloseWaveSink(wave_sink);
+    CloseFrameCapture(capture);
+    ProfilerCloseExport();
+    CloseAssets();
+    CloseFlightRecorder(*flight);
+    StopMetricsExport();
+
+    // ---- REPORT ----
+    if (replay_file && frame_count > 0)
+    {
+        u32 spike = replay.header.spike;
+        printf("Replayed spike    : frame %llu took %.3f ms when recorded, %.3f ms now\n",
+               cast(replay.frames[spike].frame, unsigned long long),
+               replay.frames[spike].nanoseconds / 1000000.0, spike_time / 1000000.0);
+    }
+    if (frame_count > 0)
+    {
+        const Histogram& frame_times = MetricTotal(frame_time_metric);
+        const Histogram& update      = MetricTotal(RegisterMetric("update", "cycles"));
+        printf("Frames            : %u in %.3f s (%.1f frames per second)\n",
+               frame_count, elapsed / 1000000000.0, frame_count * 1000000000.0 / elapsed);
+        printf("Nanos per frame   : %llu | %llu | %llu | %llu | %llu\n",
+               cast(frame_times.min, unsigned long long), cast(HistogramPercentile(frame_times, 25), unsigned long long),
+               cast(HistogramPercentile(frame_times, 50), unsigned long long), cast(HistogramPercentile(frame_times, 75), unsigned long long),
+               cast(frame_times.max, unsigned long long));
+        printf("Update cycles     : p50 %llu | p99 %llu | max %llu\n",
+               cast(HistogramPercentile(update, 50), unsigned long long), cast(HistogramPercentile(update, 99), unsigned long long),
+               cast(update.max, unsigned long long));
+        if (audio_file)
+            printf("Audio glitches    : %u\n", wave_sink.glitches);
+        if (capture_file)
+        {
+            CaptureStats stats = GetCaptureStats(capture);
+            printf("Captured frames   : %llu (%llu dropped)\n",
+                   cast(stats.frames_encoded, unsigned long long), cast(stats.frames_dropped, unsigned long long));
+        }
+        AssetStats asset_stats = GetAssetStats();
+        if (asset_stats.reloads + asset_stats.unchanged + asset_stats.failed > 0)
+        {
+            printf("Asset reloads     : %u (%u unchanged, %u failed), swap latency %.2f ms mean, %.2f ms max\n",
+                   asset_stats.reloads, asset_stats.unchanged, asset_stats.failed,
+                   asset_stats.reloads ? asset_stats.swap_latency_total / 1000000.0 / asset_stats.reloads : 0.0,
+                   asset_stats.swap_latency_max / 1000000.0);
+        }
+        if (flight_prefix)
+        {
+            FlightStats flight_stats = GetFlightStats(*flight);
+            printf("Flight recorder   : %u frames over budget, %u dumped (%u skipped)\n",
+                   flight_stats.spikes, flight_stats.dumps, flight_stats.skipped);
+        }
+        if (counters_file)
+        {
+            printf("\n");
+            ProfilerPrintCounters(stdout);
+        }
+    }
+
+    return 0;
+}
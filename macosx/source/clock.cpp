@@ -87,6 +87,16 @@ bool Timer(NanoClock& clock, u64 time)
     return false;
 }
 
+// Monotonic nanoseconds since some unspecified point. Safe to call from any thread.
+u64 NanoTime()
+{
+    static mach_timebase_info_data_t info;
+    if (info.denom == 0)
+        mach_timebase_info(&info);
+
+    return cast((mach_absolute_time() * info.numer) / cast(info.denom, f64), u64);
+}
+
 
 u64 CycleCount()
 {
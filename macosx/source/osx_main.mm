@@ -3,6 +3,9 @@
 
 #include "main.h"
 #include "clock.cpp"
+#include "shared/metrics.cpp"
+#include "shared/perf_counters.cpp"
+#include "shared/profiler.cpp"
 
 // Declared in main.h
 // #include <stdlib.h>
@@ -31,12 +34,24 @@ static KeyBoard keyboard;
 // TODO(ted): Requires global framebuffer and keyboard.
 #include "window.mm"
 
+#include "shared/audio_latency.cpp"
+#include "shared/wave_sink.cpp"
+
 // TODO(ted): Requires global game object. Pass it in as 'user_data'.
 #include "sound.cpp"
 
 // TODO(ted): Requires global game object.
 #include "hotloader.cpp"
 
+#include "shared/virtual_memory.cpp"
+#include "shared/async_io.cpp"
+#include "shared/mapped_file.cpp"
+#include "shared/overlay.cpp"
+#include "shared/lz.cpp"
+#include "shared/frame_capture.cpp"
+#include "shared/assets.cpp"
+#include "shared/flight_recorder.cpp"
+
 
 struct RecordData
 {
@@ -49,75 +64,84 @@ static RecordData record_data;
 
 
 
-void BubbleSort(u64* array, u64 count)
+// Everything's over the second since the previous status.
+void PrintStatus(u32 frames, u32 frame_time_metric, u32 frame_cycles_metric,
+                 AudioLatency& audio, FrameCapture& capture, FlightRecorder& flight)
 {
-    for (u64 i = 0; i < count; ++i)
-    {
-        for (u64 j = i+1; j < count; ++j)
-        {
-            if (array[i] > array[j])
-            {
-                u64 temp = array[i];
-                array[i] = array[j];
-                array[j] = temp;
-            }
-        }
-    }
-}
+    static u32 update_metric = RegisterMetric("update", "cycles");
+    static u32 sound_metric  = RegisterMetric("sound",  "cycles");
+    static MetricWindow frame_time_window, frame_cycles_window, update_window, sound_window, audio_fill_window;
+
+    const Histogram& frame_times  = ReadMetricWindow(frame_time_metric,   frame_time_window);
+    const Histogram& frame_cycles = ReadMetricWindow(frame_cycles_metric, frame_cycles_window);
+    const Histogram& update       = ReadMetricWindow(update_metric,       update_window);
+    const Histogram& sound        = ReadMetricWindow(sound_metric,        sound_window);
+    const Histogram& audio_fill   = ReadMetricWindow(audio.fill_metric,   audio_fill_window);
+    if (frame_times.count == 0)
+        return;
 
+    NSLog(@"---- FRAME STATS ----\n"
+          "\tFrames per second : %u\n"
+          "\tNanos  per frame  : %llu | %llu | %llu | %llu | %llu\n"
+          "\tCycles per frame  : %llu | %llu | %llu | %llu | %llu\n"
+          "\tUpdate cycles     : p50 %llu | p99 %llu | max %llu\n"
+          "\tSound cycles      : p50 %llu | p99 %llu | max %llu\n",
+          frames,
+          frame_times.min, HistogramPercentile(frame_times, 25), HistogramPercentile(frame_times, 50), HistogramPercentile(frame_times, 75), frame_times.max,
+          frame_cycles.min, HistogramPercentile(frame_cycles, 25), HistogramPercentile(frame_cycles, 50), HistogramPercentile(frame_cycles, 75), frame_cycles.max,
+          HistogramPercentile(update, 50), HistogramPercentile(update, 99), update.max,
+          HistogramPercentile(sound, 50), HistogramPercentile(sound, 99), sound.max
+    );
 
-// https://developer.apple.com/library/archive/documentation/Performance/Conceptual/ManagingMemory/Articles/MemoryAlloc.html#//apple_ref/doc/uid/20001881-CJBCFDGA
-u8* AllocateVirtualMemory(vm_offset_t size)
-{
-    // In debug builds, check that we have
-    // correct VM page alignment
-    ASSERT(size != 0, "Cannot allocate 0 bytes.\n");
-    ASSERT((size % 4096) == 0, "You should allocate so you're page aligned (i.e. allocates a multiple of 4096). Tried allocating %lu bytes.\n", size);
+    IOStats io = GetIOStats();
+    NSLog(@"---- IO STATS ----\n"
+          "\tIn flight         : %u\n"
+          "\tBytes per second  : %llu\n"
+          "\tLatency (ns)      : p50 %llu | p90 %llu | p99 %llu | max %llu\n",
+          io.in_flight, io.bytes_per_second,
+          io.latency_p50, io.latency_p90, io.latency_p99, io.latency_max
+    );
 
-    // https://www.gnu.org/software/hurd/gnumach-doc/Memory-Allocation.html
-    vm_address_t  address = TERABYTES(2);
-    kern_return_t error   = vm_allocate((vm_map_t) mach_task_self(), &address, size, false);
+    NSLog(@"---- AUDIO STATS ----\n"
+          "\tLatency (ms)      : %.1f | max %.1f | target %.1f\n"
+          "\tWrite ahead (ms)  : %.1f\n"
+          "\tCallback jitter   : %.2f ms\n"
+          "\tFill (frames)     : min %llu | p1 %llu | p50 %llu\n"
+          "\tUnderruns         : %u\n",
+          audio.latency_ns / 1000000.0, audio.max_latency_ns / 1000000.0,
+          audio.target_frames * 1000.0 / audio.samples_per_second,
+          audio.write_ahead_frames * 1000.0 / audio.samples_per_second,
+          audio.jitter / 1000000.0,
+          audio_fill.min, HistogramPercentile(audio_fill, 1), HistogramPercentile(audio_fill, 50),
+          audio.underruns
+    );
+    ResetAudioLatencyStats(audio);
 
-    if (error != KERN_SUCCESS)
+    if (capture.file)
     {
-        if (error == KERN_INVALID_ADDRESS)
-            ERROR("Address %lu is invalid.\n", address);
-        if (error == KERN_NO_SPACE)
-            ERROR("Not enough space to allocate %lu bytes at the specified address %lu.\n", size, address);
+        CaptureStats stats = GetCaptureStats(capture);
+        NSLog(@"---- CAPTURE STATS ----\n"
+              "\tFrames            : %llu captured | %llu encoded | %llu dropped | %llu skipped\n"
+              "\tCompression       : %.1fx\n"
+              "\tEncode time       : %.2f ms/frame\n",
+              stats.frames_captured, stats.frames_encoded, stats.frames_dropped, stats.frames_skipped,
+              stats.bytes_written ? cast(stats.bytes_raw, f64) / stats.bytes_written : 0.0,
+              stats.frames_encoded ? stats.encode_ns / 1000000.0 / stats.frames_encoded : 0.0
+        );
     }
 
-    memset((u8*)address, 0, size);
-
-
-    // mmap: https://hero.handmade.network/forums/code-discussion/t/134-mac_os_x_vm_allocate_vs_win__virtualalloc
-    // u8* address = (u8*)GIGABYTES(8lu); // Make this somewhere above 4GB
-    // void* data = mmap(address, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_FIXED|MAP_ANON, -1, 0);
-    // if (data == MAP_FAILED)
-    //     ERROR("'mmap' failed. Error code: %d. Message: %s\n", errno, strerror(errno));
-
-    return (u8*)address;
-}
-
-void PrintStatus(u64* frame_time_results, u8 frame_time_result_count,
-                 u64* cycle_results,      u8 cycle_result_count,
-                 u8   frames)
-{
-    BubbleSort(frame_time_results, frame_time_result_count);
-    BubbleSort(cycle_results,      cycle_result_count);
-
-    u64 i = frame_time_result_count - 1;
-    u64 j = cycle_result_count - 1;
-    NSLog(@"---- FRAME STATS ----\n"
-          "\tFrames per second : %i\n"
-          "\tNanos  per frame  : %llu | %llu | %llu | %llu | %llu\n"
-          "\tCycles per second : %llu | %llu | %llu | %llu | %llu\n",
-          frames,
-          frame_time_results[0], frame_time_results[i/4], frame_time_results[i/2], frame_time_results[3*i/4], frame_time_results[i],
-          cycle_results[0], cycle_results[j/4], cycle_results[j/2], cycle_results[3*j/4], cycle_results[j]
-    );
+    if (flight.enabled)
+    {
+        FlightStats stats = GetFlightStats(flight);
+        NSLog(@"---- FLIGHT RECORDER ----\n"
+              "\tOver budget       : %u frames | %u dumped | %u skipped\n",
+              stats.spikes, stats.dumps, stats.skipped
+        );
+    }
 }
 
 
+// Only the used part of the arenas is saved, as the rest might not even be committed.
 void SaveGameState(Memory& memory)
 {
     static const char* save_path = GetNameByExecutable("game.save");  // LEAK(ted): Making static for now.
@@ -125,19 +149,23 @@ void SaveGameState(Memory& memory)
     FILE* file = fopen(save_path, "wb");
     if (!file)
     {
-        ERROR("Couldn't create save file!\n");
+        REPORT_ERROR("Couldn't create save file!\n");
         return;
     }
 
-    u32 elements_written = 0;
+    u64 elements_written = 0;
 
-    elements_written = fwrite(memory.persistent.data, memory.persistent.size, 1, file);
-    if (elements_written == 0)
-        ERROR("Couldn't write persistent memory to save file!\n");
+    elements_written = fwrite(&memory.persistent.used, sizeof(u64), 1, file) + fwrite(&memory.temporary.used, sizeof(u64), 1, file);
+    if (elements_written != 2)
+        REPORT_ERROR("Couldn't write arena sizes to save file!\n");
 
-    elements_written = fwrite(memory.temporary.data, memory.temporary.size, 1, file);
-    if (elements_written == 0)
-        ERROR("Couldn't write temporary memory to save file!\n");
+    elements_written = fwrite(memory.persistent.data, memory.persistent.used, 1, file);
+    if (elements_written == 0 && memory.persistent.used != 0)
+        REPORT_ERROR("Couldn't write persistent memory to save file!\n");
+
+    elements_written = fwrite(memory.temporary.data, memory.temporary.used, 1, file);
+    if (elements_written == 0 && memory.temporary.used != 0)
+        REPORT_ERROR("Couldn't write temporary memory to save file!\n");
 
     fclose(file);
 }
@@ -149,19 +177,31 @@ void LoadGameState(Memory& memory)
     FILE* file = fopen(save_path, "rb");
     if (!file)
     {
-        ERROR("Couldn't open save file!\n");
+        REPORT_ERROR("Couldn't open save file!\n");
         return;
     }
 
-    u32 elements_read = 0;
+    u64 persistent_used = 0;
+    u64 temporary_used  = 0;
+    u64 elements_read   = 0;
 
-    elements_read = fread(memory.persistent.data, memory.persistent.size, 1, file);
-    if (elements_read == 0)
-        ERROR("Couldn't read persistent memory from save file!\n");
+    elements_read = fread(&persistent_used, sizeof(u64), 1, file) + fread(&temporary_used, sizeof(u64), 1, file);
+    if (elements_read != 2 || !CommitArena(memory.persistent, persistent_used) || !CommitArena(memory.temporary, temporary_used))
+    {
+        REPORT_ERROR("Save file doesn't fit in the arenas!\n");
+        fclose(file);
+        return;
+    }
+    memory.persistent.used = persistent_used;
+    memory.temporary.used  = temporary_used;
 
-    elements_read = fread(memory.temporary.data, memory.temporary.size, 1, file);
-    if (elements_read == 0)
-        ERROR("Couldn't read temporary memory from save file!\n");
+    elements_read = fread(memory.persistent.data, memory.persistent.used, 1, file);
+    if (elements_read == 0 && memory.persistent.used != 0)
+        REPORT_ERROR("Couldn't read persistent memory from save file!\n");
+
+    elements_read = fread(memory.temporary.data, memory.temporary.used, 1, file);
+    if (elements_read == 0 && memory.temporary.used != 0)
+        REPORT_ERROR("Couldn't read temporary memory from save file!\n");
 
     fclose(file);
 }
@@ -216,27 +256,65 @@ void Playback(Memory& memory, RecordData& record, KeyBoard& keyboard)
 
 int main(int argc, char* argv[])
 {
+    // ---- PARSE ARGUMENTS ----
+    //     --audio-latency <ms>    Target latency from writing a sample to hearing it.
+    //     --audio-buffers <n>     Number of buffers the audio queue cycles through.
+    //     --audio-file <path>     Write the audio to a wave file (in real time) instead of playing it.
+    //     --capture <path>        Record every frame to a capture file (see tools/capture_export.cpp).
+    //     --flight <prefix>       Dump the last few seconds when a frame is over budget (see shared/flight_recorder.cpp).
+    //     --flight-budget <ms>    Budget for '--flight' (default 32, a frame period).
+    //     --metrics <path>        Export the metrics periodically to a file, or 'unix:<path>' for a socket (see shared/metrics.cpp).
+    //     --metrics-period <ms>   Period for '--metrics' (default 1000).
+    AudioSettings audio_settings = DefaultAudioSettings();
+    const char*   audio_file     = 0;
+    const char*   capture_file   = 0;
+    const char*   flight_prefix  = 0;
+    f64           flight_budget_ms = 32;
+    const char*   metrics_destination = 0;
+    u64           metrics_period_ms   = 1000;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "--audio-latency") == 0)
+            audio_settings.target_latency_ms = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "--audio-buffers") == 0)
+            audio_settings.buffer_count = atoi(argv[i+1]);
+        else if (strcmp(argv[i], "--audio-file") == 0)
+            audio_file = argv[i+1];
+        else if (strcmp(argv[i], "--capture") == 0)
+            capture_file = argv[i+1];
+        else if (strcmp(argv[i], "--flight") == 0)
+            flight_prefix = argv[i+1];
+        else if (strcmp(argv[i], "--flight-budget") == 0)
+            flight_budget_ms = atof(argv[i+1]);
+        else if (strcmp(argv[i], "--metrics") == 0)
+            metrics_destination = argv[i+1];
+        else if (strcmp(argv[i], "--metrics-period") == 0)
+            metrics_period_ms = atoi(argv[i+1]);
+        else
+            fprintf(stderr, "Unknown argument '%s'.\n", argv[i]);
+    }
+
     // ---- INITIALIZE MEMORY ----
     {
-        // https://developer.apple.com/library/archive/documentation/System/Conceptual/ManPages_iPhoneOS/man3/calloc.3.html
-        u64 total_size = KILOBYTES(4);
-        u8* raw_virtual_memory = AllocateVirtualMemory(total_size);  // LEAK(ted): Never freed, as it'll likely live to the end of the program.
-
-        Buffer persistent;
-        persistent.size = total_size / 2;
-        persistent.used = 0;
-        persistent.data = raw_virtual_memory;
-
-        Buffer temporary;
-        temporary.size = total_size / 2;
-        temporary.used = 0;
-        temporary.data = raw_virtual_memory + persistent.size;
-
-        memory.persistent  = persistent;
-        memory.temporary   = temporary;
-        memory.initialized = false;
+        // Only reserved here. Pages are committed as the game pushes into the arenas.
+        // A fixed address keeps pointers in saved states valid between runs.
+        // LEAK(ted): Never freed, as it'll likely live to the end of the program.
+        if (!AllocateGameMemory(memory, GIGABYTES(8), GIGABYTES(8), TERABYTES(2)))
+            return 1;
     }
 
+    // ---- INITIALIZE METRICS ----
+    u32 frame_time_metric   = RegisterMetric("frame_time",   "ns");
+    u32 frame_cycles_metric = RegisterMetric("frame_cycles", "cycles");
+    if (metrics_destination && !StartMetricsExport(metrics_destination, MILLI_TO_NANO(metrics_period_ms)))
+        return 1;
+
+    // ---- INITIALIZE PLATFORM SERVICES ----
+    InitializeAsyncIO(memory.platform);
+    InitializeMappedFiles(memory.platform);
+    if (!InitializeAssets(memory.platform, 0))
+        return 1;
+
 
     // ---- INITIALIZE DLL AND HOTLOADER ----
     const char* dll_path;
@@ -262,23 +340,47 @@ int main(int argc, char* argv[])
         ResizeBuffer(window, framebuffer);
     }
 
+    // ---- INITIALIZE FRAME CAPTURE ----
+    // Frames larger than the initial window (if it's resized) are skipped.
+    FrameCapture capture = {0};
+    if (capture_file && !OpenFrameCapture(capture, capture_file, framebuffer.width, framebuffer.height))
+        return 1;
+
+    // ---- INITIALIZE FLIGHT RECORDER ----
+    static FlightRecorder flight;  // Too large for the stack.
+    if (flight_prefix && !OpenFlightRecorder(flight, flight_prefix, cast(flight_budget_ms * 1000000.0, u64), framebuffer))
+        return 1;
+
     // ---- INITIALIZE AUDIO -----
-    AudioQueueRef audio_queue;
+    AudioQueueRef audio_queue = 0;
+    WaveSink      wave_sink   = {0};
     {
-        audio_queue = SetupAudioQueue();  // LEAK(ted): Does the audio queue need to be freed?
+        if (audio_file)
+        {
+            if (!OpenWaveSink(wave_sink, audio_file, audio_settings))
+                return 1;
+        }
+        else
+        {
+            audio_queue = SetupAudioQueue(audio_settings);  // LEAK(ted): Does the audio queue need to be freed?
+        }
+    }
+    AudioLatency& audio_latency_stats = audio_file ? wave_sink.latency : audio_latency;
+
+    // ---- INITIALIZE DEBUG OVERLAY ----
+    // Toggled with 'o'. Has its own arena so it never shows up in the game's memory usage.
+    Buffer  debug_arena;
+    Overlay overlay = {0};
+    {
+        if (!AllocateArena(debug_arena, MEGABYTES(2)) || !InitializeOverlay(overlay, debug_arena, MILLI_TO_NANO(32)))
+            overlay.enabled = false;
     }
 
 
     NanoClock clock;
     NanoClock frame_clock;
 
-    u8  frame_time_result_count = 0;
-    u64 frame_time_results[255];
-
-    u8  cycle_result_count = 0;
-    u64 cycle_results[255];
-
-    int frames = 0;
+    u32 frames = 0;
 
     // ---- INITIALIZE RECORD DATA ----
     bool record_user_input   = false;
@@ -294,20 +396,20 @@ int main(int argc, char* argv[])
         // ---- FRAME COUNT ----
         if (Timer(frame_clock, SECONDS_TO_NANO(1)))
         {
-            PrintStatus(frame_time_results, frame_time_result_count, cycle_results, cycle_result_count, frames);
-
+            PrintStatus(frames, frame_time_metric, frame_cycles_metric, audio_latency_stats, capture, flight);
             frames = 0;
-            cycle_result_count = 0;
-            frame_time_result_count = 0;
         }
         ++frames;
 
         // ---- SLEEP ----
         uint64_t delta = Tick(clock, MILLI_TO_NANO(32));
-        frame_time_results[frame_time_result_count++] = delta;
+        u64 frame_start = NanoTime();  // The flight recorder times the work, not the sleep.
+        RecordMetric(frame_time_metric, delta);
+        OverlayRecordFrame(overlay, delta);
 
         // ---- EVENTS ----
         HandleEvents(keyboard);
+        SwapAssets();  // Between frames, so the game never sees half of a reload.
         // if (CheckForFileEvents(dll_monitor))
         // {
         //     game = TryLoadGame(dll_path);
@@ -315,6 +417,13 @@ int main(int argc, char* argv[])
         // }
 
 
+        // ---- DEBUG KEYS ----
+        for (u8 i = 0; i < keyboard.used; ++i)
+        {
+            if (keyboard.keys[i].character == 'o')
+                overlay.enabled = !overlay.enabled && overlay.atlas != 0;
+        }
+
         // ---- RECORD AND PLAYBACK ----
         {
             for (u8 i = 0; i < keyboard.used; ++i)
@@ -377,12 +486,42 @@ int main(int argc, char* argv[])
         // }
 
         // ---- RENDERING ----
+        FlightBeginFrame(flight, memory);  // After playback, which may have loaded a state.
+
+        {
+            TIMED_BLOCK("update");
+            game.update(memory, framebuffer, keyboard);
+        }
+        {
+            // Before the overlay, so recordings only have what the game drew.
+            TIMED_BLOCK("capture");
+            CaptureFrame(capture, framebuffer, NanoTime());
+        }
+        {
+            TIMED_BLOCK("overlay");
+            DrawOverlay(overlay, framebuffer, memory);
+        }
+        {
+            TIMED_BLOCK("present");
+            DrawBufferToWindow(window, framebuffer);
+        }
 
-        game.update(memory, framebuffer, keyboard);
-        DrawBufferToWindow(window, framebuffer);
+        // ---- AUDIO ----
+        if (audio_file)
+        {
+            TIMED_BLOCK("sound");
+            UpdateWaveSink(wave_sink, memory, game.sound, NanoTime());
+        }
 
         u64 stop = CycleCount();
-        cycle_results[cycle_result_count++] = stop - start;
+        RecordMetric(frame_cycles_metric, stop - start);
+        ProfilerEndFrame();
+        FlightEndFrame(flight, memory, keyboard, NanoTime() - frame_start);
     }
 
+    CloseWaveSink(wave_sink);
+    CloseFrameCapture(capture);
+    CloseAssets();
+    CloseFlightRecorder(flight);
+    StopMetricsExport();
 }
\ No newline at end of file
@@ -14,6 +14,9 @@
 //      meaningful set of frames for a given audio data format.
 
 
+static AudioLatency audio_latency;
+
+
 // Will be called whenever the audio queue needs more data.
 // https://developer.apple.com/documentation/audiotoolbox/audioqueueoutputcallback
 void AudioQueueCallback(void* user_data, AudioQueueRef audio_queue, AudioQueueBufferRef buffer)
@@ -21,24 +24,37 @@ void AudioQueueCallback(void* user_data, AudioQueueRef audio_queue, AudioQueueBu
     // https://developer.apple.com/documentation/audiotoolbox/audioqueuebuffer
     // AudioQueueBuffer
 
-    // static NanoClock clock;
-    // u64 duration = Tick(clock);
-    // NSLog(@"Audio Callback time: %f | Samples: %u", NANO_TO_SECONDS(cast(duration, f64)), bytes);
+    AudioLatency& latency = *cast(user_data, AudioLatency*);
+
+    // https://developer.apple.com/documentation/audiotoolbox/1502513-audioqueuegetcurrenttime
+    // The playback cursor, in frames. Not available until the queue has started.
+    u64 frames_played = 0;
+    AudioTimeStamp timestamp;
+    OSStatus error = AudioQueueGetCurrentTime(audio_queue, NULL, &timestamp, NULL);
+    if (error == noErr && (timestamp.mFlags & kAudioTimeStampSampleTimeValid))
+        frames_played = cast(timestamp.mSampleTime, u64);
 
-    static f32 theta = 0;
-    static f32 alpha = 0;
+    u32 capacity = buffer->mAudioDataBytesCapacity / sizeof(Sample);
+    u32 frames   = AudioFramesToWrite(latency, NanoTime(), frames_played, capacity);
 
-    s16* data  = cast(buffer->mAudioData, s16*);
-    u32  bytes = buffer->mAudioDataBytesCapacity;
+    // We're only called back when a buffer is returned, so it must always be enqueued again.
+    // Don't let it get so small that we're called back all the time.
+    if (frames < capacity / 4)
+        frames = capacity / 4;
 
     SoundBuffer sound;
-    sound.size = bytes;
-    sound.data = data;
+    sound.size = frames * sizeof(Sample);
+    sound.data = cast(buffer->mAudioData, s16*);
+    sound.samples_per_second = latency.samples_per_second;
 
-    game.sound(memory, sound);
+    {
+        TIMED_BLOCK("sound");
+        game.sound(memory, sound);
+    }
+    AudioFramesWritten(latency, frames);
 
     // mAudioDataByteSize must be set.
-    buffer->mAudioDataByteSize = bytes;
+    buffer->mAudioDataByteSize = sound.size;
 
     // https://developer.apple.com/documentation/audiotoolbox/1502779-audioqueueenqueuebuffer
     // AudioQueueEnqueueBuffer -> error code
@@ -46,12 +62,12 @@ void AudioQueueCallback(void* user_data, AudioQueueRef audio_queue, AudioQueueBu
     //     - buffer
     //     - number of packets of audio data in buffer
     //     - an array of packet descriptions
-    OSStatus error = AudioQueueEnqueueBuffer(audio_queue, buffer, 0, NULL);
+    error = AudioQueueEnqueueBuffer(audio_queue, buffer, 0, NULL);
     ASSERT(error == noErr, "Couldn't enqueue Audio Buffer. Error code %i.\n", error);
 }
 
 
-AudioQueueRef SetupAudioQueue()
+AudioQueueRef SetupAudioQueue(AudioSettings settings)
 {
     // https://developer.apple.com/documentation/audiotoolbox/audio_queue_services#1651699
     OSStatus error = noErr;
@@ -59,7 +75,7 @@ AudioQueueRef SetupAudioQueue()
     // https://developer.apple.com/documentation/coreaudio/audiostreambasicdescription
     // Setup the audio device.
     AudioStreamBasicDescription audio_format = {0};
-    audio_format.mSampleRate       = 44100;            // Should be named 'Frame rate'.
+    audio_format.mSampleRate       = settings.samples_per_second;  // Should be named 'Frame rate'.
     audio_format.mFormatID         = kAudioFormatLinearPCM;
     audio_format.mFormatFlags      = kLinearPCMFormatFlagIsSignedInteger;
     audio_format.mBytesPerPacket   = 4;
@@ -83,7 +99,7 @@ AudioQueueRef SetupAudioQueue()
 
     // Create a new output AudioQueue for the device.
     AudioQueueRef audio_queue;
-    error = AudioQueueNewOutput(&audio_format, AudioQueueCallback, NULL,
+    error = AudioQueueNewOutput(&audio_format, AudioQueueCallback, &audio_latency,
                                 CFRunLoopGetCurrent(), kCFRunLoopCommonModes, 0, &audio_queue);
     ASSERT(error == noErr, "Couldn't create Audio Queue. Error code %i.\n", error);
 
@@ -93,15 +109,19 @@ AudioQueueRef SetupAudioQueue()
     //     - capacity (in bytes)
     //     - buffer (output parameter
 
-    for (u8 buffer_index = 0; buffer_index < 3; ++buffer_index)
+    // The buffers are sized so we can write up to twice the target latency ahead, and
+    // 'AudioQueueCallback' decides how much of each one to fill.
+    u32 buffer_frames = AudioBufferFrames(settings);
+    InitializeAudioLatency(audio_latency, settings, buffer_frames);
+
+    for (u32 buffer_index = 0; buffer_index < settings.buffer_count; ++buffer_index)
     {
         AudioQueueBufferRef buffer;
-        error = AudioQueueAllocateBuffer(audio_queue, KILOBYTES(16), &buffer);
+        error = AudioQueueAllocateBuffer(audio_queue, buffer_frames * sizeof(Sample), &buffer);
         ASSERT(error == noErr, "Couldn't create Audio Buffer. Error code %i.\n", error);
 
         // Fill the audio queue buffer.
-        // AudioQueueCallback(NULL, audio_queue, buffer);
-        AudioQueueCallback(NULL, audio_queue, buffer);
+        AudioQueueCallback(&audio_latency, audio_queue, buffer);
     }
 
 
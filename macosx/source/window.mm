@@ -165,6 +165,8 @@ void HandleEvents(KeyBoard& keyboard)
                     StoreCharacterInKeyboard(keyboard, ',');
                 else if ([event.characters isEqualToString:@"."])
                     StoreCharacterInKeyboard(keyboard, '.');
+                else if ([event.characters isEqualToString:@"o"])
+                    StoreCharacterInKeyboard(keyboard, 'o');
                 if (event.keyCode == 53)  // Escape
                 {
                     running = false;
@@ -3,12 +3,17 @@
 #include <string.h>
 
 #include "main.h"
+#include "framebuffer.h"
+#include "mixer.cpp"
+#include "color.cpp"
 
 
+#define SINE_TABLE_FRAMES 256
+
 struct SoundState
 {
-    f32 theta;
-    f32 alpha;
+    Mixer    mixer;
+    WaveFile sine;  // One period, played back at different rates to get tones.
 };
 
 struct GameState
@@ -18,6 +23,9 @@ struct GameState
 
     s32 x;
     s32 y;
+
+    AssetHandle background;  // 0 if the host doesn't load assets.
+    AssetHandle foreground;
 };
 
 struct State
@@ -27,47 +35,142 @@ struct State
 };
 
 
-void DrawRectangle(FrameBuffer& framebuffer, s32 left, s32 top, s32 right, s32 bottom)
+template <typename Layout>
+static void DrawRectangleIn(FrameBuffer& framebuffer, s32 left, s32 top, s32 right, s32 bottom)
 {
     if (left < 0) left = 0;
     if (top  < 0) top  = 0;
     if (right  >= framebuffer.width)  right  = framebuffer.width;
     if (bottom >= framebuffer.height) bottom = framebuffer.height;
 
-    for (u16 y = cast(top, u16); y < cast(bottom, u16); ++y)
+    // A row at a time, in runs of pixels that are contiguous in the layout (whole rows when linear).
+    for (s32 y = top; y < bottom; ++y)
+    {
+        Pixel* row = framebuffer.pixels + Layout::RowOffset(framebuffer, y);
+        for (s32 x = left; x < right; )
+        {
+            s32 end = (x / Layout::SPAN + 1) * Layout::SPAN;
+            if (end > right || end < x)
+                end = right;
+
+            Pixel* run = row + Layout::ColumnOffset(x);
+            for (s32 i = 0; i < end - x; ++i)
+            {
+                Pixel& pixel = run[i];
+
+                pixel.r = 255;
+                pixel.g = 255;
+                pixel.b = 0;
+                pixel.a = 0;
+            }
+            x = end;
+        }
+    }
+}
+
+void DrawRectangle(FrameBuffer& framebuffer, s32 left, s32 top, s32 right, s32 bottom)
+{
+    switch (framebuffer.layout)
+    {
+        case FRAMEBUFFER_LINEAR:    DrawRectangleIn<LinearLayout> (framebuffer, left, top, right, bottom); break;
+        case FRAMEBUFFER_TILED_8:   DrawRectangleIn<Tiled8Layout> (framebuffer, left, top, right, bottom); break;
+        case FRAMEBUFFER_TILED_32:  DrawRectangleIn<Tiled32Layout>(framebuffer, left, top, right, bottom); break;
+        case FRAMEBUFFER_MORTON_32: DrawRectangleIn<MortonLayout> (framebuffer, left, top, right, bottom); break;
+    }
+}
+
+template <typename Layout>
+static void DrawBitmapIn(FrameBuffer& framebuffer, const Bitmap& bitmap, s32 left, s32 top)
+{
+    s32 right  = left + bitmap.width;
+    s32 bottom = top  + bitmap.height;
+    s32 x0 = left < 0 ? 0 : left;
+    s32 y0 = top  < 0 ? 0 : top;
+    if (right  > framebuffer.width)  right  = framebuffer.width;
+    if (bottom > framebuffer.height) bottom = framebuffer.height;
+
+    // The bitmap is in rows, so copy it in the runs that are contiguous in the layout.
+    for (s32 y = y0; y < bottom; ++y)
     {
-        for (u16 x = cast(left, u16); x < cast(right, u16); ++x)
+        Pixel* row          = framebuffer.pixels + Layout::RowOffset(framebuffer, y);
+        const Pixel* source = bitmap.pixels + cast(y - top, u64) * bitmap.width;
+        for (s32 x = x0; x < right; )
         {
-            Pixel& pixel = framebuffer.pixels[y * framebuffer.width + x];
+            s32 end = (x / Layout::SPAN + 1) * Layout::SPAN;
+            if (end > right || end < x)
+                end = right;
 
-            pixel.r = 255;
-            pixel.g = 255;
-            pixel.b = 0;
-            pixel.a = 0;
+            memcpy(row + Layout::ColumnOffset(x), source + (x - left), cast(end - x, u64) * sizeof(Pixel));
+            x = end;
         }
     }
 }
 
+void DrawBitmap(FrameBuffer& framebuffer, const Bitmap& bitmap, s32 left, s32 top)
+{
+    if (!bitmap.pixels)
+        return;
+
+    switch (framebuffer.layout)
+    {
+        case FRAMEBUFFER_LINEAR:    DrawBitmapIn<LinearLayout> (framebuffer, bitmap, left, top); break;
+        case FRAMEBUFFER_TILED_8:   DrawBitmapIn<Tiled8Layout> (framebuffer, bitmap, left, top); break;
+        case FRAMEBUFFER_TILED_32:  DrawBitmapIn<Tiled32Layout>(framebuffer, bitmap, left, top); break;
+        case FRAMEBUFFER_MORTON_32: DrawBitmapIn<MortonLayout> (framebuffer, bitmap, left, top); break;
+    }
+}
+
 
 void Initialize(Memory& memory)
 {
     ASSERT(memory.persistent.data != 0, "Invalid persistent memory.\n");
     ASSERT(memory.temporary.data  != 0, "Invalid temporary memory.\n");
 
-    State* state = cast(memory.persistent.data, State*);
-
     if (!memory.initialized)
     {
+        State* state = PushStruct(memory.persistent, State);
+        ASSERT(state == memory.persistent.data, "State must be first in persistent memory.\n");
+
         state->game.offset = 0;
         state->game.increase = true;
         state->game.x = 0;
         state->game.y = 0;
 
-        state->sound.theta = 0;
-        state->sound.alpha = 0;
+        // The host keeps these up to date as the files change, so they're never loaded again.
+        state->game.background = 0;
+        state->game.foreground = 0;
+        if (memory.platform.load_bitmap)
+        {
+            state->game.background = memory.platform.load_bitmap("textures/background.bmp");
+            state->game.foreground = memory.platform.load_bitmap("textures/foreground.bmp");
+        }
+
+        s16* sine = PushArray(memory.persistent, SINE_TABLE_FRAMES, s16);
+        ASSERT(sine != 0, "Not enough persistent memory for the sine table.\n");
+        for (u32 i = 0; i < SINE_TABLE_FRAMES; ++i)
+            sine[i] = cast(sin(2.0f * PI32 * i / SINE_TABLE_FRAMES) * 32767.0f, s16);
+
+        SoundState& sound = state->sound;
+        memset(&sound.mixer, 0, sizeof(sound.mixer));
+        sound.mixer.master_volume = 1.0f;
+        sound.sine.samples     = sine;
+        sound.sine.frame_count = SINE_TABLE_FRAMES;
+        sound.sine.channels    = 1;
+
+        u16 left_tone  = 440;
+        u16 right_tone = 220;
+
+        sound.sine.samples_per_second = left_tone * SINE_TABLE_FRAMES;
+        Voice* left = PlayVoice(sound.mixer, sound.sine);
+        left->pan     = -1.0f;
+        left->looping = true;
+
+        sound.sine.samples_per_second = right_tone * SINE_TABLE_FRAMES;
+        Voice* right = PlayVoice(sound.mixer, sound.sine);
+        right->pan     = 1.0f;
+        right->looping = true;
 
         memory.initialized = true;
-        memory.persistent.used = sizeof(State);
     }
 }
 
@@ -99,18 +202,24 @@ void Update(Memory& memory, FrameBuffer& framebuffer, KeyBoard& keyboard)
     else
         --state.offset;
 
-    // Fill screen
-    for (int y = 0; y < framebuffer.height; ++y)
+    // Fill screen. Every pixel gets the same color, so the layout doesn't matter (padding included).
+    u64 pixel_count = FrameBufferPixelCount(framebuffer);
+    for (u64 i = 0; i < pixel_count; ++i)
     {
-        for(int x = 0; x < framebuffer.width ; ++x)
-        {
-            Pixel& pixel = framebuffer.pixels[y * framebuffer.width + x];
+        Pixel& pixel = framebuffer.pixels[i];
 
-            pixel.r = 0;
-            pixel.g = cast(state.offset, u8);
-            pixel.b = 0;
-            pixel.a = 0;
-        }
+        pixel.r = 0;
+        pixel.g = cast(state.offset, u8);
+        pixel.b = 0;
+        pixel.a = 0;
+    }
+
+    if (memory.platform.get_bitmap)
+    {
+        Bitmap background = memory.platform.get_bitmap(state.background);
+        Bitmap foreground = memory.platform.get_bitmap(state.foreground);
+        DrawBitmap(framebuffer, background, 0, 0);
+        DrawBitmap(framebuffer, foreground, framebuffer.width - foreground.width, framebuffer.height - foreground.height);
     }
 
     // Draw rectangle
@@ -121,22 +230,7 @@ void Update(Memory& memory, FrameBuffer& framebuffer, KeyBoard& keyboard)
 void Sound(Memory& memory, SoundBuffer& buffer)
 {
     SoundState& state = cast(memory.persistent.data, State*)->sound;
-
-    u16 left_tone  = 440;
-    u16 right_tone = 220;
-
-    for (u32 left = 0, right = 1; right < buffer.size / 2; left+=2, right+=2)
-    {
-        buffer.data[left]  = cast(sin(state.theta) * 32767.0f, s16);
-        buffer.data[right] = cast(sin(state.alpha) * 32767.0f, s16);
-
-        state.theta += 2.0f * PI32 * left_tone  / 44100;
-        state.alpha += 2.0f * PI32 * right_tone / 44100;
-        if (state.theta > 2.0f * PI32)
-            state.theta -= 2.0f * PI32;
-        if (state.alpha > 2.0f * PI32)
-            state.alpha -= 2.0f * PI32;
-    }
+    MixVoices(state.mixer, buffer);
 }
 
 
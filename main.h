@@ -53,6 +53,10 @@ typedef int64_t s64;
 typedef float  f32;
 typedef double f64;
 
+// Little endian reads, for the file formats the game and hosts parse (wave, bitmap).
+inline u16 ReadU16(const u8* at) { return cast(at[0] | (at[1] << 8), u16); }
+inline u32 ReadU32(const u8* at) { return cast(at[0] | (at[1] << 8) | (at[2] << 16) | (cast(at[3], u32) << 24), u32); }
+
 // Memory
 #define KILOBYTES(x) (         (x) * 1024ULL)
 #define MEGABYTES(x) (KILOBYTES(x) * 1024ULL)
@@ -60,19 +64,112 @@ typedef double f64;
 #define TERABYTES(x) (GIGABYTES(x) * 1024ULL)
 
 
+struct Buffer;
+// Makes sure at least the first 'minimum_size' bytes of the arena are backed by memory.
+typedef bool (*CommitFunction)(Buffer& arena, u64 minimum_size);
+
+// An arena of reserved address space. Only the first 'committed' bytes are backed by memory,
+// the rest is committed on demand by 'PushSize'.
 struct Buffer
 {
-    u32   size;  // Maximum 4GB
-    u32   used;
+    u64   size;       // Reserved.
+    u64   used;
+    u64   committed;
     void* data;
+    CommitFunction commit;  // Set by the host. 0 if everything is committed up front.
+};
+
+
+// Bump allocates from an arena, committing more of it if needed. Returns 0 if the arena is full.
+inline void* PushSize(Buffer& arena, u64 size)
+{
+    if (arena.size - arena.used < size)
+        return 0;
+
+    u64 end = arena.used + size;
+    if (end > arena.committed && (!arena.commit || !arena.commit(arena, end)))
+        return 0;
+
+    void* result = cast(arena.data, u8*) + arena.used;
+    arena.used = end;
+    return result;
+}
+#define PushStruct(arena, type)       cast(PushSize(arena, sizeof(type)), type*)
+#define PushArray(arena, count, type) cast(PushSize(arena, (count) * sizeof(type)), type*)
+
+
+// ---- PLATFORM SERVICES ----
+// Functions the host hands to the game through 'Memory'. A host that doesn't
+// support a service leaves its pointer as 0, so check before calling.
+
+// Asynchronous file I/O. The destination/source buffer must stay untouched by
+// the game (and alive) until the ticket has completed or failed, as the host
+// reads/writes it from another thread. Allocate it from an arena.
+typedef u32 IOTicket;  // 0 is never a valid ticket.
+
+enum IOStatus
+{
+    IO_INVALID,    // Unknown or already retired ticket.
+    IO_PENDING,
+    IO_COMPLETED,
+    IO_FAILED,
+};
+
+typedef IOTicket (*ReadFileAsyncFunction) (const char* path, u64 offset, void* destination, u64 size);
+typedef IOTicket (*WriteFileAsyncFunction)(const char* path, u64 offset, const void* source, u64 size);
+// Both retire the ticket once it's completed or failed, so only the first call reports the result.
+typedef IOStatus (*PollIOFunction)(IOTicket ticket, u64* bytes_transferred);
+typedef IOStatus (*WaitIOFunction)(IOTicket ticket, u64* bytes_transferred);
+
+// Read-only memory mapping of a whole file. Pages are loaded by the OS as they're touched.
+struct MappedFile
+{
+    void* data;  // 0 on failure.
+    u64   size;
+};
+
+typedef MappedFile (*MapFileFunction)(const char* path);
+typedef void       (*UnmapFileFunction)(MappedFile file);
+
+// Images loaded and converted by the host, which reloads them when their files change on disk.
+// Paths are relative to the host's asset directory. The handle stays the same across reloads,
+// but the pixels don't: get the bitmap again every frame instead of keeping it, as they're only
+// valid until the end of the frame.
+typedef u32 AssetHandle;  // 0 is never a valid handle.
+
+struct Pixel;
+struct Bitmap
+{
+    s32    width;
+    s32    height;
+    Pixel* pixels;      // Rows top to bottom. 0 until the file has been loaded.
+    u32    generation;  // Bumped every time the pixels are replaced.
+};
+
+typedef AssetHandle (*LoadBitmapFunction)(const char* path);
+typedef Bitmap      (*GetBitmapFunction)(AssetHandle handle);
+
+struct Platform
+{
+    ReadFileAsyncFunction  read_file_async;
+    WriteFileAsyncFunction write_file_async;
+    PollIOFunction         poll_io;
+    WaitIOFunction         wait_io;
+
+    MapFileFunction        map_file;
+    UnmapFileFunction      unmap_file;
+
+    LoadBitmapFunction     load_bitmap;
+    GetBitmapFunction      get_bitmap;
 };
 
 
 struct Memory
 {
-    Buffer persistent;
-    Buffer temporary;
-    bool   initialized;
+    Buffer   persistent;
+    Buffer   temporary;
+    Platform platform;
+    bool     initialized;
 };
 
 
@@ -83,23 +180,37 @@ struct Pixel
     u8 r, g, b, a;
 #elif defined(_WIN32) || defined(_WIN64)
     u8 b, g, r, a;
+#elif defined(__linux__)
+    u8 r, g, b, a;  // No window yet, so match macOS (and image formats).
 #else
     #error "Your operating system is not supported."
 #endif
 };
 
+// How pixels are ordered in memory. See framebuffer.h for the addressing of each, and for how
+// much memory they need (the tiled layouts pad the size up to whole tiles).
+enum FrameBufferLayout
+{
+    FRAMEBUFFER_LINEAR,     // Row after row, 'pixels[y * width + x]'. What the windows want.
+    FRAMEBUFFER_TILED_8,    // 8x8 tiles of rows, tiles row after row.
+    FRAMEBUFFER_TILED_32,   // 32x32 tiles of rows, tiles row after row.
+    FRAMEBUFFER_MORTON_32,  // 32x32 tiles in Z-order (Morton order), tiles row after row.
+};
+
 struct FrameBuffer
 {
     s32 width;
     s32 height;
     Pixel* pixels;
+    FrameBufferLayout layout;  // Zero (linear) unless the host asks for another.
 };
 
 struct Sample { s16 left; s16 right; };
 struct SoundBuffer
 {
-    u32  size;
-    s16* data;
+    u32  size;                // In bytes.
+    s16* data;                // Interleaved left and right samples.
+    u32  samples_per_second;
 };
 
 
@@ -137,7 +248,10 @@ typedef void (*name##Function)(__VA_ARGS__);                                \
 void DEFAULT_##name(__VA_ARGS__) {}                                         \
 
 #elif defined(__linux__)
-#error "Don't support Linux yet."
+#define EXPORT_FUNCTION(name, ...)                                          \
+extern "C" __attribute__((visibility("default"))) void name(__VA_ARGS__);   \
+typedef void (*name##Function)(__VA_ARGS__);                                \
+void DEFAULT_##name(__VA_ARGS__) {}                                         \
 
 #else
 #error "Couldn't determine operating system!"
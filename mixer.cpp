@@ -0,0 +1,301 @@
+// Sample playback mixer.
+//
+// Any number of voices (up to MIXER_MAX_VOICES) play 16-bit PCM sample data with their own
+// volume, pan and pitch. Voices are resampled to the output rate (linear or cubic), summed in
+// float lanes and written to the s16 output with saturation.
+//
+// Sample data is only referenced, never copied, so long tracks can be played straight out of
+// a memory mapped WAV file (see 'LoadWave'), and the OS streams them in as they're played.
+
+#include <string.h>
+#include <math.h>
+
+#include "simd.h"
+
+
+#define MIXER_MAX_VOICES   64
+#define MIXER_CHUNK_FRAMES 256  // Frames mixed per pass. Must be a multiple of 4.
+
+
+struct WaveFile
+{
+    const s16* samples;          // Interleaved if stereo.
+    u32 frame_count;
+    u16 channels;                // 1 or 2.
+    u32 samples_per_second;
+};
+
+enum Resampling
+{
+    RESAMPLE_LINEAR,
+    RESAMPLE_CUBIC,
+};
+
+struct Voice
+{
+    WaveFile wave;
+    f64  position;    // In source frames.
+    f32  volume;      // Linear gain.
+    f32  pan;         // -1 is left, 0 is center, 1 is right.
+    f32  pitch;       // Playback rate multiplier.
+    Resampling resampling;
+    bool looping;
+    bool active;
+};
+
+struct Mixer
+{
+    Voice voices[MIXER_MAX_VOICES];
+    f32   master_volume;
+};
+
+
+// Only 16-bit PCM, mono or stereo, is supported.
+bool ParseWave(const void* data, u64 size, WaveFile& wave)
+{
+    const u8* at  = cast(data, const u8*);
+    const u8* end = at + size;
+
+    if (size < 12 || memcmp(at, "RIFF", 4) != 0 || memcmp(at + 8, "WAVE", 4) != 0)
+        return false;
+    at += 12;
+
+    bool has_format = false;
+    wave.samples = 0;
+
+    while (end - at >= 8)
+    {
+        const u8* chunk = at + 8;
+        u64 chunk_size  = ReadU32(at + 4);
+        if (chunk_size > cast(end - chunk, u64))  // Truncated, e.g. a file that's still being written.
+            chunk_size = end - chunk;
+
+        if (memcmp(at, "fmt ", 4) == 0 && chunk_size >= 16)
+        {
+            u16 format          = ReadU16(chunk);
+            u16 bits_per_sample = ReadU16(chunk + 14);
+            wave.channels           = ReadU16(chunk + 2);
+            wave.samples_per_second = ReadU32(chunk + 4);
+
+            if ((format != 1 && format != 0xFFFE) || bits_per_sample != 16)
+                return false;
+            if (wave.channels != 1 && wave.channels != 2)
+                return false;
+            has_format = true;
+        }
+        else if (memcmp(at, "data", 4) == 0 && has_format)
+        {
+            wave.samples     = reinterpret_cast<const s16*>(chunk);
+            wave.frame_count = cast(chunk_size / (sizeof(s16) * wave.channels), u32);
+            return wave.frame_count > 0;
+        }
+
+        at = chunk + chunk_size + (chunk_size & 1);  // Chunks are padded to an even size.
+    }
+
+    return false;
+}
+
+// Maps the file into memory rather than reading it. Returns a wave with 'frame_count' 0 on failure.
+WaveFile LoadWave(Platform& platform, const char* path)
+{
+    WaveFile wave = {0};
+    if (!platform.map_file)
+        return wave;
+
+    MappedFile file = platform.map_file(path);
+    if (!file.data)
+        return wave;
+
+    if (!ParseWave(file.data, file.size, wave))
+    {
+        REPORT_ERROR("'%s' isn't a 16-bit PCM wave file.\n", path);
+        platform.unmap_file(file);
+        wave.frame_count = 0;
+    }
+    return wave;
+}
+
+
+// Returns 0 if all voices are busy. The voice can be modified until it stops.
+Voice* PlayVoice(Mixer& mixer, const WaveFile& wave)
+{
+    if (wave.frame_count == 0)
+        return 0;
+
+    for (u32 i = 0; i < MIXER_MAX_VOICES; ++i)
+    {
+        Voice& voice = mixer.voices[i];
+        if (voice.active)
+            continue;
+
+        voice.wave       = wave;
+        voice.position   = 0;
+        voice.volume     = 1.0f;
+        voice.pan        = 0.0f;
+        voice.pitch      = 1.0f;
+        voice.resampling = RESAMPLE_LINEAR;
+        voice.looping    = false;
+        voice.active     = true;
+        return &voice;
+    }
+    return 0;
+}
+
+
+// Reads a sample, wrapping around for looping voices and returning silence outside non-looping ones.
+static inline f32 SampleAt(const Voice& voice, s64 frame, u32 channel)
+{
+    s64 count = voice.wave.frame_count;
+    if (frame < 0 || frame >= count)
+    {
+        if (!voice.looping)
+            return 0.0f;
+        frame %= count;
+        if (frame < 0)
+            frame += count;
+    }
+    return voice.wave.samples[frame * voice.wave.channels + channel];
+}
+
+// Adds 'frame_count' resampled frames of the voice to 'left' and 'right'. 'left' and 'right' must
+// have room for 'frame_count' rounded up to a multiple of 4.
+static void MixVoice(Voice& voice, f32* left, f32* right, u32 frame_count, u32 samples_per_second)
+{
+    f64 step  = voice.pitch * cast(voice.wave.samples_per_second, f64) / samples_per_second;
+    s64 count = voice.wave.frame_count;
+    bool cubic = voice.resampling == RESAMPLE_CUBIC;
+
+    // Constant power panning.
+    f32 angle = (voice.pan + 1.0f) * (PI32 / 4.0f);
+    f32x4 gain_left  = F32x4(voice.volume * cosf(angle));
+    f32x4 gain_right = F32x4(voice.volume * sinf(angle));
+
+    u32 right_channel = voice.wave.channels - 1;  // Mono voices read channel 0 for both.
+
+    // Linear interpolation only needs the middle two taps.
+    u32 first_tap = cubic ? 0 : 1;
+    u32 last_tap  = cubic ? 4 : 3;
+    u32 stride    = voice.wave.channels;
+
+    for (u32 i = 0; i < frame_count; i += 4)
+    {
+        // taps[channel][tap][lane] holds source frames index-1 .. index+2 for each of the 4 output frames.
+        f32 taps[2][4][4];
+        f32 fraction[4];
+        s64 first_index = 0;
+
+        for (u32 lane = 0; lane < 4; ++lane)
+        {
+            f64 position = voice.position + (i + lane) * step;
+            s64 index    = cast(position, s64);  // Positions are never negative, so this is floor.
+            fraction[lane] = cast(position - index, f32);
+
+            if (lane == 0)
+                first_index = index;
+
+            // Fast path when all taps are inside the wave. Otherwise wrap or pad with silence.
+            if (index >= 1 && index + 2 < count)
+            {
+                const s16* at = voice.wave.samples + (index - 1) * stride;
+                for (u32 tap = first_tap; tap < last_tap; ++tap)
+                {
+                    taps[0][tap][lane] = at[tap * stride];
+                    taps[1][tap][lane] = at[tap * stride + right_channel];
+                }
+            }
+            else
+            {
+                for (u32 tap = first_tap; tap < last_tap; ++tap)
+                {
+                    taps[0][tap][lane] = SampleAt(voice, index - 1 + tap, 0);
+                    taps[1][tap][lane] = SampleAt(voice, index - 1 + tap, right_channel);
+                }
+            }
+        }
+
+        // Nothing left to play for a non-looping voice.
+        if (!voice.looping && first_index >= count)
+            break;
+
+        f32x4 t = LoadF32x4(fraction);
+        f32x4 result[2];
+        for (u32 channel = 0; channel < 2; ++channel)
+        {
+            f32x4 x1 = LoadF32x4(taps[channel][1]);
+            f32x4 x2 = LoadF32x4(taps[channel][2]);
+
+            if (cubic)
+            {
+                f32x4 x0 = LoadF32x4(taps[channel][0]);
+                f32x4 x3 = LoadF32x4(taps[channel][3]);
+
+                // Catmull-Rom spline through x0..x3, evaluated between x1 and x2.
+                f32x4 half = F32x4(0.5f);
+                f32x4 c1 = half * (x2 - x0);
+                f32x4 c2 = x0 - F32x4(2.5f) * x1 + F32x4(2.0f) * x2 - half * x3;
+                f32x4 c3 = half * (x3 - x0) + F32x4(1.5f) * (x1 - x2);
+                result[channel] = ((c3 * t + c2) * t + c1) * t + x1;
+            }
+            else
+            {
+                result[channel] = x1 + (x2 - x1) * t;
+            }
+        }
+
+        StoreF32x4(left  + i, LoadF32x4(left  + i) + result[0] * gain_left);
+        StoreF32x4(right + i, LoadF32x4(right + i) + result[1] * gain_right);
+    }
+
+    voice.position += frame_count * step;
+    if (voice.position >= count)
+    {
+        if (voice.looping)
+            voice.position = fmod(voice.position, cast(count, f64));
+        else
+            voice.active = false;
+    }
+}
+
+// Overwrites 'buffer' with the sum of all active voices.
+void MixVoices(Mixer& mixer, SoundBuffer& buffer)
+{
+    ASSERT(buffer.samples_per_second != 0, "Sound buffer has no sample rate.\n");
+
+    // Planar accumulators, so each voice can add 4 frames per channel at once.
+    f32 left [MIXER_CHUNK_FRAMES];
+    f32 right[MIXER_CHUNK_FRAMES];
+
+    u32 frame_count = buffer.size / sizeof(Sample);
+    f32x4 master    = F32x4(mixer.master_volume);
+
+    for (u32 done = 0; done < frame_count; done += MIXER_CHUNK_FRAMES)
+    {
+        u32 frames = frame_count - done;
+        if (frames > MIXER_CHUNK_FRAMES)
+            frames = MIXER_CHUNK_FRAMES;
+
+        memset(left,  0, sizeof(left));
+        memset(right, 0, sizeof(right));
+
+        for (u32 i = 0; i < MIXER_MAX_VOICES; ++i)
+        {
+            if (mixer.voices[i].active)
+                MixVoice(mixer.voices[i], left, right, frames, buffer.samples_per_second);
+        }
+
+        s16* out = buffer.data + done * 2;
+        u32  i   = 0;
+        for (; i + 4 <= frames; i += 4)
+        {
+            f32x4 l = LoadF32x4(left  + i) * master;
+            f32x4 r = LoadF32x4(right + i) * master;
+            StoreSaturatedS16(out + i * 2, InterleaveLow(l, r), InterleaveHigh(l, r));
+        }
+        for (; i < frames; ++i)
+        {
+            out[i * 2 + 0] = SaturateS16(left[i]  * mixer.master_volume);
+            out[i * 2 + 1] = SaturateS16(right[i] * mixer.master_volume);
+        }
+    }
+}
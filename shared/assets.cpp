@@ -0,0 +1,555 @@
+// Bitmaps offered to the game through 'Platform' (see main.h), reloaded while the game runs
+// whenever their files change on disk.
+//
+// A watcher thread checks the size and modification time of every loaded file each
+// ASSET_POLL_INTERVAL. When they change it reads the file and hashes the content, and if the
+// content is the same as what's loaded (the file was touched, or saved without changes) that's
+// the end of it. Otherwise it converts the file into the asset's back slot. Only the assets that
+// changed are converted, and none of it happens on the frame thread.
+//
+// Every asset has two slots of pixels from the asset arena: the front one, which the game sees,
+// and the back one, which the watcher converts into. The host calls 'SwapAssets' between frames,
+// which flips the slots of the assets that are ready. That's all the frame thread ever does, so
+// a large asset never makes a frame late, and the pixels never change while the game draws them.
+// The time from noticing the change to the swap is the swap latency.
+//
+//     state = front slot << 2 | phase
+//
+//     ASSET_IDLE        -> ASSET_CONVERTING   Watcher, before writing the back slot.
+//     ASSET_CONVERTING  -> ASSET_READY        Watcher, when the back slot is done.
+//     ASSET_READY       -> ASSET_CONVERTING   Watcher, if the file changed again before the swap.
+//     ASSET_READY       -> ASSET_IDLE         'SwapAssets', flipping the front slot.
+//
+// The front slot is part of the state so the watcher and the swap can't disagree about which
+// slot is the back one.
+//
+// Only uncompressed 24 and 32 bit BMP files are supported for now.
+//
+// NOTE(ted): Polling a handful of files is cheap, but an inotify/kqueue watch (like the macOS
+// hotloader's 'CreateMonitor') would cut the latency further.
+//
+// Requires 'virtual_memory.cpp' and 'NanoTime' from the platform's clock.cpp.
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+
+#define ASSET_MAX_COUNT      64
+#define ASSET_PATH_SIZE      512
+#define ASSET_ARENA_SIZE     GIGABYTES(1)
+#define ASSET_POLL_INTERVAL  MILLI_TO_NANO(50)
+#define ASSET_MAX_DIMENSION  16384
+
+#if !defined(HANDMADE_ASSET_DIRECTORY)
+#define HANDMADE_ASSET_DIRECTORY "resources"  // Set by CMake to the source tree's, so edits show up.
+#endif
+
+
+enum AssetPhase
+{
+    ASSET_IDLE,
+    ASSET_CONVERTING,
+    ASSET_READY,
+};
+
+struct AssetSlot
+{
+    Pixel* pixels;
+    u64    capacity;  // In pixels.
+    s32    width;
+    s32    height;
+};
+
+struct Asset
+{
+    char path[ASSET_PATH_SIZE];    // Resolved against the asset directory.
+    char name[ASSET_PATH_SIZE];    // As the game asked for it.
+
+    AssetSlot slots[2];
+    u32 state;                     // Front slot << 2 | 'AssetPhase'. Use __atomic_* to access.
+
+    // Watcher thread only (or the main thread before the asset is published).
+    u64 file_time;
+    u64 file_size;
+    u64 content_hash;
+    u64 change_time;               // When the change in the back slot was noticed. The main thread reads it while ASSET_READY.
+
+    // Main thread only.
+    Bitmap bitmap;                 // The front slot, as handed to the game.
+};
+
+struct AssetStats
+{
+    u32 assets;
+    u32 reloads;             // Swapped in.
+    u32 unchanged;           // Written, but with the same content, so not converted.
+    u32 failed;              // Couldn't be converted. The previous pixels stay.
+    u64 convert_max;         // Nanoseconds to read, hash and convert a file, on the watcher thread.
+    u64 swap_latency_total;  // Nanoseconds from noticing a change to the swap.
+    u64 swap_latency_max;
+};
+
+// A growable buffer to read files into, one per thread.
+struct AssetScratch
+{
+    u8* data;
+    u64 capacity;
+};
+
+struct Assets
+{
+    Asset assets[ASSET_MAX_COUNT];
+    u32   count;                   // Written by the main thread, read by the watcher. Use __atomic_* to access.
+    char  directory[ASSET_PATH_SIZE];
+
+    Buffer          arena;         // Pixels of all slots. Pushed to under 'lock'.
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_t       watcher;
+    bool            running;
+    bool            stop;
+
+    AssetScratch main_scratch;
+    AssetScratch watcher_scratch;
+
+    AssetStats stats;              // Counters the watcher writes use __atomic_*. Read them with 'GetAssetStats'.
+};
+static Assets assets;
+
+
+// 64-bit FNV-1a, a word at a time. Only used to tell whether a file's content changed.
+static u64 HashAssetContent(const u8* data, u64 size)
+{
+    u64 hash = 0xCBF29CE484222325ULL;
+    u64 i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        u64 word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001B3ULL;
+    }
+    for (; i < size; ++i)
+        hash = (hash ^ data[i]) * 0x100000001B3ULL;
+    return hash ^ size;
+}
+
+// Reads all of 'path' into 'scratch'. Returns the size, or 0 on failure.
+static u64 ReadWholeFile(const char* path, AssetScratch& scratch)
+{
+    int file = open(path, O_RDONLY);
+    if (file == -1)
+        return 0;
+
+    struct stat info;
+    if (fstat(file, &info) == -1 || info.st_size <= 0)
+    {
+        close(file);
+        return 0;
+    }
+
+    u64 size = info.st_size;
+    if (size > scratch.capacity)
+    {
+        u8* data = cast(realloc(scratch.data, size), u8*);
+        if (!data)
+        {
+            close(file);
+            return 0;
+        }
+        scratch.data     = data;
+        scratch.capacity = size;
+    }
+
+    u64 total = 0;
+    while (total < size)
+    {
+        ssize_t bytes = read(file, scratch.data + total, size - total);
+        if (bytes <= 0)
+            break;
+        total += bytes;
+    }
+    close(file);
+    return total == size ? size : 0;
+}
+
+
+// ---- BMP ----
+struct BmpInfo
+{
+    s32  width;
+    s32  height;
+    bool top_down;
+    u32  bits_per_pixel;
+    u64  pixel_offset;
+    u64  stride;
+    u32  shifts[4];      // Of red, green, blue and alpha in a 32 bit pixel.
+    bool has_alpha;
+};
+
+// Returns the number of trailing zeroes, if 'mask' is 8 contiguous bits on a byte boundary.
+static bool ByteMaskShift(u32 mask, u32& shift)
+{
+    for (shift = 0; shift < 32; shift += 8)
+    {
+        if (mask == (0xFFu << shift))
+            return true;
+    }
+    return false;
+}
+
+// Checks the header, and that all the pixels are in the file.
+static bool ParseBmp(const u8* data, u64 size, BmpInfo& info)
+{
+    if (size < 54 || data[0] != 'B' || data[1] != 'M')
+        return false;
+
+    u32 header_size = ReadU32(data + 14);
+    u32 compression = ReadU32(data + 30);
+    s64 height      = cast(ReadU32(data + 22), s32);  // Negative if the rows are stored top to bottom.
+    info.width          = cast(ReadU32(data + 18), s32);
+    info.height         = cast(height < 0 ? -height : height, s32);
+    info.top_down       = height < 0;
+    info.bits_per_pixel = ReadU16(data + 28);
+    info.pixel_offset   = ReadU32(data + 10);
+
+    if (header_size < 40 || ReadU16(data + 26) != 1)
+        return false;
+    if (info.width <= 0 || info.height <= 0 || info.width > ASSET_MAX_DIMENSION || info.height > ASSET_MAX_DIMENSION)
+        return false;
+
+    // Blue, green, red (and alpha) from the lowest byte up, unless there are masks.
+    info.shifts[0] = 16; info.shifts[1] = 8; info.shifts[2] = 0; info.shifts[3] = 24;
+    info.has_alpha = false;
+
+    bool uncompressed = compression == 0 && (info.bits_per_pixel == 24 || info.bits_per_pixel == 32);
+    bool bitfields    = compression == 3 && info.bits_per_pixel == 32;  // Masks right after the 40 byte header.
+    if (!uncompressed && !bitfields)
+        return false;
+
+    if (bitfields)
+    {
+        if (size < 66)
+            return false;
+        for (u32 i = 0; i < 3; ++i)
+        {
+            if (!ByteMaskShift(ReadU32(data + 54 + 4 * i), info.shifts[i]))
+                return false;
+        }
+        if (header_size >= 56 && size >= 70 && ReadU32(data + 66) != 0)
+            info.has_alpha = ByteMaskShift(ReadU32(data + 66), info.shifts[3]);
+    }
+
+    info.stride = (cast(info.width, u64) * info.bits_per_pixel + 31) / 32 * 4;
+    return info.pixel_offset <= size && info.stride * info.height <= size - info.pixel_offset;
+}
+
+static void ConvertBmp(const u8* data, const BmpInfo& info, Pixel* output)
+{
+    for (s32 y = 0; y < info.height; ++y)
+    {
+        s32 source_y    = info.top_down ? y : info.height - 1 - y;
+        const u8* row   = data + info.pixel_offset + cast(source_y, u64) * info.stride;
+        Pixel*    pixel = output + cast(y, u64) * info.width;
+
+        if (info.bits_per_pixel == 24)
+        {
+            for (s32 x = 0; x < info.width; ++x, row += 3, ++pixel)
+            {
+                pixel->r = row[2];
+                pixel->g = row[1];
+                pixel->b = row[0];
+                pixel->a = 255;
+            }
+        }
+        else
+        {
+            for (s32 x = 0; x < info.width; ++x, row += 4, ++pixel)
+            {
+                u32 value = ReadU32(row);
+                pixel->r = cast(value >> info.shifts[0], u8);
+                pixel->g = cast(value >> info.shifts[1], u8);
+                pixel->b = cast(value >> info.shifts[2], u8);
+                pixel->a = info.has_alpha ? cast(value >> info.shifts[3], u8) : 255;
+            }
+        }
+    }
+}
+
+
+// ---- RELOADING ----
+static u64 FileTime(const struct stat& info)
+{
+#if defined(__APPLE__) && defined(__MACH__)
+    return cast(info.st_mtimespec.tv_sec, u64) * 1000000000ULL + info.st_mtimespec.tv_nsec;
+#else
+    return cast(info.st_mtim.tv_sec, u64) * 1000000000ULL + info.st_mtim.tv_nsec;
+#endif
+}
+
+// Converts the file of 'asset' into its back slot if it changed since the last call. Only
+// called by the watcher, or by the main thread before the asset is published.
+static void RefreshAsset(Asset& asset, AssetScratch& scratch)
+{
+    struct stat info;
+    if (stat(asset.path, &info) != 0)
+        return;  // Gone, maybe for a moment while an editor saves. Keep what we have.
+    if (FileTime(info) == asset.file_time && cast(info.st_size, u64) == asset.file_size)
+        return;
+
+    u64 change_time = NanoTime();
+    u64 size = ReadWholeFile(asset.path, scratch);
+
+    // Still being written if it changed while we read it. Try again on the next poll.
+    struct stat after;
+    if (size == 0 || stat(asset.path, &after) != 0 || FileTime(after) != FileTime(info) || cast(after.st_size, u64) != size)
+        return;
+    asset.file_time = FileTime(info);
+    asset.file_size = size;
+
+    u64 hash = HashAssetContent(scratch.data, size);
+    if (hash == asset.content_hash)
+    {
+        __atomic_add_fetch(&assets.stats.unchanged, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    asset.content_hash = hash;
+
+    BmpInfo bmp;
+    if (!ParseBmp(scratch.data, size, bmp))
+    {
+        fprintf(stderr, "[Warning]: '%s' isn't a supported bitmap, keeping the previous one.\n", asset.name);
+        __atomic_add_fetch(&assets.stats.failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Claim the back slot. It's either idle or ready (only this thread converts), so this only
+    // retries if the swap gets in between.
+    u32  state = __atomic_load_n(&asset.state, __ATOMIC_ACQUIRE);
+    bool pending;
+    for (;;)
+    {
+        pending = (state & 3) == ASSET_READY;
+        u32 desired = (state & ~3u) | ASSET_CONVERTING;
+        if (__atomic_compare_exchange_n(&asset.state, &state, desired, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+        {
+            state = desired;
+            break;
+        }
+    }
+    u32 front = state >> 2;
+    AssetSlot& back = asset.slots[front ^ 1];
+
+    u64 pixel_count = cast(bmp.width, u64) * bmp.height;
+    if (pixel_count > back.capacity)
+    {
+        // LEAK(ted): The old pixels stay in the arena. Assets rarely grow, so it's not worth a free list.
+        pthread_mutex_lock(&assets.lock);
+        Pixel* pixels = PushArray(assets.arena, pixel_count, Pixel);
+        pthread_mutex_unlock(&assets.lock);
+        if (!pixels)
+        {
+            fprintf(stderr, "[Warning]: Not enough asset memory for '%s' (%dx%d).\n", asset.name, bmp.width, bmp.height);
+            __atomic_add_fetch(&assets.stats.failed, 1, __ATOMIC_RELAXED);
+            asset.content_hash = 0;  // Try again when it changes.
+            __atomic_store_n(&asset.state, (front << 2) | (pending ? ASSET_READY : ASSET_IDLE), __ATOMIC_RELEASE);
+            return;
+        }
+        back.pixels   = pixels;
+        back.capacity = pixel_count;
+    }
+
+    ConvertBmp(scratch.data, bmp, back.pixels);
+    back.width  = bmp.width;
+    back.height = bmp.height;
+    if (!pending)
+        asset.change_time = change_time;  // Otherwise the game has been waiting since the earlier change.
+
+    u64 convert_time = NanoTime() - change_time;
+    u64 convert_max  = __atomic_load_n(&assets.stats.convert_max, __ATOMIC_RELAXED);
+    if (convert_time > convert_max)
+        __atomic_store_n(&assets.stats.convert_max, convert_time, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&asset.state, (front << 2) | ASSET_READY, __ATOMIC_RELEASE);
+}
+
+static void* AssetWatcherThread(void* data)
+{
+#if defined(__linux__)
+    // Below the frame thread, so converting a large asset never takes the core from it.
+    setpriority(PRIO_PROCESS, cast(syscall(SYS_gettid), id_t), 10);
+#endif
+
+    pthread_mutex_lock(&assets.lock);
+    while (!assets.stop)
+    {
+        pthread_mutex_unlock(&assets.lock);
+
+        u32 count = __atomic_load_n(&assets.count, __ATOMIC_ACQUIRE);
+        for (u32 i = 0; i < count; ++i)
+            RefreshAsset(assets.assets[i], assets.watcher_scratch);
+
+        pthread_mutex_lock(&assets.lock);
+        if (assets.stop)
+            break;
+
+        timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        u64 nanoseconds = until.tv_nsec + ASSET_POLL_INTERVAL;
+        until.tv_sec  += nanoseconds / 1000000000ULL;
+        until.tv_nsec  = nanoseconds % 1000000000ULL;
+        pthread_cond_timedwait(&assets.wake, &assets.lock, &until);
+    }
+    pthread_mutex_unlock(&assets.lock);
+    return 0;
+}
+
+// Flips the slots of 'asset' if a new version is ready, and gives when the change was noticed.
+// Main thread only.
+static bool SwapAsset(Asset& asset, u64& change_time)
+{
+    u32 state = __atomic_load_n(&asset.state, __ATOMIC_ACQUIRE);
+    if ((state & 3) != ASSET_READY)
+        return false;
+
+    // Before the flip: once the asset is idle, the watcher may claim it and write a newer time.
+    change_time = asset.change_time;
+    u32 front = (state >> 2) ^ 1;
+    if (!__atomic_compare_exchange_n(&asset.state, &state, (front << 2) | ASSET_IDLE, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return false;  // The watcher took it back for an even newer version.
+
+    const AssetSlot& slot = asset.slots[front];
+    asset.bitmap.width  = slot.width;
+    asset.bitmap.height = slot.height;
+    asset.bitmap.pixels = slot.pixels;
+    asset.bitmap.generation += 1;
+    return true;
+}
+
+
+// ---- PLATFORM SERVICE ----
+AssetHandle LoadBitmapAsset(const char* name)
+{
+    // Loading the same file twice (e.g. after the game is reloaded) gives the same asset.
+    u32 count = assets.count;
+    for (u32 i = 0; i < count; ++i)
+    {
+        if (strcmp(assets.assets[i].name, name) == 0)
+            return i + 1;
+    }
+
+    if (count == ASSET_MAX_COUNT)
+    {
+        REPORT_ERROR("Too many assets (max %d).\n", ASSET_MAX_COUNT);
+        return 0;
+    }
+
+    Asset& asset = assets.assets[count];
+    memset(&asset, 0, sizeof(asset));
+    snprintf(asset.name, sizeof(asset.name), "%s", name);
+    snprintf(asset.path, sizeof(asset.path), "%s/%s", assets.directory, name);
+
+    // The first load happens right away, so the game has its bitmaps from the first frame. If
+    // the file isn't there yet, the watcher picks it up when it is.
+    u64 change_time;
+    RefreshAsset(asset, assets.main_scratch);
+    SwapAsset(asset, change_time);
+    if (!asset.bitmap.pixels)
+        fprintf(stderr, "[Warning]: Couldn't load '%s'.\n", asset.path);
+
+    __atomic_store_n(&assets.count, count + 1, __ATOMIC_RELEASE);
+    return count + 1;
+}
+
+Bitmap GetBitmapAsset(AssetHandle handle)
+{
+    if (handle == 0 || handle > assets.count)
+    {
+        Bitmap empty = {0};
+        return empty;
+    }
+    return assets.assets[handle - 1].bitmap;
+}
+
+
+// ---- HOST ----
+// 'directory' is where the game's asset paths are relative to, HANDMADE_ASSET_DIRECTORY if 0.
+bool InitializeAssets(Platform& platform, const char* directory)
+{
+    if (!directory)
+        directory = HANDMADE_ASSET_DIRECTORY;
+    snprintf(assets.directory, sizeof(assets.directory), "%s", directory);
+
+    if (!AllocateArena(assets.arena, ASSET_ARENA_SIZE))
+    {
+        REPORT_ERROR("Couldn't reserve the asset arena.\n");
+        return false;
+    }
+
+    pthread_mutex_init(&assets.lock, 0);
+    pthread_cond_init(&assets.wake, 0);
+    if (pthread_create(&assets.watcher, 0, AssetWatcherThread, 0) != 0)
+    {
+        REPORT_ERROR("Couldn't start the asset watcher thread.\n");
+        return false;
+    }
+    assets.running = true;
+
+    platform.load_bitmap = LoadBitmapAsset;
+    platform.get_bitmap  = GetBitmapAsset;
+    return true;
+}
+
+// Call between frames. Hands the game the assets that have been reconverted since the last call.
+void SwapAssets()
+{
+    u64 now = NanoTime();
+    for (u32 i = 0; i < assets.count; ++i)
+    {
+        Asset& asset = assets.assets[i];
+        u64 change_time;
+        if (!SwapAsset(asset, change_time))
+            continue;
+
+        u64 latency = now - change_time;
+        assets.stats.reloads += 1;
+        assets.stats.swap_latency_total += latency;
+        if (latency > assets.stats.swap_latency_max)
+            assets.stats.swap_latency_max = latency;
+
+        printf("Reloaded '%s' (%dx%d), %.2f ms after the change.\n",
+               asset.name, asset.bitmap.width, asset.bitmap.height, latency / 1000000.0);
+    }
+}
+
+AssetStats GetAssetStats()
+{
+    AssetStats stats = assets.stats;
+    stats.assets      = assets.count;
+    stats.unchanged   = __atomic_load_n(&assets.stats.unchanged,   __ATOMIC_RELAXED);
+    stats.failed      = __atomic_load_n(&assets.stats.failed,      __ATOMIC_RELAXED);
+    stats.convert_max = __atomic_load_n(&assets.stats.convert_max, __ATOMIC_RELAXED);
+    return stats;
+}
+
+// Stops the watcher. The bitmaps stay valid.
+void CloseAssets()
+{
+    if (!assets.running)
+        return;
+
+    pthread_mutex_lock(&assets.lock);
+    assets.stop = true;
+    pthread_cond_signal(&assets.wake);
+    pthread_mutex_unlock(&assets.lock);
+    pthread_join(assets.watcher, 0);
+    assets.running = false;
+}
@@ -0,0 +1,527 @@
+// Asynchronous file I/O offered to the game through 'Platform' (see main.h).
+//
+// On Linux the requests go straight to the kernel through io_uring. When io_uring
+// isn't available (old kernel, blocked by seccomp, or not Linux at all) they're
+// handed to a small pool of threads doing blocking pread/pwrite instead.
+//
+// Either way, requests are finished on a thread of the backend (the io_uring completion thread,
+// or the worker that did the transfer) as soon as they're done, and waiters are woken through
+// 'work_done'. So completion times mean the same thing for both backends.
+//
+// The latency of every request is recorded into the "io_latency" metric (see metrics.cpp).
+//
+// Requires 'NanoTime' from the platform's clock.cpp and metrics.cpp.
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+
+#define IO_MAX_REQUESTS    64
+#define IO_WORKER_COUNT    4
+
+
+enum IOOperation
+{
+    IO_READ,
+    IO_WRITE,
+};
+
+struct IORequest
+{
+    u32  generation;  // Bumped every time the slot is reused, so stale tickets can be detected.
+    bool in_use;
+
+    IOOperation operation;
+    int   file;
+    u64   offset;
+    u8*   data;
+    u64   size;
+    u64   transferred;
+    iovec vector;     // Must outlive the submission when using io_uring.
+
+    IOStatus status;  // Written by the completing thread. Use __atomic_* to access.
+    u64 submit_time;
+    u64 complete_time;
+};
+
+struct IOStats
+{
+    u32 in_flight;
+    u64 bytes_per_second;   // Since the previous call to 'GetIOStats'.
+    u64 latency_p50;        // Nanoseconds from submit to completion, since the previous call.
+    u64 latency_p90;
+    u64 latency_p99;
+    u64 latency_max;
+};
+
+
+#if defined(__linux__)
+struct IOUring
+{
+    int file;
+
+    u32* sq_head;
+    u32* sq_tail;
+    u32* sq_mask;
+    u32* sq_array;
+    io_uring_sqe* sqes;
+
+    u32* cq_head;
+    u32* cq_tail;
+    u32* cq_mask;
+    io_uring_cqe* cqes;
+};
+#endif
+
+struct AsyncIO
+{
+    IORequest requests[IO_MAX_REQUESTS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t  work_available;
+    pthread_cond_t  work_done;
+
+    bool use_uring;
+#if defined(__linux__)
+    IOUring   ring;
+    pthread_t completer;  // The only thread that reaps the completion queue.
+#endif
+
+    // Thread pool fallback. Circular queue of request indices.
+    pthread_t workers[IO_WORKER_COUNT];
+    u32 queue[IO_MAX_REQUESTS];
+    u32 queue_head;
+    u32 queue_count;
+
+    // Statistics.
+    u32 in_flight;
+    u64 bytes_completed;
+    u64 bytes_at_last_stats;
+    u64 time_at_last_stats;
+    u32 latency_metric;
+    MetricWindow latency_window;  // For 'GetIOStats'.
+};
+static AsyncIO async_io;
+
+
+static IOTicket MakeTicket(u32 index, u32 generation)
+{
+    return (generation << 8) | index;
+}
+
+static IORequest* RequestFromTicket(IOTicket ticket)
+{
+    u32 index      = ticket & 0xFF;
+    u32 generation = ticket >> 8;
+    if (ticket == 0 || index >= IO_MAX_REQUESTS)
+        return 0;
+
+    IORequest* request = &async_io.requests[index];
+    if (!request->in_use || request->generation != generation)
+        return 0;
+    return request;
+}
+
+// Must be called with the lock held.
+static void FinishRequest(IORequest& request, IOStatus status)
+{
+    request.complete_time = NanoTime();
+    close(request.file);
+
+    async_io.in_flight -= 1;
+    async_io.bytes_completed += request.transferred;
+    RecordMetric(async_io.latency_metric, request.complete_time - request.submit_time);
+
+    __atomic_store_n(&request.status, status, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&async_io.work_done);
+}
+
+
+// ---- IO_URING BACKEND ----
+#if defined(__linux__)
+static bool IOUringSetup(IOUring& ring, u32 entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int file = cast(syscall(__NR_io_uring_setup, entries, &params), int);
+    if (file < 0)
+        return false;
+
+    u64 sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    u64 cq_size = params.cq_off.cqes  + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+        sq_size = cq_size = (sq_size > cq_size) ? sq_size : cq_size;
+
+    u8* sq = cast(mmap(0, sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, file, IORING_OFF_SQ_RING), u8*);
+    if (sq == MAP_FAILED)
+    {
+        close(file);
+        return false;
+    }
+
+    u8* cq = sq;
+    if (!single_mmap)
+    {
+        cq = cast(mmap(0, cq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, file, IORING_OFF_CQ_RING), u8*);
+        if (cq == MAP_FAILED)
+        {
+            munmap(sq, sq_size);
+            close(file);
+            return false;
+        }
+    }
+
+    void* sqes = mmap(0, params.sq_entries * sizeof(io_uring_sqe), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, file, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        if (!single_mmap)
+            munmap(cq, cq_size);
+        munmap(sq, sq_size);
+        close(file);
+        return false;
+    }
+
+    ring.file     = file;
+    ring.sq_head  = reinterpret_cast<u32*>(sq + params.sq_off.head);
+    ring.sq_tail  = reinterpret_cast<u32*>(sq + params.sq_off.tail);
+    ring.sq_mask  = reinterpret_cast<u32*>(sq + params.sq_off.ring_mask);
+    ring.sq_array = reinterpret_cast<u32*>(sq + params.sq_off.array);
+    ring.sqes     = cast(sqes, io_uring_sqe*);
+    ring.cq_head  = reinterpret_cast<u32*>(cq + params.cq_off.head);
+    ring.cq_tail  = reinterpret_cast<u32*>(cq + params.cq_off.tail);
+    ring.cq_mask  = reinterpret_cast<u32*>(cq + params.cq_off.ring_mask);
+    ring.cqes     = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+// Must be called with the lock held.
+static bool IOUringSubmit(IOUring& ring, u32 index)
+{
+    IORequest& request = async_io.requests[index];
+    request.vector.iov_base = request.data + request.transferred;
+    request.vector.iov_len  = request.size - request.transferred;
+
+    u32 tail = *ring.sq_tail;
+    u32 slot = tail & *ring.sq_mask;
+
+    io_uring_sqe& entry = ring.sqes[slot];
+    memset(&entry, 0, sizeof(entry));
+    entry.opcode    = (request.operation == IO_READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+    entry.fd        = request.file;
+    entry.addr      = reinterpret_cast<u64>(&request.vector);
+    entry.len       = 1;
+    entry.off       = request.offset + request.transferred;
+    entry.user_data = index;
+
+    ring.sq_array[slot] = slot;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    long result;
+    do
+        result = syscall(__NR_io_uring_enter, ring.file, 1, 0, 0, 0, 0);
+    while (result < 0 && errno == EINTR);
+
+    // Once the kernel has consumed the entry, the buffers are its until the completion arrives,
+    // whatever enter returned. Otherwise take the entry back, so a later enter doesn't submit it
+    // after the request is failed and its buffer reused. The kernel only reads the tail inside
+    // enter, and every submission holds the lock, so the head was at 'tail' before this one.
+    if (__atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) != tail)
+        return true;
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+    return false;
+}
+
+// Must be called with the lock held.
+static void IOUringReap(IOUring& ring)
+{
+    u32 head = *ring.cq_head;
+    u32 tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail)
+    {
+        io_uring_cqe& entry = ring.cqes[head & *ring.cq_mask];
+        IORequest& request  = async_io.requests[entry.user_data];
+        ++head;
+
+        if (entry.res < 0)
+        {
+            FinishRequest(request, IO_FAILED);
+            continue;
+        }
+
+        // Short transfers are resubmitted, unless we hit end of file.
+        request.transferred += entry.res;
+        if (entry.res > 0 && request.transferred < request.size)
+        {
+            if (IOUringSubmit(ring, cast(entry.user_data, u32)))
+                continue;
+            FinishRequest(request, IO_FAILED);
+            continue;
+        }
+
+        FinishRequest(request, request.operation == IO_WRITE && request.transferred < request.size ? IO_FAILED : IO_COMPLETED);
+    }
+
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Sleeps in the kernel until there are completions, and finishes their requests. Being the only
+// thread that reaps, none can be taken from the queue between another thread looking at it and
+// going to sleep.
+static void* IOUringCompleter(void* user_data)
+{
+    while (true)
+    {
+        long result = syscall(__NR_io_uring_enter, async_io.ring.file, 0, 1, IORING_ENTER_GETEVENTS, 0, 0);
+        if (result < 0 && errno != EINTR)
+            usleep(1000);  // Shouldn't happen, but poll rather than spin if it does.
+
+        pthread_mutex_lock(&async_io.lock);
+        IOUringReap(async_io.ring);
+        pthread_mutex_unlock(&async_io.lock);
+    }
+    return 0;
+}
+#endif
+
+
+// ---- THREAD POOL BACKEND ----
+static void* IOWorker(void* user_data)
+{
+    pthread_mutex_lock(&async_io.lock);
+    while (true)
+    {
+        while (async_io.queue_count == 0)
+            pthread_cond_wait(&async_io.work_available, &async_io.lock);
+
+        u32 index = async_io.queue[async_io.queue_head];
+        async_io.queue_head = (async_io.queue_head + 1) % IO_MAX_REQUESTS;
+        async_io.queue_count -= 1;
+
+        IORequest& request = async_io.requests[index];
+        pthread_mutex_unlock(&async_io.lock);
+
+        bool failed = false;
+        while (request.transferred < request.size)
+        {
+            u8* data   = request.data + request.transferred;
+            u64 left   = request.size - request.transferred;
+            u64 offset = request.offset + request.transferred;
+
+            ssize_t result = (request.operation == IO_READ) ? pread (request.file, data, left, offset)
+                                                            : pwrite(request.file, data, left, offset);
+            if (result < 0 && errno == EINTR)
+                continue;
+            if (result < 0 || (result == 0 && request.operation == IO_WRITE))
+            {
+                failed = true;
+                break;
+            }
+            if (result == 0)  // End of file.
+                break;
+            request.transferred += result;
+        }
+
+        pthread_mutex_lock(&async_io.lock);
+        FinishRequest(request, failed ? IO_FAILED : IO_COMPLETED);
+    }
+    return 0;
+}
+
+
+// ---- PLATFORM FUNCTIONS ----
+static IOTicket SubmitIO(IOOperation operation, const char* path, u64 offset, u8* data, u64 size)
+{
+    // NOTE(ted): open() itself is still synchronous. It's only a metadata lookup, so it's cheap
+    // compared to the transfer, but it would be the next thing to move off the calling thread.
+    int flags = (operation == IO_READ) ? O_RDONLY : (O_WRONLY | O_CREAT);
+    int file  = open(path, flags, 0644);
+    if (file == -1)
+    {
+        REPORT_ERROR("Couldn't open '%s' for async %s.\n", path, operation == IO_READ ? "read" : "write");
+        return 0;
+    }
+
+    pthread_mutex_lock(&async_io.lock);
+
+    u32 index = IO_MAX_REQUESTS;
+    for (u32 i = 0; i < IO_MAX_REQUESTS; ++i)
+    {
+        if (!async_io.requests[i].in_use)
+        {
+            index = i;
+            break;
+        }
+    }
+    if (index == IO_MAX_REQUESTS)
+    {
+        pthread_mutex_unlock(&async_io.lock);
+        close(file);
+        REPORT_ERROR("Too many async I/O requests in flight (max %i).\n", IO_MAX_REQUESTS);
+        return 0;
+    }
+
+    IORequest& request = async_io.requests[index];
+    request.generation = (request.generation + 1) & 0xFFFFFF;
+    if (request.generation == 0)
+        request.generation = 1;
+    request.in_use      = true;
+    request.operation   = operation;
+    request.file        = file;
+    request.offset      = offset;
+    request.data        = data;
+    request.size        = size;
+    request.transferred = 0;
+    request.status      = IO_PENDING;
+    request.submit_time = NanoTime();
+    async_io.in_flight += 1;
+
+    IOTicket ticket = MakeTicket(index, request.generation);
+
+#if defined(__linux__)
+    if (async_io.use_uring)
+    {
+        if (!IOUringSubmit(async_io.ring, index))
+            FinishRequest(request, IO_FAILED);
+        pthread_mutex_unlock(&async_io.lock);
+        return ticket;
+    }
+#endif
+
+    async_io.queue[(async_io.queue_head + async_io.queue_count) % IO_MAX_REQUESTS] = index;
+    async_io.queue_count += 1;
+    pthread_cond_signal(&async_io.work_available);
+    pthread_mutex_unlock(&async_io.lock);
+
+    return ticket;
+}
+
+IOTicket ReadFileAsync(const char* path, u64 offset, void* destination, u64 size)
+{
+    return SubmitIO(IO_READ, path, offset, cast(destination, u8*), size);
+}
+
+IOTicket WriteFileAsync(const char* path, u64 offset, const void* source, u64 size)
+{
+    return SubmitIO(IO_WRITE, path, offset, cast(const_cast<void*>(source), u8*), size);
+}
+
+// Must be called with the lock held. Retires the request if it's done.
+static IOStatus RetireIfDone(IORequest* request, u64* bytes_transferred)
+{
+    IOStatus status = __atomic_load_n(&request->status, __ATOMIC_ACQUIRE);
+    if (status != IO_PENDING)
+    {
+        if (bytes_transferred)
+            *bytes_transferred = request->transferred;
+        request->in_use = false;
+    }
+    return status;
+}
+
+IOStatus PollIO(IOTicket ticket, u64* bytes_transferred)
+{
+    pthread_mutex_lock(&async_io.lock);
+
+    IORequest* request = RequestFromTicket(ticket);
+    if (!request)
+    {
+        pthread_mutex_unlock(&async_io.lock);
+        return IO_INVALID;
+    }
+
+    IOStatus status = RetireIfDone(request, bytes_transferred);
+    pthread_mutex_unlock(&async_io.lock);
+    return status;
+}
+
+IOStatus WaitIO(IOTicket ticket, u64* bytes_transferred)
+{
+    pthread_mutex_lock(&async_io.lock);
+
+    IORequest* request = RequestFromTicket(ticket);
+    if (!request)
+    {
+        pthread_mutex_unlock(&async_io.lock);
+        return IO_INVALID;
+    }
+
+    IOStatus status = IO_PENDING;
+    while ((status = RetireIfDone(request, bytes_transferred)) == IO_PENDING)
+        pthread_cond_wait(&async_io.work_done, &async_io.lock);
+
+    pthread_mutex_unlock(&async_io.lock);
+    return status;
+}
+
+
+IOStats GetIOStats()
+{
+    IOStats stats = {0};
+
+    pthread_mutex_lock(&async_io.lock);
+    u64 now = NanoTime();
+    const Histogram& latencies = ReadMetricWindow(async_io.latency_metric, async_io.latency_window);
+
+    stats.in_flight = async_io.in_flight;
+    if (now > async_io.time_at_last_stats)
+    {
+        u64 bytes = async_io.bytes_completed - async_io.bytes_at_last_stats;
+        stats.bytes_per_second = cast(bytes * (1000000000.0 / (now - async_io.time_at_last_stats)), u64);
+    }
+    async_io.bytes_at_last_stats = async_io.bytes_completed;
+    async_io.time_at_last_stats  = now;
+
+    stats.latency_p50 = HistogramPercentile(latencies, 50.0);
+    stats.latency_p90 = HistogramPercentile(latencies, 90.0);
+    stats.latency_p99 = HistogramPercentile(latencies, 99.0);
+    stats.latency_max = latencies.max;
+    pthread_mutex_unlock(&async_io.lock);
+
+    return stats;
+}
+
+
+// Starts the backend and fills in the I/O functions of 'platform'.
+void InitializeAsyncIO(Platform& platform)
+{
+    pthread_mutex_init(&async_io.lock, 0);
+    pthread_cond_init(&async_io.work_available, 0);
+    pthread_cond_init(&async_io.work_done, 0);
+    async_io.time_at_last_stats = NanoTime();
+    async_io.latency_metric     = RegisterMetric("io_latency", "ns");
+
+#if defined(__linux__)
+    async_io.use_uring = IOUringSetup(async_io.ring, IO_MAX_REQUESTS);
+    if (async_io.use_uring)
+    {
+        int error = pthread_create(&async_io.completer, 0, IOUringCompleter, 0);
+        ASSERT(error == 0, "Couldn't create I/O completion thread. Error code %i.\n", error);
+    }
+#endif
+
+    if (!async_io.use_uring)
+    {
+        for (u32 i = 0; i < IO_WORKER_COUNT; ++i)
+        {
+            int error = pthread_create(&async_io.workers[i], 0, IOWorker, 0);
+            ASSERT(error == 0, "Couldn't create I/O worker thread. Error code %i.\n", error);
+        }
+    }
+
+    platform.read_file_async  = ReadFileAsync;
+    platform.write_file_async = WriteFileAsync;
+    platform.poll_io          = PollIO;
+    platform.wait_io          = WaitIO;
+}
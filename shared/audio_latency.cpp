@@ -0,0 +1,129 @@
+// Keeps track of how far ahead of the playback cursor we write audio, and adapts it.
+//
+// Every time the audio backend asks for samples we know how many frames we've handed it in
+// total, and (from the device, or a simulated clock) how many frames have actually been played.
+// The difference is the real output latency. We aim to keep that at the requested target, but
+// if the callbacks arrive with more jitter than the target can absorb, we write further ahead
+// so we don't glitch.
+//
+// The frames queued at every callback are recorded into the "audio_fill" metric (see
+// metrics.cpp), so underruns can be told apart from a queue that's just running low.
+
+
+struct AudioSettings
+{
+    u32 samples_per_second;
+    u32 target_latency_ms;   // From writing a sample to hearing it.
+    u32 buffer_count;        // How many buffers the backend cycles through.
+};
+
+AudioSettings DefaultAudioSettings()
+{
+    AudioSettings settings;
+    settings.samples_per_second = 44100;
+    settings.target_latency_ms  = 50;
+    settings.buffer_count       = 3;
+    return settings;
+}
+
+struct AudioLatency
+{
+    u32 samples_per_second;
+    u32 target_frames;         // Requested latency.
+    u32 max_frames;            // Total room in the backend's buffers.
+    u32 write_ahead_frames;    // Currently targeted amount of queued audio.
+
+    u64 frames_written;        // Handed to the backend since start.
+    u64 frames_played;         // Last known playback cursor.
+
+    u64 last_callback_time;
+    f64 mean_interval;         // Exponential moving average of the time between callbacks, in ns.
+    f64 jitter;                // Exponential moving average of the deviation from 'mean_interval', in ns.
+
+    u64 latency_ns;            // Latest measured latency from sample write to playback cursor.
+    u64 max_latency_ns;        // Since the last call to 'ResetAudioLatencyStats'.
+    u32 underruns;             // Times the playback cursor caught up with what we'd written.
+
+    u32 fill_metric;           // Frames queued at each callback.
+};
+
+
+// 'buffer_frames' is the capacity of a single backend buffer.
+void InitializeAudioLatency(AudioLatency& latency, AudioSettings settings, u32 buffer_frames)
+{
+    memset(&latency, 0, sizeof(latency));
+    latency.samples_per_second = settings.samples_per_second;
+    latency.target_frames      = settings.target_latency_ms * settings.samples_per_second / 1000;
+    latency.max_frames         = buffer_frames * settings.buffer_count;
+    latency.write_ahead_frames = latency.target_frames < latency.max_frames ? latency.target_frames : latency.max_frames;
+    latency.fill_metric        = RegisterMetric("audio_fill", "frames");
+}
+
+// Frames per backend buffer for the given settings. Leaves room to write up to twice the
+// target ahead when the callbacks are jittery.
+u32 AudioBufferFrames(AudioSettings settings)
+{
+    ASSERT(settings.buffer_count != 0, "Need at least one audio buffer.\n");
+
+    u32 target_frames = settings.target_latency_ms * settings.samples_per_second / 1000;
+    u32 frames = (2 * target_frames + settings.buffer_count - 1) / settings.buffer_count;
+    return (frames + 3) & ~3u;  // Multiple of 4, so the mixer never takes its scalar tail path.
+}
+
+// Call at the start of every callback with the backend's playback cursor. Returns how many
+// frames should be written now, at most 'capacity'.
+u32 AudioFramesToWrite(AudioLatency& latency, u64 now, u64 frames_played, u32 capacity)
+{
+    // Track callback timing.
+    if (latency.last_callback_time != 0)
+    {
+        f64 interval = cast(now - latency.last_callback_time, f64);
+        if (latency.mean_interval == 0)
+            latency.mean_interval = interval;
+
+        f64 deviation = interval - latency.mean_interval;
+        if (deviation < 0)
+            deviation = -deviation;
+
+        latency.mean_interval += (interval  - latency.mean_interval) / 16.0;
+        latency.jitter        += (deviation - latency.jitter)        / 16.0;
+    }
+    latency.last_callback_time = now;
+
+    // Measure the actual latency.
+    latency.frames_played = frames_played;
+    u64 queued = 0;
+    if (latency.frames_written > frames_played)
+        queued = latency.frames_written - frames_played;
+    else if (latency.frames_written != 0)
+        ++latency.underruns;
+    RecordMetric(latency.fill_metric, queued);
+
+    latency.latency_ns = queued * 1000000000ULL / latency.samples_per_second;
+    if (latency.latency_ns > latency.max_latency_ns)
+        latency.max_latency_ns = latency.latency_ns;
+
+    // We need enough queued to last until the next callback, even a late one.
+    f64 frames_per_ns = latency.samples_per_second / 1000000000.0;
+    u64 needed = cast((latency.mean_interval + 4.0 * latency.jitter) * frames_per_ns, u64);
+    u64 write_ahead = needed > latency.target_frames ? needed : latency.target_frames;
+    if (write_ahead > latency.max_frames)
+        write_ahead = latency.max_frames;
+    latency.write_ahead_frames = cast(write_ahead, u32);
+
+    u64 frames = write_ahead > queued ? write_ahead - queued : 0;
+    if (frames > capacity)
+        frames = capacity;
+    return cast(frames, u32);
+}
+
+void AudioFramesWritten(AudioLatency& latency, u32 frames)
+{
+    latency.frames_written += frames;
+}
+
+void ResetAudioLatencyStats(AudioLatency& latency)
+{
+    latency.max_latency_ns = 0;
+    latency.underruns      = 0;
+}
@@ -0,0 +1,496 @@
+// Flight recorder. Keeps the last FLIGHT_FRAMES frames of timing, input and memory stats in a
+// ring, and when a frame goes over budget dumps them to disk together with the game's memory as
+// it was at the start of those frames. Replaying the dump (headless '--replay') runs the same
+// frames from the same state with the same input, so a hitch seen once can be reproduced.
+//
+// Every FLIGHT_SNAPSHOT_INTERVAL frames the used part of the arenas is copied, right before the
+// frame's 'Update', into the older of two snapshots. So the other one is always between
+// FLIGHT_SNAPSHOT_INTERVAL and FLIGHT_FRAMES frames old, and the frames since then are still in
+// the ring. On a spike that snapshot is swapped with a spare one and the frames since are copied
+// out, and a background thread writes them (the snapshot goes back afterwards, unless a newer one
+// has taken its place):
+//
+//     <prefix>-<n>.flight   FlightHeader, FlightFrame (frame_count), persistent arena, temporary arena.
+//     <prefix>-<n>.csv      The frames as text, for a quick look.
+//
+// Until it's done, further spikes are only counted. At most FLIGHT_MAX_DUMPS are written per run.
+//
+// Steady state cost is filling in a ring entry and a 'getrusage' per frame, and copying the
+// arenas every FLIGHT_SNAPSHOT_INTERVAL frames.
+// TODO(ted): Large arenas would rather be snapshotted copy-on-write (fork, or write protection)
+// than copied.
+//
+// Requires 'profiler.cpp', 'virtual_memory.cpp' and 'NanoTime' from the platform's clock.cpp.
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/resource.h>
+
+
+#define FLIGHT_MAGIC              0x524C4648  // "HFLR"
+#define FLIGHT_VERSION            2
+#define FLIGHT_FRAMES             256
+#define FLIGHT_SNAPSHOT_INTERVAL  (FLIGHT_FRAMES / 2)
+#define FLIGHT_MAX_BLOCKS         8           // Profiler blocks kept per frame.
+#define FLIGHT_MAX_KEYS           (sizeof(KeyBoard::keys) / sizeof(Key))  // All of them, or a replay gets other input.
+#define FLIGHT_MAX_DUMPS          16
+#define FLIGHT_PATH_SIZE          512
+
+
+struct FlightHeader
+{
+    u32 magic;
+    u32 version;
+    u32 frame_count;
+    u32 spike;                   // Index of the frame that went over budget.
+    u64 budget_ns;
+    u64 first_frame;             // The host's number of the first frame.
+
+    u64 persistent_address;      // Replaying needs the arenas at the same addresses.
+    u64 persistent_used;
+    u64 temporary_address;
+    u64 temporary_used;
+
+    s32 width;                   // Of the framebuffer.
+    s32 height;
+    u32 layout;
+    u32 block_count;
+    char block_names[FLIGHT_MAX_BLOCKS][32];
+};
+
+struct FlightFrame
+{
+    u64 frame;
+    u64 nanoseconds;             // As the host measured the frame.
+    u64 block_cycles[FLIGHT_MAX_BLOCKS];  // Of the profiler's first blocks, named in the header.
+
+    u64 persistent_used;
+    u64 temporary_used;
+    u64 committed;               // By all arenas, the host's included.
+    u32 minor_faults;            // Page faults of the frame thread during the frame.
+    u32 major_faults;
+
+    u32 key_count;
+    Key keys[FLIGHT_MAX_KEYS];   // The keyboard given to 'Update'.
+};
+
+struct FlightSnapshot
+{
+    u8* data;                    // Persistent arena, then temporary arena.
+    u64 capacity;
+    u64 persistent_used;
+    u64 temporary_used;
+    u64 frame;                   // Taken before this frame's 'Update'.
+    bool valid;
+};
+
+struct FlightStats
+{
+    u32 spikes;                  // Frames over budget.
+    u32 dumps;                   // Written to disk.
+    u32 skipped;                 // Spikes while a dump was being written, or after the last one allowed.
+};
+
+struct FlightRecorder
+{
+    bool enabled;
+    u64  budget_ns;
+    char prefix[FLIGHT_PATH_SIZE];
+    s32  width;
+    s32  height;
+    u32  layout;
+
+    FlightFrame ring[FLIGHT_FRAMES];
+    u64 frame;                   // Frames recorded.
+    u64 minor_faults;            // At the end of the previous frame.
+    u64 major_faults;
+
+    FlightSnapshot snapshots[2];
+    u32 next_snapshot;
+
+    // Handed to the writer on a spike. Owned by the writer while 'pending' is set.
+    FlightHeader   dump_header;
+    FlightFrame    dump_frames[FLIGHT_FRAMES];
+    FlightSnapshot dump_snapshot;
+    s32            dump_slot;    // Of 'snapshots' the dump's snapshot came from, -1 once it's been given back.
+    bool           pending;      // Use __atomic_* to access.
+
+    pthread_t       writer;
+    pthread_mutex_t lock;
+    pthread_cond_t  dump_available;
+    bool            stop;
+
+    FlightStats stats;           // 'dumps' is written by the writer with __atomic_*.
+};
+
+
+static bool TakeFlightSnapshot(FlightSnapshot& snapshot, const Memory& memory, u64 frame)
+{
+    u64 size = memory.persistent.used + memory.temporary.used;
+    if (size > snapshot.capacity)
+    {
+        u8* data = cast(realloc(snapshot.data, size), u8*);
+        if (!data)
+            return false;
+        snapshot.data     = data;
+        snapshot.capacity = size;
+    }
+
+    memcpy(snapshot.data, memory.persistent.data, memory.persistent.used);
+    memcpy(snapshot.data + memory.persistent.used, memory.temporary.data, memory.temporary.used);
+    snapshot.persistent_used = memory.persistent.used;
+    snapshot.temporary_used  = memory.temporary.used;
+    snapshot.frame           = frame;
+    snapshot.valid           = true;
+    return true;
+}
+
+static void ReadPageFaults(u64& minor, u64& major)
+{
+    struct rusage usage;
+#if defined(RUSAGE_THREAD)
+    getrusage(RUSAGE_THREAD, &usage);
+#else
+    getrusage(RUSAGE_SELF, &usage);
+#endif
+    minor = usage.ru_minflt;
+    major = usage.ru_majflt;
+}
+
+
+// ---- WRITER ----
+static bool WriteFlightDump(FlightRecorder& recorder, u32 number)
+{
+    const FlightHeader&   header   = recorder.dump_header;
+    const FlightSnapshot& snapshot = recorder.dump_snapshot;
+
+    char path[FLIGHT_PATH_SIZE + 32];
+    snprintf(path, sizeof(path), "%s-%u.flight", recorder.prefix, number);
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+        REPORT_ERROR("Couldn't create flight recorder dump '%s'.\n", path);
+        return false;
+    }
+    u64 written = fwrite(&header, sizeof(header), 1, file)
+                + fwrite(recorder.dump_frames, sizeof(FlightFrame), header.frame_count, file)
+                + fwrite(snapshot.data, snapshot.persistent_used + snapshot.temporary_used, 1, file);
+    fclose(file);
+    if (written != 1 + header.frame_count + (snapshot.persistent_used + snapshot.temporary_used > 0))
+    {
+        REPORT_ERROR("Couldn't write flight recorder dump '%s'.\n", path);
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "%s-%u.csv", recorder.prefix, number);
+    file = fopen(path, "w");
+    if (!file)
+    {
+        REPORT_ERROR("Couldn't create '%s'.\n", path);
+        return false;
+    }
+    fprintf(file, "frame,nanoseconds");
+    for (u32 i = 0; i < header.block_count; ++i)
+        fprintf(file, ",%s_cycles", header.block_names[i]);
+    fprintf(file, ",persistent_used,temporary_used,committed,minor_faults,major_faults,keys\n");
+
+    for (u32 i = 0; i < header.frame_count; ++i)
+    {
+        const FlightFrame& frame = recorder.dump_frames[i];
+        fprintf(file, "%llu,%llu", cast(frame.frame, unsigned long long), cast(frame.nanoseconds, unsigned long long));
+        for (u32 block = 0; block < header.block_count; ++block)
+            fprintf(file, ",%llu", cast(frame.block_cycles[block], unsigned long long));
+        fprintf(file, ",%llu,%llu,%llu,%u,%u,", cast(frame.persistent_used, unsigned long long),
+                cast(frame.temporary_used, unsigned long long), cast(frame.committed, unsigned long long),
+                frame.minor_faults, frame.major_faults);
+        for (u32 key = 0; key < frame.key_count; ++key)
+        {
+            s8 character = frame.keys[key].character;
+            fputc(character > ' ' && character < 127 && character != ',' ? character : '?', file);
+        }
+        fprintf(file, "\n");
+    }
+    fclose(file);
+
+    const FlightFrame& spike = recorder.dump_frames[header.spike];
+    fprintf(stderr, "[Flight recorder]: Frame %llu took %.2f ms (budget %.2f ms). Wrote %u frames to '%s-%u.flight'.\n",
+            cast(spike.frame, unsigned long long), spike.nanoseconds / 1000000.0, header.budget_ns / 1000000.0,
+            header.frame_count, recorder.prefix, number);
+    return true;
+}
+
+static void* FlightWriterThread(void* data)
+{
+    FlightRecorder& recorder = *cast(data, FlightRecorder*);
+    u32 number = 0;
+
+    pthread_mutex_lock(&recorder.lock);
+    while (true)
+    {
+        while (!__atomic_load_n(&recorder.pending, __ATOMIC_ACQUIRE) && !recorder.stop)
+            pthread_cond_wait(&recorder.dump_available, &recorder.lock);
+        if (!__atomic_load_n(&recorder.pending, __ATOMIC_ACQUIRE))
+            break;  // Stopped, with nothing left to write.
+        pthread_mutex_unlock(&recorder.lock);
+
+        if (WriteFlightDump(recorder, number++))
+            __atomic_add_fetch(&recorder.stats.dumps, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&recorder.pending, false, __ATOMIC_RELEASE);  // Hands the dump buffers back.
+
+        pthread_mutex_lock(&recorder.lock);
+    }
+    pthread_mutex_unlock(&recorder.lock);
+    return 0;
+}
+
+
+// ---- RECORDING ----
+// Dumps go to '<prefix>-<n>.flight' when a frame takes longer than 'budget_ns'. The framebuffer's
+// size and layout go in the dumps, so a replay renders the same.
+bool OpenFlightRecorder(FlightRecorder& recorder, const char* prefix, u64 budget_ns, const FrameBuffer& framebuffer)
+{
+    memset(&recorder, 0, sizeof(recorder));
+    snprintf(recorder.prefix, sizeof(recorder.prefix), "%s", prefix);
+    recorder.budget_ns = budget_ns;
+    recorder.dump_slot = -1;
+    recorder.width     = framebuffer.width;
+    recorder.height    = framebuffer.height;
+    recorder.layout    = framebuffer.layout;
+    ReadPageFaults(recorder.minor_faults, recorder.major_faults);
+
+    pthread_mutex_init(&recorder.lock, 0);
+    pthread_cond_init(&recorder.dump_available, 0);
+    if (pthread_create(&recorder.writer, 0, FlightWriterThread, &recorder) != 0)
+    {
+        REPORT_ERROR("Couldn't start the flight recorder's writer thread.\n");
+        return false;
+    }
+
+    recorder.enabled = true;
+    return true;
+}
+
+// Call right before 'Update', after anything that changes the game's memory or input.
+void FlightBeginFrame(FlightRecorder& recorder, const Memory& memory)
+{
+    if (!recorder.enabled || recorder.frame % FLIGHT_SNAPSHOT_INTERVAL != 0)
+        return;
+
+    FlightSnapshot& snapshot = recorder.snapshots[recorder.next_snapshot];
+    recorder.next_snapshot ^= 1;
+    if (!TakeFlightSnapshot(snapshot, memory, recorder.frame))
+        snapshot.valid = false;
+}
+
+// Freezes the frames since the oldest snapshot that's still covered by the ring, and hands them
+// to the writer. The snapshot goes with them, and the writer's spare takes its place.
+static void DumpFlight(FlightRecorder& recorder, const Memory& memory)
+{
+    u64 spike = recorder.frame;
+    FlightSnapshot* start = 0;
+    for (u32 i = 0; i < 2; ++i)
+    {
+        FlightSnapshot& snapshot = recorder.snapshots[i];
+        if (snapshot.valid && spike - snapshot.frame < FLIGHT_FRAMES && (!start || snapshot.frame < start->frame))
+            start = &snapshot;
+    }
+    if (!start)
+    {
+        ++recorder.stats.skipped;
+        return;
+    }
+
+    FlightHeader& header = recorder.dump_header;
+    memset(&header, 0, sizeof(header));
+    header.magic              = FLIGHT_MAGIC;
+    header.version            = FLIGHT_VERSION;
+    header.frame_count        = cast(spike - start->frame + 1, u32);
+    header.spike              = header.frame_count - 1;
+    header.budget_ns          = recorder.budget_ns;
+    header.first_frame        = start->frame;
+    header.persistent_address = reinterpret_cast<u64>(memory.persistent.data);
+    header.persistent_used    = start->persistent_used;
+    header.temporary_address  = reinterpret_cast<u64>(memory.temporary.data);
+    header.temporary_used     = start->temporary_used;
+    header.width              = recorder.width;
+    header.height             = recorder.height;
+    header.layout             = recorder.layout;
+    header.block_count        = profiler.count < FLIGHT_MAX_BLOCKS ? profiler.count : FLIGHT_MAX_BLOCKS;
+    for (u32 i = 0; i < header.block_count; ++i)
+        snprintf(header.block_names[i], sizeof(header.block_names[i]), "%s", profiler.blocks[i].name);
+
+    for (u32 i = 0; i < header.frame_count; ++i)
+        recorder.dump_frames[i] = recorder.ring[(start->frame + i) % FLIGHT_FRAMES];
+
+    FlightSnapshot spare   = recorder.dump_snapshot;
+    recorder.dump_snapshot = *start;
+    *start                 = spare;
+    start->valid           = false;
+    recorder.dump_slot     = cast(start - recorder.snapshots, s32);
+
+    pthread_mutex_lock(&recorder.lock);
+    __atomic_store_n(&recorder.pending, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&recorder.dump_available);
+    pthread_mutex_unlock(&recorder.lock);
+}
+
+// Once the writer is done with a snapshot, puts it back where it came from if that slot hasn't
+// been used for a newer one. Otherwise the spikes right after a dump would have no snapshot to
+// start from.
+static void ReclaimFlightSnapshot(FlightRecorder& recorder)
+{
+    if (recorder.dump_slot < 0 || __atomic_load_n(&recorder.pending, __ATOMIC_ACQUIRE))
+        return;
+
+    FlightSnapshot& slot = recorder.snapshots[recorder.dump_slot];
+    if (!slot.valid)
+    {
+        FlightSnapshot spare   = slot;
+        slot                   = recorder.dump_snapshot;
+        recorder.dump_snapshot = spare;
+    }
+    recorder.dump_slot = -1;
+}
+
+// Call once the frame is done, after 'ProfilerEndFrame', with the keyboard given to 'Update'.
+void FlightEndFrame(FlightRecorder& recorder, const Memory& memory, const KeyBoard& keyboard, u64 frame_ns)
+{
+    if (!recorder.enabled)
+        return;
+
+    FlightFrame& frame = recorder.ring[recorder.frame % FLIGHT_FRAMES];
+    frame.frame       = recorder.frame;
+    frame.nanoseconds = frame_ns;
+    for (u32 i = 0; i < FLIGHT_MAX_BLOCKS; ++i)
+        frame.block_cycles[i] = i < profiler.count ? profiler.previous[i].cycles : 0;
+
+    frame.persistent_used = memory.persistent.used;
+    frame.temporary_used  = memory.temporary.used;
+    frame.committed       = __atomic_load_n(&virtual_memory.committed, __ATOMIC_RELAXED);
+
+    u64 minor, major;
+    ReadPageFaults(minor, major);
+    frame.minor_faults = cast(minor - recorder.minor_faults, u32);
+    frame.major_faults = cast(major - recorder.major_faults, u32);
+    recorder.minor_faults = minor;
+    recorder.major_faults = major;
+
+    frame.key_count = keyboard.used < FLIGHT_MAX_KEYS ? keyboard.used : FLIGHT_MAX_KEYS;
+    memcpy(frame.keys, keyboard.keys, frame.key_count * sizeof(Key));
+
+    ReclaimFlightSnapshot(recorder);
+    if (frame_ns > recorder.budget_ns)
+    {
+        ++recorder.stats.spikes;
+        bool busy = __atomic_load_n(&recorder.pending, __ATOMIC_ACQUIRE);
+        if (busy || recorder.stats.spikes - recorder.stats.skipped > FLIGHT_MAX_DUMPS)
+            ++recorder.stats.skipped;
+        else
+            DumpFlight(recorder, memory);
+    }
+
+    ++recorder.frame;
+}
+
+FlightStats GetFlightStats(FlightRecorder& recorder)
+{
+    FlightStats stats = recorder.stats;
+    stats.dumps = __atomic_load_n(&recorder.stats.dumps, __ATOMIC_RELAXED);
+    return stats;
+}
+
+// Waits for a dump that's being written.
+void CloseFlightRecorder(FlightRecorder& recorder)
+{
+    if (!recorder.enabled)
+        return;
+
+    pthread_mutex_lock(&recorder.lock);
+    recorder.stop = true;
+    pthread_cond_signal(&recorder.dump_available);
+    pthread_mutex_unlock(&recorder.lock);
+    pthread_join(recorder.writer, 0);
+    recorder.enabled = false;
+}
+
+
+// ---- REPLAY ----
+struct FlightDump
+{
+    FlightHeader header;
+    FlightFrame* frames;
+    u8*          memory;   // Persistent arena, then temporary arena.
+};
+
+// LEAK(ted): The dump lives until exit, it's only loaded to be replayed.
+bool LoadFlightDump(FlightDump& dump, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        REPORT_ERROR("Couldn't open flight recorder dump '%s'.\n", path);
+        return false;
+    }
+
+    FlightHeader& header = dump.header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != FLIGHT_MAGIC || header.version != FLIGHT_VERSION ||
+        header.frame_count == 0 || header.frame_count > FLIGHT_FRAMES || header.block_count > FLIGHT_MAX_BLOCKS)
+    {
+        REPORT_ERROR("'%s' isn't a flight recorder dump of this version.\n", path);
+        fclose(file);
+        return false;
+    }
+
+    u64 memory_size = header.persistent_used + header.temporary_used;
+    dump.frames = cast(malloc(header.frame_count * sizeof(FlightFrame)), FlightFrame*);
+    dump.memory = cast(malloc(memory_size + 1), u8*);
+    bool ok = dump.frames && dump.memory
+           && fread(dump.frames, sizeof(FlightFrame), header.frame_count, file) == header.frame_count
+           && (memory_size == 0 || fread(dump.memory, memory_size, 1, file) == 1);
+    fclose(file);
+    if (!ok)
+    {
+        REPORT_ERROR("Flight recorder dump '%s' is truncated.\n", path);
+        return false;
+    }
+
+    for (u32 i = 0; i < header.frame_count; ++i)
+    {
+        if (dump.frames[i].key_count > FLIGHT_MAX_KEYS)
+            dump.frames[i].key_count = FLIGHT_MAX_KEYS;
+    }
+    return true;
+}
+
+// Puts the game's memory back to the start of the dump. The arenas must be where they were when
+// it was recorded, as the game keeps pointers into them.
+bool RestoreFlightSnapshot(Memory& memory, const FlightDump& dump)
+{
+    const FlightHeader& header = dump.header;
+    if (reinterpret_cast<u64>(memory.persistent.data) != header.persistent_address ||
+        reinterpret_cast<u64>(memory.temporary.data)  != header.temporary_address)
+    {
+        REPORT_ERROR("The arenas aren't where they were when the dump was recorded.\n");
+        return false;
+    }
+    if (!CommitArena(memory.persistent, header.persistent_used) || !CommitArena(memory.temporary, header.temporary_used))
+    {
+        REPORT_ERROR("The dump doesn't fit in the arenas.\n");
+        return false;
+    }
+
+    memcpy(memory.persistent.data, dump.memory, header.persistent_used);
+    memcpy(memory.temporary.data, dump.memory + header.persistent_used, header.temporary_used);
+    memory.persistent.used = header.persistent_used;
+    memory.temporary.used  = header.temporary_used;
+    memory.initialized     = true;
+    return true;
+}
+
+// The keyboard of frame 'index' of the dump.
+void FlightReplayKeyboard(const FlightDump& dump, u32 index, KeyBoard& keyboard)
+{
+    const FlightFrame& frame = dump.frames[index];
+    keyboard.used = cast(frame.key_count, u16);
+    memcpy(keyboard.keys, frame.keys, frame.key_count * sizeof(Key));
+}
@@ -0,0 +1,502 @@
+// Records every presented frame to a compressed, seekable file, without an external screen
+// recorder perturbing the timing.
+//
+// The frame thread only copies the framebuffer into a free slot of a small ring. A background
+// thread XORs each frame with the previous one (unchanged pixels become zeros), compresses the
+// result with 'lz.cpp' and appends it to the file. Every CAPTURE_KEYFRAME_INTERVAL frames, or
+// when the size changes, a frame is stored whole so readers can seek. If the encoder can't keep
+// up the ring fills, and frames are dropped and counted rather than stalling the game (unless
+// 'wait_when_full' is set, for offline rendering where every frame matters more than timing).
+//
+// File layout (all little endian):
+//
+//     CaptureHeader
+//     CaptureFrameHeader, compressed pixels     (repeated)
+//     CaptureIndexEntry                         (one per frame, at 'index_offset')
+//
+// 'index_offset' and 'frame_count' are patched in when the capture is closed. If that never
+// happened, readers rebuild the index by walking the frames.
+//
+// Use 'tools/capture_export.cpp' to turn a capture into Y4M or PNG.
+//
+// Requires 'lz.cpp', 'virtual_memory.cpp' and 'NanoTime'.
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+
+
+#define CAPTURE_MAGIC             0x50414348  // "HCAP"
+#define CAPTURE_VERSION           1
+#define CAPTURE_SLOTS             8
+#define CAPTURE_KEYFRAME_INTERVAL 60
+#define CAPTURE_KEYFRAME          0x1
+
+enum CapturePixelFormat
+{
+    CAPTURE_RGBA,
+    CAPTURE_BGRA,
+};
+
+struct CaptureHeader
+{
+    u32 magic;
+    u32 version;
+    u32 pixel_format;   // CapturePixelFormat, the byte order of the platform's 'Pixel'.
+    u32 frame_count;
+    u64 index_offset;
+};
+
+struct CaptureFrameHeader
+{
+    u32 width;
+    u32 height;
+    u64 timestamp;        // Nanoseconds, from the host's clock.
+    u32 flags;
+    u32 compressed_size;
+};
+
+struct CaptureIndexEntry
+{
+    u64 offset;           // Of the frame's CaptureFrameHeader.
+    u64 timestamp;
+    u32 flags;
+    u32 reserved;
+};
+
+
+struct CaptureSlot
+{
+    Pixel* pixels;
+    u32    width;
+    u32    height;
+    u64    timestamp;
+};
+
+struct CaptureStats
+{
+    u64 frames_captured;   // Handed to the encoder.
+    u64 frames_dropped;    // The ring was full.
+    u64 frames_skipped;    // Larger than the slots.
+    u64 frames_encoded;
+    u64 bytes_raw;
+    u64 bytes_written;
+    u64 encode_ns;         // Total time spent encoding.
+};
+
+struct FrameCapture
+{
+    FILE*  file;
+    Buffer arena;
+    u64    slot_capacity;  // In pixels.
+
+    // Single producer (the frame thread), single consumer (the encoder). Both counters only
+    // grow, and are accessed with __atomic_*. A slot is free when 'written - read' < SLOTS.
+    CaptureSlot slots[CAPTURE_SLOTS];
+    u64 written;
+    u64 read;
+    bool stop;
+    bool wait_when_full;
+
+    pthread_t       encoder;
+    pthread_mutex_t lock;
+    pthread_cond_t  frame_available;
+
+    // Owned by the encoder.
+    Pixel* previous;
+    u32    previous_width;
+    u32    previous_height;
+    u8*    delta;
+    u8*    compressed;
+    u32*   hash_table;
+    CaptureIndexEntry* index;
+    u32    index_capacity;
+    u32    frame_count;
+    u64    file_offset;
+
+    CaptureStats stats;    // Counters are written with __atomic_*, read them with 'GetCaptureStats'.
+};
+
+
+static CapturePixelFormat NativePixelFormat()
+{
+    return offsetof(Pixel, r) == 0 ? CAPTURE_RGBA : CAPTURE_BGRA;
+}
+
+static void EncodeFrame(FrameCapture& capture, CaptureSlot& slot)
+{
+    u64 start = NanoTime();
+
+    u64  size      = cast(slot.width, u64) * slot.height * sizeof(Pixel);
+    bool same_size = slot.width == capture.previous_width && slot.height == capture.previous_height;
+    bool keyframe  = !same_size || capture.frame_count % CAPTURE_KEYFRAME_INTERVAL == 0;
+
+    // Unchanged pixels become zeros, which compress to almost nothing.
+    const u8* source = reinterpret_cast<const u8*>(slot.pixels);
+    if (!keyframe)
+    {
+        const u64* current  = reinterpret_cast<const u64*>(slot.pixels);
+        const u64* previous = reinterpret_cast<const u64*>(capture.previous);
+        u64*       delta    = reinterpret_cast<u64*>(capture.delta);
+        u64 words = size / sizeof(u64);
+        for (u64 i = 0; i < words; ++i)
+            delta[i] = current[i] ^ previous[i];
+        for (u64 i = words * sizeof(u64); i < size; ++i)
+            capture.delta[i] = source[i] ^ reinterpret_cast<const u8*>(capture.previous)[i];
+        source = capture.delta;
+    }
+
+    CaptureFrameHeader header;
+    header.width           = slot.width;
+    header.height          = slot.height;
+    header.timestamp       = slot.timestamp;
+    header.flags           = keyframe ? CAPTURE_KEYFRAME : 0;
+    header.compressed_size = cast(LZCompress(source, size, capture.compressed, capture.hash_table), u32);
+
+    if (capture.frame_count == capture.index_capacity)
+    {
+        capture.index_capacity = capture.index_capacity ? capture.index_capacity * 2 : 1024;
+        capture.index = cast(realloc(capture.index, capture.index_capacity * sizeof(CaptureIndexEntry)), CaptureIndexEntry*);
+    }
+    CaptureIndexEntry& entry = capture.index[capture.frame_count++];
+    entry.offset    = capture.file_offset;
+    entry.timestamp = slot.timestamp;
+    entry.flags     = header.flags;
+    entry.reserved  = 0;
+
+    fwrite(&header, sizeof(header), 1, capture.file);
+    fwrite(capture.compressed, header.compressed_size, 1, capture.file);
+    capture.file_offset += sizeof(header) + header.compressed_size;
+
+    memcpy(capture.previous, slot.pixels, size);
+    capture.previous_width  = slot.width;
+    capture.previous_height = slot.height;
+
+    __atomic_add_fetch(&capture.stats.frames_encoded, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&capture.stats.bytes_raw, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&capture.stats.bytes_written, sizeof(header) + header.compressed_size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&capture.stats.encode_ns, NanoTime() - start, __ATOMIC_RELAXED);
+}
+
+static void* CaptureEncoderThread(void* user_data)
+{
+    FrameCapture& capture = *cast(user_data, FrameCapture*);
+
+    while (true)
+    {
+        pthread_mutex_lock(&capture.lock);
+        while (__atomic_load_n(&capture.written, __ATOMIC_ACQUIRE) == capture.read && !capture.stop)
+            pthread_cond_wait(&capture.frame_available, &capture.lock);
+        bool stop = capture.stop;
+        pthread_mutex_unlock(&capture.lock);
+
+        // Drain everything before stopping, so closing doesn't lose the last frames.
+        u64 written = __atomic_load_n(&capture.written, __ATOMIC_ACQUIRE);
+        if (written == capture.read && stop)
+            break;
+
+        for (u64 i = capture.read; i < written; ++i)
+        {
+            EncodeFrame(capture, capture.slots[i % CAPTURE_SLOTS]);
+            __atomic_store_n(&capture.read, i + 1, __ATOMIC_RELEASE);  // Hands the slot back.
+        }
+    }
+
+    return 0;
+}
+
+
+// Frames up to 'max_width' x 'max_height' can be captured. Larger ones are skipped.
+bool OpenFrameCapture(FrameCapture& capture, const char* path, u32 max_width, u32 max_height)
+{
+    memset(&capture, 0, sizeof(capture));
+
+    capture.slot_capacity = (cast(max_width, u64) * max_height + 1) & ~1ULL;  // Even, so the slots stay 8 byte aligned.
+    u64 frame_size = capture.slot_capacity * sizeof(Pixel);
+
+    // Slots, previous frame, delta, compressed output and the hash table.
+    u64 arena_size = (CAPTURE_SLOTS + 2) * frame_size + LZBound(frame_size) + LZ_HASH_SIZE * sizeof(u32) + MEGABYTES(1);
+    if (!AllocateArena(capture.arena, arena_size))
+        return false;
+
+    for (u32 i = 0; i < CAPTURE_SLOTS; ++i)
+        capture.slots[i].pixels = PushArray(capture.arena, capture.slot_capacity, Pixel);
+    capture.previous   = PushArray(capture.arena, capture.slot_capacity, Pixel);
+    capture.delta      = PushArray(capture.arena, frame_size, u8);
+    capture.compressed = PushArray(capture.arena, LZBound(frame_size), u8);
+    capture.hash_table = PushArray(capture.arena, LZ_HASH_SIZE, u32);
+    if (!capture.hash_table)
+    {
+        REPORT_ERROR("Not enough memory for frame capture.\n");
+        return false;
+    }
+
+    capture.file = fopen(path, "wb");
+    if (!capture.file)
+    {
+        REPORT_ERROR("Couldn't create capture file '%s'.\n", path);
+        return false;
+    }
+
+    CaptureHeader header = {0};
+    header.magic        = CAPTURE_MAGIC;
+    header.version      = CAPTURE_VERSION;
+    header.pixel_format = NativePixelFormat();
+    fwrite(&header, sizeof(header), 1, capture.file);
+    capture.file_offset = sizeof(header);
+
+    pthread_mutex_init(&capture.lock, 0);
+    pthread_cond_init(&capture.frame_available, 0);
+    if (pthread_create(&capture.encoder, 0, CaptureEncoderThread, &capture) != 0)
+    {
+        REPORT_ERROR("Couldn't start the capture encoder thread.\n");
+        fclose(capture.file);
+        capture.file = 0;
+        return false;
+    }
+
+    return true;
+}
+
+// Call with every finished frame. Only copies the pixels, and never blocks unless 'wait_when_full' is set.
+void CaptureFrame(FrameCapture& capture, FrameBuffer& framebuffer, u64 timestamp)
+{
+    if (!capture.file)
+        return;
+
+    u64 pixel_count = cast(framebuffer.width, u64) * framebuffer.height;
+    if (pixel_count > capture.slot_capacity || pixel_count == 0)
+    {
+        ++capture.stats.frames_skipped;
+        return;
+    }
+
+    u64 written = capture.written;
+    while (written - __atomic_load_n(&capture.read, __ATOMIC_ACQUIRE) == CAPTURE_SLOTS)
+    {
+        if (!capture.wait_when_full)
+        {
+            __atomic_add_fetch(&capture.stats.frames_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        timespec pause = { 0, 200000 };
+        nanosleep(&pause, 0);
+    }
+
+    CaptureSlot& slot = capture.slots[written % CAPTURE_SLOTS];
+    memcpy(slot.pixels, framebuffer.pixels, pixel_count * sizeof(Pixel));
+    slot.width     = framebuffer.width;
+    slot.height    = framebuffer.height;
+    slot.timestamp = timestamp;
+
+    __atomic_store_n(&capture.written, written + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&capture.stats.frames_captured, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&capture.lock);
+    pthread_cond_signal(&capture.frame_available);
+    pthread_mutex_unlock(&capture.lock);
+}
+
+CaptureStats GetCaptureStats(FrameCapture& capture)
+{
+    CaptureStats stats;
+    stats.frames_captured = __atomic_load_n(&capture.stats.frames_captured, __ATOMIC_RELAXED);
+    stats.frames_dropped  = __atomic_load_n(&capture.stats.frames_dropped,  __ATOMIC_RELAXED);
+    stats.frames_skipped  = capture.stats.frames_skipped;
+    stats.frames_encoded  = __atomic_load_n(&capture.stats.frames_encoded,  __ATOMIC_RELAXED);
+    stats.bytes_raw       = __atomic_load_n(&capture.stats.bytes_raw,       __ATOMIC_RELAXED);
+    stats.bytes_written   = __atomic_load_n(&capture.stats.bytes_written,   __ATOMIC_RELAXED);
+    stats.encode_ns       = __atomic_load_n(&capture.stats.encode_ns,       __ATOMIC_RELAXED);
+    return stats;
+}
+
+// Waits for the encoder to finish the queued frames, then writes the index.
+void CloseFrameCapture(FrameCapture& capture)
+{
+    if (!capture.file)
+        return;
+
+    pthread_mutex_lock(&capture.lock);
+    capture.stop = true;
+    pthread_cond_signal(&capture.frame_available);
+    pthread_mutex_unlock(&capture.lock);
+    pthread_join(capture.encoder, 0);
+
+    fwrite(capture.index, sizeof(CaptureIndexEntry), capture.frame_count, capture.file);
+
+    CaptureHeader header = {0};
+    header.magic        = CAPTURE_MAGIC;
+    header.version      = CAPTURE_VERSION;
+    header.pixel_format = NativePixelFormat();
+    header.frame_count  = capture.frame_count;
+    header.index_offset = capture.file_offset;
+    fseek(capture.file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, capture.file);
+    fclose(capture.file);
+
+    pthread_mutex_destroy(&capture.lock);
+    pthread_cond_destroy(&capture.frame_available);
+    free(capture.index);
+
+    capture.file  = 0;
+    capture.index = 0;
+    // LEAK(ted): The arena's address space stays reserved. Captures are opened once per run.
+}
+
+
+// ---- READING ----
+
+struct CaptureReader
+{
+    FILE* file;
+    CaptureHeader      header;
+    CaptureIndexEntry* index;
+    u32    frame_count;
+
+    Pixel* pixels;         // The decoded frame.
+    u32    width;
+    u32    height;
+    s64    current;        // Frame in 'pixels', -1 for none.
+
+    u8*    compressed;
+    u8*    delta;
+    u64    capacity;       // Of 'pixels' and 'delta', in bytes.
+};
+
+bool OpenCaptureReader(CaptureReader& reader, const char* path)
+{
+    memset(&reader, 0, sizeof(reader));
+    reader.current = -1;
+
+    reader.file = fopen(path, "rb");
+    if (!reader.file)
+    {
+        REPORT_ERROR("Couldn't open capture file '%s'.\n", path);
+        return false;
+    }
+    if (fread(&reader.header, sizeof(reader.header), 1, reader.file) != 1 || reader.header.magic != CAPTURE_MAGIC || reader.header.version != CAPTURE_VERSION)
+    {
+        REPORT_ERROR("'%s' isn't a capture file.\n", path);
+        fclose(reader.file);
+        return false;
+    }
+
+    if (reader.header.index_offset != 0)
+    {
+        reader.frame_count = reader.header.frame_count;
+        reader.index = cast(malloc(reader.frame_count * sizeof(CaptureIndexEntry) + 1), CaptureIndexEntry*);
+        fseek(reader.file, reader.header.index_offset, SEEK_SET);
+        if (fread(reader.index, sizeof(CaptureIndexEntry), reader.frame_count, reader.file) != reader.frame_count)
+        {
+            REPORT_ERROR("Capture index is truncated.\n");
+            reader.frame_count = 0;
+        }
+    }
+    else
+    {
+        // Never closed (the game crashed or was killed). Walk the frames to rebuild the index,
+        // up to the first one that isn't all there. Seeking past the end succeeds, so check
+        // against the file's size, which also catches a torn header's garbage size.
+        fseek(reader.file, 0, SEEK_END);
+        u64 file_size = cast(ftell(reader.file), u64);
+
+        u32 capacity = 0;
+        u64 offset   = sizeof(CaptureHeader);
+        CaptureFrameHeader frame;
+        fseek(reader.file, offset, SEEK_SET);
+        while (fread(&frame, sizeof(frame), 1, reader.file) == 1)
+        {
+            if (offset + sizeof(frame) + frame.compressed_size > file_size)
+                break;
+            if (fseek(reader.file, frame.compressed_size, SEEK_CUR) != 0)
+                break;
+            if (reader.frame_count == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 1024;
+                reader.index = cast(realloc(reader.index, capacity * sizeof(CaptureIndexEntry)), CaptureIndexEntry*);
+            }
+            CaptureIndexEntry& entry = reader.index[reader.frame_count++];
+            entry.offset    = offset;
+            entry.timestamp = frame.timestamp;
+            entry.flags     = frame.flags;
+            entry.reserved  = 0;
+            offset += sizeof(frame) + frame.compressed_size;
+        }
+        fprintf(stderr, "[Warning]: Capture wasn't closed properly. Recovered %u frames.\n", reader.frame_count);
+    }
+
+    return true;
+}
+
+// Decodes 'frame' into 'reader.pixels'. Sequential reads decode one frame, seeking decodes
+// from the closest keyframe before it.
+bool ReadCaptureFrame(CaptureReader& reader, u32 frame)
+{
+    if (frame >= reader.frame_count)
+        return false;
+
+    u32 first = frame;
+    if (reader.current < 0 || frame != reader.current + 1)
+    {
+        while (first > 0 && !(reader.index[first].flags & CAPTURE_KEYFRAME))
+            --first;
+    }
+
+    for (u32 i = first; i <= frame; ++i)
+    {
+        CaptureFrameHeader header;
+        fseek(reader.file, reader.index[i].offset, SEEK_SET);
+        if (fread(&header, sizeof(header), 1, reader.file) != 1)
+            return false;
+
+        u64 size = cast(header.width, u64) * header.height * sizeof(Pixel);
+        if (size > reader.capacity)
+        {
+            reader.capacity = size;
+            reader.pixels = cast(realloc(reader.pixels, size), Pixel*);
+            reader.delta  = cast(realloc(reader.delta,  size), u8*);
+        }
+        reader.compressed = cast(realloc(reader.compressed, header.compressed_size + 1), u8*);
+        if (fread(reader.compressed, 1, header.compressed_size, reader.file) != header.compressed_size)
+            return false;
+
+        bool keyframe = (header.flags & CAPTURE_KEYFRAME) != 0;
+        if (!keyframe && (reader.current != cast(i, s64) - 1 || header.width != reader.width || header.height != reader.height))
+        {
+            REPORT_ERROR("Capture frame %u is a delta without a frame to apply it to.\n", i);
+            return false;
+        }
+
+        u8* target = keyframe ? reinterpret_cast<u8*>(reader.pixels) : reader.delta;
+        if (LZDecompress(reader.compressed, header.compressed_size, target, size) != size)
+        {
+            REPORT_ERROR("Capture frame %u is corrupt.\n", i);
+            reader.current = -1;
+            return false;
+        }
+        if (!keyframe)
+        {
+            u8* pixels = reinterpret_cast<u8*>(reader.pixels);
+            for (u64 j = 0; j < size; ++j)
+                pixels[j] ^= reader.delta[j];
+        }
+
+        reader.width   = header.width;
+        reader.height  = header.height;
+        reader.current = i;
+    }
+
+    return true;
+}
+
+void CloseCaptureReader(CaptureReader& reader)
+{
+    if (reader.file)
+        fclose(reader.file);
+    free(reader.index);
+    free(reader.pixels);
+    free(reader.delta);
+    free(reader.compressed);
+    memset(&reader, 0, sizeof(reader));
+}
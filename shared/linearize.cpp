@@ -0,0 +1,116 @@
+// Turns a tiled framebuffer (see framebuffer.h) into rows, for hosts that let the game render
+// tiled but present, capture and draw the overlay in rows. One pass over the frame, done right
+// before presenting.
+//
+//     Tiled:  every row of a tile is SIZE contiguous pixels, so it's a copy of 32 or 128 bytes.
+//     Morton: two 2x2 blocks next to each other are 8 contiguous pixels covering 4x2 pixels, so
+//             two 16 byte loads and two unpacks give 4 pixels of two rows.
+//
+// Tiles on the right and bottom edges that stick out of the framebuffer go pixel by pixel.
+
+#include <string.h>
+
+#include "simd.h"
+#include "framebuffer.h"
+
+
+// Pixel by pixel, for the partial tiles on the edges.
+template <typename Layout>
+static void LinearizeRectangle(const FrameBuffer& source, FrameBuffer& destination, s32 left, s32 top, s32 right, s32 bottom)
+{
+    for (s32 y = top; y < bottom; ++y)
+    {
+        const Pixel* row = source.pixels + Layout::RowOffset(source, y);
+        Pixel* output    = destination.pixels + cast(y, u64) * destination.width;
+        for (s32 x = left; x < right; ++x)
+            output[x] = row[Layout::ColumnOffset(x)];
+    }
+}
+
+template <u32 LOG2_SIZE>
+static void LinearizeTiled(const FrameBuffer& source, FrameBuffer& destination)
+{
+    typedef TiledLayout<LOG2_SIZE> Layout;
+    const s32 size = Layout::SIZE;
+    s32 full_width  = source.width  / size * size;
+    s32 full_height = source.height / size * size;
+
+    // Tile by tile, so the source is read front to back.
+    for (s32 tile_y = 0; tile_y < full_height; tile_y += size)
+    {
+        const Pixel* tile = source.pixels + Layout::RowOffset(source, tile_y);
+        for (s32 tile_x = 0; tile_x < full_width; tile_x += size, tile += size * size)
+        {
+            Pixel* output = destination.pixels + cast(tile_y, u64) * destination.width + tile_x;
+            for (s32 y = 0; y < size; ++y)
+                memcpy(output + y * cast(destination.width, u64), tile + y * size, size * sizeof(Pixel));
+        }
+    }
+
+    LinearizeRectangle<Layout>(source, destination, full_width, 0, source.width, source.height);
+    LinearizeRectangle<Layout>(source, destination, 0, full_height, full_width, source.height);
+}
+
+static void LinearizeMorton(const FrameBuffer& source, FrameBuffer& destination)
+{
+    const s32 size = MortonLayout::SIZE;
+    s32 full_width  = source.width  / size * size;
+    s32 full_height = source.height / size * size;
+    u64 pitch = destination.width;
+
+    for (s32 tile_y = 0; tile_y < full_height; tile_y += size)
+    {
+        for (s32 tile_x = 0; tile_x < full_width; tile_x += size)
+        {
+            const Pixel* tile = source.pixels + MortonLayout::RowOffset(source, tile_y) + MortonLayout::ColumnOffset(tile_x);
+            Pixel* output     = destination.pixels + cast(tile_y, u64) * pitch + tile_x;
+
+            for (s32 y = 0; y < size; y += 2)
+            {
+                u32 row_bits = SpreadBits5(y) << 1;
+                for (s32 x = 0; x < size; x += 4)
+                {
+                    // Pixels (x, y) (x+1, y) (x, y+1) (x+1, y+1), then the same for x+2.
+                    const Pixel* block = tile + (row_bits | SpreadBits5(x));
+                    Pixel* top    = output + y * pitch + x;
+                    Pixel* bottom = top + pitch;
+#if defined(SIMD_SSE2)
+                    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+                    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 4));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(top),    _mm_unpacklo_epi64(a, b));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(bottom), _mm_unpackhi_epi64(a, b));
+#elif defined(SIMD_NEON)
+                    uint64x2_t a = vld1q_u64(reinterpret_cast<const u64*>(block));
+                    uint64x2_t b = vld1q_u64(reinterpret_cast<const u64*>(block + 4));
+                    vst1q_u64(reinterpret_cast<u64*>(top),    vzip1q_u64(a, b));
+                    vst1q_u64(reinterpret_cast<u64*>(bottom), vzip2q_u64(a, b));
+#else
+                    top[0] = block[0]; top[1] = block[1]; bottom[0] = block[2]; bottom[1] = block[3];
+                    top[2] = block[4]; top[3] = block[5]; bottom[2] = block[6]; bottom[3] = block[7];
+#endif
+                }
+            }
+        }
+    }
+
+    LinearizeRectangle<MortonLayout>(source, destination, full_width, 0, source.width, source.height);
+    LinearizeRectangle<MortonLayout>(source, destination, 0, full_height, full_width, source.height);
+}
+
+
+// Copies 'source', in any layout, into 'destination', which must be linear and the same size.
+void LinearizeFrameBuffer(const FrameBuffer& source, FrameBuffer& destination)
+{
+    ASSERT(destination.layout == FRAMEBUFFER_LINEAR && destination.width == source.width && destination.height == source.height,
+           "Can only linearize into a linear framebuffer of the same size.\n");
+
+    switch (source.layout)
+    {
+        case FRAMEBUFFER_LINEAR:
+            memcpy(destination.pixels, source.pixels, cast(source.width, u64) * source.height * sizeof(Pixel));
+            break;
+        case FRAMEBUFFER_TILED_8:   LinearizeTiled<3>(source, destination); break;
+        case FRAMEBUFFER_TILED_32:  LinearizeTiled<5>(source, destination); break;
+        case FRAMEBUFFER_MORTON_32: LinearizeMorton(source, destination);   break;
+    }
+}
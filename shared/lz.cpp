@@ -0,0 +1,202 @@
+// Small LZ77 block compressor in the spirit of LZ4. Greedy matching through a hash table of
+// 4 byte sequences, so it runs at several hundred MB/s, and decompression is mostly copies.
+//
+// A block is a list of sequences:
+//
+//     [token][literal length...][literals][offset u16][match length...]
+//
+// The high nibble of the token is the literal count, the low nibble the match length - 4. A
+// nibble of 15 means more length follows as bytes, each adding up to 255 (a byte below 255 ends
+// it). The last sequence only has literals, the block ends right after them.
+
+#include <string.h>
+
+
+#define LZ_MIN_MATCH   4
+#define LZ_MAX_OFFSET  65535
+#define LZ_HASH_BITS   14
+#define LZ_HASH_SIZE   (1 << LZ_HASH_BITS)
+
+
+// Worst case size of compressing 'size' bytes (everything ends up as literals).
+u64 LZBound(u64 size)
+{
+    return size + size / 255 + 16;
+}
+
+static u32 LZHash(u32 sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static u32 LZRead32(const u8* p)
+{
+    u32 result;
+    memcpy(&result, p, sizeof(result));
+    return result;
+}
+
+static u8* LZWriteLength(u8* output, u64 length)
+{
+    while (length >= 255)
+    {
+        *output++ = 255;
+        length -= 255;
+    }
+    *output++ = cast(length, u8);
+    return output;
+}
+
+// Compresses 'input' into 'output', which must hold at least 'LZBound(size)' bytes. 'table' is
+// scratch space of LZ_HASH_SIZE entries, so the caller decides where it lives. Returns the
+// compressed size.
+u64 LZCompress(const u8* input, u64 size, u8* output, u32* table)
+{
+    memset(table, 0, LZ_HASH_SIZE * sizeof(u32));
+
+    const u8* literals = input;
+    const u8* current  = input + 1;  // Position 0 is what empty table entries point to.
+    const u8* end      = input + size;
+    const u8* limit    = size > LZ_MIN_MATCH + 8 ? end - (LZ_MIN_MATCH + 8) : input;  // Leaves room to read 4 bytes.
+    u8*       out      = output;
+
+    u32 misses = 0;
+    while (current < limit)
+    {
+        u32 sequence  = LZRead32(current);
+        u32 hash      = LZHash(sequence);
+        const u8* candidate = input + table[hash];
+        table[hash] = cast(current - input, u32);
+
+        if (current - candidate > LZ_MAX_OFFSET || LZRead32(candidate) != sequence)
+        {
+            // Incompressible data is skipped faster and faster.
+            current += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+
+        // Extend the match backwards over pending literals, and forwards as far as it goes.
+        while (current > literals && candidate > input && current[-1] == candidate[-1])
+        {
+            --current;
+            --candidate;
+        }
+        const u8* match_end = current + LZ_MIN_MATCH;
+        const u8* source    = candidate + LZ_MIN_MATCH;
+        while (match_end < end && *match_end == *source)
+        {
+            ++match_end;
+            ++source;
+        }
+
+        u64 literal_count = current - literals;
+        u64 match_length  = (match_end - current) - LZ_MIN_MATCH;
+        u16 offset        = cast(current - candidate, u16);
+
+        u8* token = out++;
+        *token = cast(((literal_count < 15 ? literal_count : 15) << 4) | (match_length < 15 ? match_length : 15), u8);
+        if (literal_count >= 15)
+            out = LZWriteLength(out, literal_count - 15);
+        memcpy(out, literals, literal_count);
+        out += literal_count;
+        memcpy(out, &offset, sizeof(offset));
+        out += sizeof(offset);
+        if (match_length >= 15)
+            out = LZWriteLength(out, match_length - 15);
+
+        current  = match_end;
+        literals = match_end;
+
+        // Seed the table with the end of the match, which helps runs of repeated data.
+        if (current < limit)
+            table[LZHash(LZRead32(current - 2))] = cast(current - 2 - input, u32);
+    }
+
+    // Whatever's left goes out as literals.
+    u64 literal_count = end - literals;
+    u8* token = out++;
+    *token = cast((literal_count < 15 ? literal_count : 15) << 4, u8);
+    if (literal_count >= 15)
+        out = LZWriteLength(out, literal_count - 15);
+    memcpy(out, literals, literal_count);
+    out += literal_count;
+
+    return out - output;
+}
+
+// Returns the decompressed size, or ~0 if the block is corrupt or doesn't fit in 'capacity'.
+u64 LZDecompress(const u8* input, u64 size, u8* output, u64 capacity)
+{
+    const u8* in      = input;
+    const u8* in_end  = input + size;
+    u8*       out     = output;
+    u8*       out_end = output + capacity;
+
+    while (in < in_end)
+    {
+        u8  token = *in++;
+        u64 literal_count = token >> 4;
+        if (literal_count == 15)
+        {
+            u8 byte;
+            do
+            {
+                if (in >= in_end) return ~0ULL;
+                byte = *in++;
+                literal_count += byte;
+            } while (byte == 255);
+        }
+
+        if (literal_count > cast(in_end - in, u64) || literal_count > cast(out_end - out, u64))
+            return ~0ULL;
+        memcpy(out, in, literal_count);
+        in  += literal_count;
+        out += literal_count;
+
+        if (in == in_end)
+            break;  // The last sequence has no match.
+
+        if (in_end - in < 2)
+            return ~0ULL;
+        u16 offset;
+        memcpy(&offset, in, sizeof(offset));
+        in += sizeof(offset);
+
+        u64 match_length = token & 15;
+        if (match_length == 15)
+        {
+            u8 byte;
+            do
+            {
+                if (in >= in_end) return ~0ULL;
+                byte = *in++;
+                match_length += byte;
+            } while (byte == 255);
+        }
+        match_length += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > out - output || match_length > cast(out_end - out, u64))
+            return ~0ULL;
+
+        // Matches may overlap what they produce (offset < length), which is how runs are encoded.
+        const u8* source = out - offset;
+        if (offset >= match_length)
+        {
+            memcpy(out, source, match_length);
+            out += match_length;
+        }
+        else if (offset == 1)
+        {
+            memset(out, *source, match_length);  // Runs of a single byte, like unchanged pixels in a delta.
+            out += match_length;
+        }
+        else
+        {
+            for (u64 i = 0; i < match_length; ++i)
+                *out++ = source[i];
+        }
+    }
+
+    return out - output;
+}
@@ -0,0 +1,56 @@
+// Read-only file mappings offered to the game through 'Platform' (see main.h).
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+MappedFile MapFile(const char* path)
+{
+    MappedFile result = {0};
+
+    int file = open(path, O_RDONLY);
+    if (file == -1)
+    {
+        REPORT_ERROR("Couldn't open '%s' for mapping.\n", path);
+        return result;
+    }
+
+    struct stat info;
+    if (fstat(file, &info) == -1 || info.st_size == 0)
+    {
+        REPORT_ERROR("Couldn't get the size of '%s'.\n", path);
+        close(file);
+        return result;
+    }
+
+    void* data = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);  // The mapping keeps its own reference.
+    if (data == MAP_FAILED)
+    {
+        REPORT_ERROR("Couldn't map '%s'. Error code: %d.\n", path, errno);
+        return result;
+    }
+
+    // Files are mostly read front to back (e.g. audio tracks), so ask for aggressive read-ahead.
+    // Keeps page faults out of the audio callback.
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+    result.data = data;
+    result.size = info.st_size;
+    return result;
+}
+
+void UnmapFile(MappedFile file)
+{
+    if (file.data)
+        munmap(file.data, file.size);
+}
+
+
+void InitializeMappedFiles(Platform& platform)
+{
+    platform.map_file   = MapFile;
+    platform.unmap_file = UnmapFile;
+}
@@ -0,0 +1,436 @@
+// Runtime metrics: frame times, block costs, audio fill, I/O latency... kept as histograms, so
+// percentiles can be asked for at any time and over any stretch of time without keeping the
+// samples, sorting them, or doing anything but a few adds per sample.
+//
+// The histograms are log-linear (like HdrHistogram): every power of two is split into
+// HISTOGRAM_SUB_COUNT equal buckets, so any value is known to within 1/HISTOGRAM_SUB_COUNT of
+// itself (about 3%), from 0 to 2^64, in HISTOGRAM_BUCKETS counters. Recording is finding the
+// bucket (a count of leading zeroes and a shift) and incrementing it. Histograms of the same
+// kind of value merge by adding the buckets, e.g. ones recorded on different threads.
+//
+// A metric is a named histogram that's recorded into for the whole run, from any thread. It's
+// never reset. Instead, whoever reads it keeps a 'MetricWindow', which holds the metric as it
+// was at the previous read, and the difference is what was recorded in between. So the per
+// second status, the periodic export and the end of run report can each read at their own pace.
+//
+// 'StartMetricsExport' writes every metric's window as CSV to a file or a Unix socket every
+// period, from a thread of its own:
+//
+//     time,metric,unit,count,min,mean,p50,p90,p99,p999,max
+//
+// 'time' is nanoseconds on the host's clock, the rest are over the period. Periods in which a
+// metric wasn't recorded are left out. A socket is reconnected every period until someone listens,
+// and nothing's lost meanwhile: the first period after covers everything since the last export.
+//
+// NOTE(ted): Register metrics from the main thread, before recording from other threads.
+//
+// Requires 'NanoTime' from the platform's clock.cpp.
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+#define HISTOGRAM_SUB_BITS  5
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS   ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)
+
+#define METRICS_RESERVED    16                        // For the hosts' and platform services' own.
+#define METRICS_MAX         (64 + METRICS_RESERVED)   // And one per profile block (PROFILER_MAX_BLOCKS).
+#define METRICS_PATH_SIZE   512
+
+
+// ---- HISTOGRAM ----
+struct Histogram
+{
+    u64 count;
+    u64 sum;
+    u64 min;
+    u64 max;
+    u32 buckets[HISTOGRAM_BUCKETS];
+};
+
+// Values below HISTOGRAM_SUB_COUNT get a bucket each. Above, the bucket is the position of the
+// highest set bit and the HISTOGRAM_SUB_BITS bits below it.
+static inline u32 HistogramBucket(u64 value)
+{
+    if (value < HISTOGRAM_SUB_COUNT)
+        return cast(value, u32);
+
+    u32 shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+    return (shift + 1) * HISTOGRAM_SUB_COUNT + cast(value >> shift, u32) - HISTOGRAM_SUB_COUNT;
+}
+
+static inline u32 HistogramBucketShift(u32 bucket)
+{
+    return bucket < HISTOGRAM_SUB_COUNT ? 0 : bucket / HISTOGRAM_SUB_COUNT - 1;
+}
+
+// The smallest value that lands in 'bucket'.
+static inline u64 HistogramBucketLow(u32 bucket)
+{
+    if (bucket < HISTOGRAM_SUB_COUNT)
+        return bucket;
+    return cast(bucket % HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_COUNT, u64) << HistogramBucketShift(bucket);
+}
+
+// The largest value that lands in 'bucket'.
+static inline u64 HistogramBucketHigh(u32 bucket)
+{
+    return HistogramBucketLow(bucket) + (1ULL << HistogramBucketShift(bucket)) - 1;
+}
+
+void ResetHistogram(Histogram& histogram)
+{
+    memset(&histogram, 0, sizeof(histogram));
+    histogram.min = ~0ULL;
+}
+
+// For histograms only one thread records into.
+inline void HistogramRecord(Histogram& histogram, u64 value)
+{
+    histogram.buckets[HistogramBucket(value)] += 1;
+    histogram.count += 1;
+    histogram.sum   += value;
+    if (value < histogram.min) histogram.min = value;
+    if (value > histogram.max) histogram.max = value;
+}
+
+// For histograms any number of threads record into.
+inline void HistogramRecordAtomic(Histogram& histogram, u64 value)
+{
+    __atomic_add_fetch(&histogram.buckets[HistogramBucket(value)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram.count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram.sum, value, __ATOMIC_RELAXED);
+
+    u64 min = __atomic_load_n(&histogram.min, __ATOMIC_RELAXED);
+    while (value < min && !__atomic_compare_exchange_n(&histogram.min, &min, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    u64 max = __atomic_load_n(&histogram.max, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&histogram.max, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void MergeHistogram(Histogram& into, const Histogram& from)
+{
+    for (u32 i = 0; i < HISTOGRAM_BUCKETS; ++i)
+        into.buckets[i] += from.buckets[i];
+    into.count += from.count;
+    into.sum   += from.sum;
+    if (from.min < into.min) into.min = from.min;
+    if (from.max > into.max) into.max = from.max;
+}
+
+// The value that 'percentile' percent of the values are at or below (to within a bucket), 0
+// if it's empty.
+u64 HistogramPercentile(const Histogram& histogram, f64 percentile)
+{
+    if (histogram.count == 0)
+        return 0;
+
+    u64 rank = cast(percentile / 100.0 * histogram.count + 0.5, u64);
+    if (rank < 1)               rank = 1;
+    if (rank > histogram.count) rank = histogram.count;
+
+    u64 seen = 0;
+    for (u32 i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += histogram.buckets[i];
+        if (seen >= rank)
+        {
+            u64 value = HistogramBucketHigh(i);
+            if (value > histogram.max) value = histogram.max;
+            if (value < histogram.min) value = histogram.min;
+            return value;
+        }
+    }
+    return histogram.max;
+}
+
+inline f64 HistogramMean(const Histogram& histogram)
+{
+    return histogram.count ? cast(histogram.sum, f64) / histogram.count : 0.0;
+}
+
+
+// ---- METRICS ----
+struct Metric
+{
+    const char* name;
+    const char* unit;
+    Histogram   histogram;  // Everything since the start. Recorded with __atomic_*.
+};
+
+// What was recorded into a metric between two reads.
+struct MetricWindow
+{
+    Histogram previous;     // The metric at the previous read.
+    Histogram interval;     // Recorded between the previous read and the last one.
+};
+
+struct Metrics
+{
+    Metric metrics[METRICS_MAX];
+    u32    count;           // Use __atomic_* to read from other threads.
+
+    // Export.
+    pthread_t       exporter;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    bool            exporting;
+    bool            stop;
+    u64             period;
+    char            destination[METRICS_PATH_SIZE];
+    FILE*           file;    // Either a file,
+    int             socket;  // or a Unix socket, -1 while not connected.
+    MetricWindow*   windows; // One per metric.
+};
+static Metrics metrics;
+
+
+// Returns the index of the metric with that name, adding it if needed.
+u32 RegisterMetric(const char* name, const char* unit)
+{
+    for (u32 i = 0; i < metrics.count; ++i)
+    {
+        if (strcmp(metrics.metrics[i].name, name) == 0)
+            return i;
+    }
+
+    ASSERT(metrics.count < METRICS_MAX, "Too many metrics (max %i).\n", METRICS_MAX);
+    Metric& metric = metrics.metrics[metrics.count];
+    metric.name = name;
+    metric.unit = unit;
+    ResetHistogram(metric.histogram);
+    return __atomic_fetch_add(&metrics.count, 1, __ATOMIC_RELEASE);
+}
+
+// From any thread.
+inline void RecordMetric(u32 metric, u64 value)
+{
+    HistogramRecordAtomic(metrics.metrics[metric].histogram, value);
+}
+
+// Everything recorded into 'metric' since the start.
+const Histogram& MetricTotal(u32 metric)
+{
+    return metrics.metrics[metric].histogram;
+}
+
+// Fills 'window.interval' with what was recorded into 'metric' since the previous call with
+// this window (or since the start). Zero the window before the first call.
+const Histogram& ReadMetricWindow(u32 metric, MetricWindow& window)
+{
+    const Histogram& total    = metrics.metrics[metric].histogram;
+    Histogram&       previous = window.previous;
+    Histogram&       interval = window.interval;
+
+    // The buckets are what counts. The totals next to them may be a sample ahead or behind.
+    interval.count = 0;
+    u32 first = HISTOGRAM_BUCKETS, last = 0;
+    for (u32 i = 0; i < HISTOGRAM_BUCKETS; ++i)
+    {
+        u32 now = __atomic_load_n(&total.buckets[i], __ATOMIC_RELAXED);
+        interval.buckets[i] = now - previous.buckets[i];
+        previous.buckets[i] = now;
+        interval.count     += interval.buckets[i];
+        if (interval.buckets[i])
+        {
+            if (first == HISTOGRAM_BUCKETS)
+                first = i;
+            last = i;
+        }
+    }
+
+    u64 sum = __atomic_load_n(&total.sum, __ATOMIC_RELAXED);
+    interval.sum  = sum - previous.sum;
+    previous.sum  = sum;
+    interval.min  = 0;
+    interval.max  = 0;
+    if (interval.count > 0)
+    {
+        // Only known to within the buckets, except where they're the extremes of the whole run.
+        u64 total_min = __atomic_load_n(&total.min, __ATOMIC_RELAXED);
+        u64 total_max = __atomic_load_n(&total.max, __ATOMIC_RELAXED);
+        interval.min = HistogramBucketLow(first)  > total_min ? HistogramBucketLow(first)  : total_min;
+        interval.max = HistogramBucketHigh(last)  < total_max ? HistogramBucketHigh(last)  : total_max;
+    }
+    return interval;
+}
+
+
+// ---- EXPORT ----
+static bool ConnectMetricsSocket()
+{
+    const char* path = metrics.destination + 5;  // After "unix:".
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+        return false;
+    strcpy(address.sun_path, path);
+
+    metrics.socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (metrics.socket == -1)
+        return false;
+#if defined(SO_NOSIGPIPE)
+    int on = 1;
+    setsockopt(metrics.socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    if (connect(metrics.socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+    {
+        close(metrics.socket);
+        metrics.socket = -1;
+        return false;
+    }
+    return true;
+}
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0  // SO_NOSIGPIPE instead.
+#endif
+
+// Sends to the socket, dropping the connection if the other end went away.
+static void SendMetrics(const char* text, u64 size)
+{
+    while (size > 0 && metrics.socket != -1)
+    {
+        ssize_t sent = send(metrics.socket, text, size, MSG_NOSIGNAL);
+        if (sent <= 0)
+        {
+            close(metrics.socket);
+            metrics.socket = -1;
+            return;
+        }
+        text += sent;
+        size -= sent;
+    }
+}
+
+static const char metrics_header[] = "time,metric,unit,count,min,mean,p50,p90,p99,p999,max\n";
+
+static void ExportMetrics()
+{
+    // Reconnect every period, so a listener can come and go.
+    bool socket = metrics.file == 0;
+    if (socket && metrics.socket == -1)
+    {
+        if (!ConnectMetricsSocket())
+            return;
+        SendMetrics(metrics_header, sizeof(metrics_header) - 1);
+    }
+
+    u64 now   = NanoTime();
+    u32 count = __atomic_load_n(&metrics.count, __ATOMIC_ACQUIRE);
+    for (u32 i = 0; i < count; ++i)
+    {
+        const Histogram& interval = ReadMetricWindow(i, metrics.windows[i]);
+        if (interval.count == 0)
+            continue;
+
+        char line[256];
+        int size = snprintf(line, sizeof(line), "%llu,%s,%s,%llu,%llu,%.1f,%llu,%llu,%llu,%llu,%llu\n",
+                            cast(now, unsigned long long), metrics.metrics[i].name, metrics.metrics[i].unit,
+                            cast(interval.count, unsigned long long), cast(interval.min, unsigned long long),
+                            HistogramMean(interval),
+                            cast(HistogramPercentile(interval, 50.0), unsigned long long),
+                            cast(HistogramPercentile(interval, 90.0), unsigned long long),
+                            cast(HistogramPercentile(interval, 99.0), unsigned long long),
+                            cast(HistogramPercentile(interval, 99.9), unsigned long long),
+                            cast(interval.max, unsigned long long));
+        if (size <= 0 || size >= cast(sizeof(line), int))
+            continue;
+
+        if (socket)
+            SendMetrics(line, size);
+        else
+            fwrite(line, size, 1, metrics.file);
+    }
+    if (!socket)
+        fflush(metrics.file);
+}
+
+static void* MetricsExportThread(void* data)
+{
+    pthread_mutex_lock(&metrics.lock);
+    while (!metrics.stop)
+    {
+        timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        u64 nanoseconds = until.tv_nsec + metrics.period;
+        until.tv_sec  += nanoseconds / 1000000000ULL;
+        until.tv_nsec  = nanoseconds % 1000000000ULL;
+        while (!metrics.stop && pthread_cond_timedwait(&metrics.wake, &metrics.lock, &until) == 0)
+            ;
+
+        pthread_mutex_unlock(&metrics.lock);
+        ExportMetrics();  // One last time when stopping, for the rest of the last period.
+        pthread_mutex_lock(&metrics.lock);
+    }
+    pthread_mutex_unlock(&metrics.lock);
+    return 0;
+}
+
+// Exports the metrics every 'period' nanoseconds to 'destination', a file path, or
+// 'unix:<path>' for a Unix stream socket someone listens on.
+bool StartMetricsExport(const char* destination, u64 period)
+{
+    snprintf(metrics.destination, sizeof(metrics.destination), "%s", destination);
+    metrics.period = period;
+    metrics.socket = -1;
+    metrics.file   = 0;
+
+    if (strncmp(destination, "unix:", 5) != 0)
+    {
+        metrics.file = fopen(destination, "w");
+        if (!metrics.file)
+        {
+            REPORT_ERROR("Couldn't create metrics file '%s'.\n", destination);
+            return false;
+        }
+        fwrite(metrics_header, sizeof(metrics_header) - 1, 1, metrics.file);
+    }
+    else if (!ConnectMetricsSocket())
+    {
+        // Not fatal, it's retried every period.
+        fprintf(stderr, "[Warning]: Nothing listens on '%s' yet.\n", destination + 5);
+    }
+    else
+    {
+        SendMetrics(metrics_header, sizeof(metrics_header) - 1);
+    }
+
+    metrics.windows = cast(calloc(METRICS_MAX, sizeof(MetricWindow)), MetricWindow*);  // LEAK(ted): Lives until exit.
+    pthread_mutex_init(&metrics.lock, 0);
+    pthread_cond_init(&metrics.wake, 0);
+    if (!metrics.windows || pthread_create(&metrics.exporter, 0, MetricsExportThread, 0) != 0)
+    {
+        REPORT_ERROR("Couldn't start the metrics export thread.\n");
+        return false;
+    }
+    metrics.exporting = true;
+    return true;
+}
+
+// Exports what's been recorded since the last period, and stops.
+void StopMetricsExport()
+{
+    if (!metrics.exporting)
+        return;
+
+    pthread_mutex_lock(&metrics.lock);
+    metrics.stop = true;
+    pthread_cond_signal(&metrics.wake);
+    pthread_mutex_unlock(&metrics.lock);
+    pthread_join(metrics.exporter, 0);
+
+    if (metrics.file)
+        fclose(metrics.file);
+    if (metrics.socket != -1)
+        close(metrics.socket);
+    metrics.exporting = false;
+}
@@ -0,0 +1,499 @@
+// Debug overlay drawn straight into the framebuffer: frame time graph, arena usage and the most
+// expensive profiler blocks of the last frame.
+//
+// Text uses an 8x8 bitmap font that's rasterized once into an atlas at startup, with the drop
+// shadow already baked in. Each cell has two 8-bit maps: how much of the background is covered
+// (text or shadow), and how much of that is text. Both maps are only ever 0 or 255, so drawing
+// a row of 8 pixels of a glyph is a masked select, which is a handful of SIMD instructions.
+//
+// The overlay measures itself, see 'cost_ns', and the benchmark has an 'overlay' kernel. It costs
+// about 10 us per frame with its rows in cache and 12 to 15 us without, whatever the resolution,
+// and about 20 us in the headless host ('--overlay'), where the game's frame has pushed the
+// overlay's code and atlas out of cache too. That's more than the few microseconds it should.
+// In the benchmark, about 3 us is shading the graph's background and 2 us filling the bars,
+// which already touch each pixel only once. The rest is the 7 lines of text, half a microsecond
+// each, a third of which is snprintf. Getting it down further means drawing less.
+//
+// Requires 'profiler.cpp', 'virtual_memory.cpp' and 'NanoTime'.
+
+#include "simd.h"
+
+
+#define GLYPH_SIZE          8
+#define GLYPH_FIRST         32    // ' '
+#define GLYPH_COUNT         95    // ' ' to '~'.
+#define CELL_WIDTH          GLYPH_SIZE       // The shadow is 1 pixel right and down. Only '*' and '_' use the
+#define CELL_HEIGHT         (GLYPH_SIZE + 1) // last column, and lose a shadow pixel, so only the height grows.
+#define CELL_SIZE           (CELL_WIDTH * CELL_HEIGHT)
+
+#define OVERLAY_GRAPH_SIZE  128   // Frame times in the graph.
+#define OVERLAY_TOP_BLOCKS  5
+#define OVERLAY_LINE_HEIGHT (GLYPH_SIZE + 2)
+
+
+// Public domain 8x8 font (font8x8_basic by Daniel Hepper). One byte per row, bit 0 is the leftmost pixel.
+static const u8 font8x8[GLYPH_COUNT][GLYPH_SIZE] =
+{
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // space
+    { 0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00 },  // '!'
+    { 0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '"'
+    { 0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00 },  // '#'
+    { 0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00 },  // '$'
+    { 0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00 },  // '%'
+    { 0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00 },  // '&'
+    { 0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '''
+    { 0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00 },  // '('
+    { 0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00 },  // ')'
+    { 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 },  // '*'
+    { 0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00 },  // '+'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06 },  // ','
+    { 0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00 },  // '-'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00 },  // '.'
+    { 0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00 },  // '/'
+    { 0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00 },  // '0'
+    { 0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00 },  // '1'
+    { 0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00 },  // '2'
+    { 0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00 },  // '3'
+    { 0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00 },  // '4'
+    { 0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00 },  // '5'
+    { 0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00 },  // '6'
+    { 0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00 },  // '7'
+    { 0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00 },  // '8'
+    { 0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00 },  // '9'
+    { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00 },  // ':'
+    { 0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06 },  // ';'
+    { 0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00 },  // '<'
+    { 0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00 },  // '='
+    { 0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00 },  // '>'
+    { 0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00 },  // '?'
+    { 0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00 },  // '@'
+    { 0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00 },  // 'A'
+    { 0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00 },  // 'B'
+    { 0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00 },  // 'C'
+    { 0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00 },  // 'D'
+    { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00 },  // 'E'
+    { 0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00 },  // 'F'
+    { 0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00 },  // 'G'
+    { 0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00 },  // 'H'
+    { 0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // 'I'
+    { 0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00 },  // 'J'
+    { 0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00 },  // 'K'
+    { 0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00 },  // 'L'
+    { 0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00 },  // 'M'
+    { 0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00 },  // 'N'
+    { 0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00 },  // 'O'
+    { 0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00 },  // 'P'
+    { 0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00 },  // 'Q'
+    { 0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00 },  // 'R'
+    { 0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00 },  // 'S'
+    { 0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // 'T'
+    { 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00 },  // 'U'
+    { 0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },  // 'V'
+    { 0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00 },  // 'W'
+    { 0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00 },  // 'X'
+    { 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00 },  // 'Y'
+    { 0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00 },  // 'Z'
+    { 0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00 },  // '['
+    { 0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00 },  // backslash
+    { 0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00 },  // ']'
+    { 0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00 },  // '^'
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF },  // '_'
+    { 0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '`'
+    { 0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00 },  // 'a'
+    { 0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00 },  // 'b'
+    { 0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00 },  // 'c'
+    { 0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00 },  // 'd'
+    { 0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00 },  // 'e'
+    { 0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00 },  // 'f'
+    { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F },  // 'g'
+    { 0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00 },  // 'h'
+    { 0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // 'i'
+    { 0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E },  // 'j'
+    { 0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00 },  // 'k'
+    { 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00 },  // 'l'
+    { 0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00 },  // 'm'
+    { 0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00 },  // 'n'
+    { 0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00 },  // 'o'
+    { 0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F },  // 'p'
+    { 0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78 },  // 'q'
+    { 0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00 },  // 'r'
+    { 0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00 },  // 's'
+    { 0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00 },  // 't'
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00 },  // 'u'
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00 },  // 'v'
+    { 0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00 },  // 'w'
+    { 0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00 },  // 'x'
+    { 0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F },  // 'y'
+    { 0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00 },  // 'z'
+    { 0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00 },  // '{'
+    { 0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00 },  // '|'
+    { 0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00 },  // '}'
+    { 0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },  // '~'
+};
+
+
+struct Overlay
+{
+    u8* atlas;                 // Per glyph: CELL_SIZE coverage, then CELL_SIZE text weight.
+
+    u64 frame_times[OVERLAY_GRAPH_SIZE];  // Nanoseconds, ring buffer.
+    u32 frame_time_index;
+    u64 budget_ns;             // Drawn as a line in the graph.
+
+    u64 cost_ns;               // What drawing the overlay took last frame.
+    bool enabled;
+};
+
+
+// Rasterizes the font into the atlas, which is allocated from 'arena' and must outlive the overlay.
+bool InitializeOverlay(Overlay& overlay, Buffer& arena, u64 budget_ns)
+{
+    memset(&overlay, 0, sizeof(overlay));
+    overlay.budget_ns = budget_ns;
+    overlay.enabled   = true;
+
+    overlay.atlas = PushArray(arena, GLYPH_COUNT * 2 * CELL_SIZE, u8);
+    if (!overlay.atlas)
+    {
+        REPORT_ERROR("Not enough memory for the overlay's glyph atlas.\n");
+        return false;
+    }
+
+    for (u32 glyph = 0; glyph < GLYPH_COUNT; ++glyph)
+    {
+        u8* coverage = overlay.atlas + glyph * 2 * CELL_SIZE;
+        u8* text     = coverage + CELL_SIZE;
+        for (u32 y = 0; y < CELL_HEIGHT; ++y)
+        {
+            u8 bits   = y < GLYPH_SIZE ? font8x8[glyph][y] : 0;
+            u8 shadow = y > 0 ? cast(font8x8[glyph][y - 1] << 1, u8) : 0;
+            for (u32 x = 0; x < CELL_WIDTH; ++x)
+            {
+                bool is_text   = (bits   >> x) & 1;
+                bool is_shadow = (shadow >> x) & 1;
+                coverage[y * CELL_WIDTH + x] = is_text || is_shadow ? 255 : 0;
+                text[y * CELL_WIDTH + x]     = is_text ? 255 : 0;
+            }
+        }
+    }
+
+    return true;
+}
+
+void OverlayRecordFrame(Overlay& overlay, u64 frame_ns)
+{
+    overlay.frame_times[overlay.frame_time_index] = frame_ns;
+    overlay.frame_time_index = (overlay.frame_time_index + 1) % OVERLAY_GRAPH_SIZE;
+}
+
+
+static u32 PackPixel(u8 r, u8 g, u8 b)
+{
+    Pixel pixel;
+    pixel.r = r;
+    pixel.g = g;
+    pixel.b = b;
+    pixel.a = 255;
+
+    u32 result;
+    memcpy(&result, &pixel, sizeof(result));
+    return result;
+}
+
+// All blending is
+//     dst = (dst * (255 - coverage) + color * weight) / 255
+// per channel, rounded. With weight == coverage it's a normal alpha blend, with weight == 0 it
+// darkens (the shadow). It works for any channel order as 'color' is packed like the framebuffer.
+static inline u8 BlendChannel(u32 dst, u32 coverage, u32 src, u32 weight)
+{
+    u32 t = dst * (255 - coverage) + src * weight + 128;
+    return cast((t + (t >> 8)) >> 8, u8);
+}
+
+static void BlendRowScalar(u8* dst, const u8* coverage, const u8* weight, u32 count, u32 color)
+{
+    u8 src[4];
+    memcpy(src, &color, sizeof(src));
+    for (u32 i = 0; i < count; ++i)
+    {
+        for (u32 c = 0; c < 4; ++c)
+            dst[i * 4 + c] = BlendChannel(dst[i * 4 + c], coverage[i], src[c], weight[i]);
+    }
+}
+
+// Draws one row of a glyph cell. 'dst' must have room for CELL_WIDTH pixels. The atlas only has
+// 0 and 255, so the blend comes down to picking the text color, black (the shadow) or the pixel
+// that's there, which is a mask per pixel.
+static inline void BlendCellRow(u8* dst, const u8* coverage, const u8* weight, u32 color)
+{
+#if defined(SIMD_SSE2)
+    u64 any;
+    memcpy(&any, coverage, sizeof(any));
+    if (any == 0)
+        return;  // Nothing to blend, which is a good part of every glyph.
+
+    // Each byte repeated 4 times, for the 4 channels of the pixel.
+    __m128i c   = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(coverage));
+    __m128i w   = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(weight));
+    __m128i src = _mm_set1_epi32(cast(color, int));
+    c = _mm_unpacklo_epi8(c, c);
+    w = _mm_unpacklo_epi8(w, w);
+
+    __m128i* address = reinterpret_cast<__m128i*>(dst);
+    __m128i  low     = _mm_loadu_si128(address);
+    __m128i  high    = _mm_loadu_si128(address + 1);
+    low  = _mm_or_si128(_mm_andnot_si128(_mm_unpacklo_epi16(c, c), low),  _mm_and_si128(_mm_unpacklo_epi16(w, w), src));
+    high = _mm_or_si128(_mm_andnot_si128(_mm_unpackhi_epi16(c, c), high), _mm_and_si128(_mm_unpackhi_epi16(w, w), src));
+    _mm_storeu_si128(address,     low);
+    _mm_storeu_si128(address + 1, high);
+#elif defined(SIMD_NEON)
+    uint8x8_t c = vld1_u8(coverage);
+    if (vget_lane_u64(vreinterpret_u64_u8(c), 0) == 0)
+        return;  // Nothing to blend, which is a good part of every glyph.
+
+    uint8x8_t   w      = vld1_u8(weight);
+    uint8x8x4_t pixels = vld4_u8(dst);  // One register per channel.
+    for (u32 channel = 0; channel < 4; ++channel)
+    {
+        uint8x8_t src = vand_u8(vdup_n_u8(cast(color >> (channel * 8), u8)), w);
+        pixels.val[channel] = vbsl_u8(c, src, pixels.val[channel]);
+    }
+    vst4_u8(dst, pixels);
+#else
+    BlendRowScalar(dst, coverage, weight, CELL_WIDTH, color);
+#endif
+}
+
+static void DrawGlyph(Overlay& overlay, FrameBuffer& framebuffer, s32 x, s32 y, u32 glyph, u32 color)
+{
+    const u8* coverage = overlay.atlas + glyph * 2 * CELL_SIZE;
+    const u8* weight   = coverage + CELL_SIZE;
+
+    if (x >= 0 && y >= 0 && x + CELL_WIDTH <= framebuffer.width && y + CELL_HEIGHT <= framebuffer.height)
+    {
+        u8* dst = reinterpret_cast<u8*>(framebuffer.pixels + y * framebuffer.width + x);
+        for (u32 row = 0; row < CELL_HEIGHT; ++row)
+            BlendCellRow(dst + row * framebuffer.width * 4, coverage + row * CELL_WIDTH, weight + row * CELL_WIDTH, color);
+        return;
+    }
+
+    // Clipped by the edge of the framebuffer.
+    s32 left   = x < 0 ? 0 : x;
+    s32 top    = y < 0 ? 0 : y;
+    s32 right  = x + CELL_WIDTH  > framebuffer.width  ? framebuffer.width  : x + CELL_WIDTH;
+    s32 bottom = y + CELL_HEIGHT > framebuffer.height ? framebuffer.height : y + CELL_HEIGHT;
+    for (s32 row = top; row < bottom && left < right; ++row)
+    {
+        u32 offset = (row - y) * CELL_WIDTH + (left - x);
+        u8* dst    = reinterpret_cast<u8*>(framebuffer.pixels + row * framebuffer.width + left);
+        BlendRowScalar(dst, coverage + offset, weight + offset, cast(right - left, u32), color);
+    }
+}
+
+static void DrawText(Overlay& overlay, FrameBuffer& framebuffer, s32 x, s32 y, const char* text, u32 color)
+{
+    for (const char* c = text; *c; ++c, x += GLYPH_SIZE)
+    {
+        u32 glyph = cast(*c, u8) - GLYPH_FIRST;
+        if (glyph != 0 && glyph < GLYPH_COUNT)  // Spaces are skipped.
+            DrawGlyph(overlay, framebuffer, x, y, glyph, color);
+    }
+}
+
+
+// Clips the rectangle to the framebuffer. Returns false if nothing is left.
+static bool ClipRectangle(FrameBuffer& framebuffer, s32& left, s32& top, s32& right, s32& bottom)
+{
+    if (left < 0) left = 0;
+    if (top  < 0) top  = 0;
+    if (right  > framebuffer.width)  right  = framebuffer.width;
+    if (bottom > framebuffer.height) bottom = framebuffer.height;
+    return left < right && top < bottom;
+}
+
+static void FillRectangle(FrameBuffer& framebuffer, s32 left, s32 top, s32 right, s32 bottom, u32 color)
+{
+    if (!ClipRectangle(framebuffer, left, top, right, bottom))
+        return;
+
+    for (s32 y = top; y < bottom; ++y)
+    {
+        u32* row = reinterpret_cast<u32*>(framebuffer.pixels + y * framebuffer.width);
+        for (s32 x = left; x < right; ++x)
+            row[x] = color;
+    }
+}
+
+// Darkens the rectangle by 'amount' out of 255, so what's drawn on top stays readable. Rounds
+// down: 'x * (255 - amount) * 257 >> 16', which is a single multiply per channel in SIMD.
+static void ShadeRectangle(FrameBuffer& framebuffer, s32 left, s32 top, s32 right, s32 bottom, u8 amount)
+{
+    if (!ClipRectangle(framebuffer, left, top, right, bottom))
+        return;
+
+    u32 keep = 255 - amount;
+    for (s32 y = top; y < bottom; ++y)
+    {
+        u8* row = reinterpret_cast<u8*>(framebuffer.pixels + y * framebuffer.width);
+        s32 x   = left;
+#if defined(SIMD_SSE2)
+        __m128i zero   = _mm_setzero_si128();
+        __m128i factor = _mm_set1_epi16(cast(keep * 257, short));
+        for (; x + 4 <= right; x += 4)
+        {
+            __m128i* address = reinterpret_cast<__m128i*>(row + x * 4);
+            __m128i  pixels  = _mm_loadu_si128(address);
+            __m128i  low     = _mm_mulhi_epu16(_mm_unpacklo_epi8(pixels, zero), factor);
+            __m128i  high    = _mm_mulhi_epu16(_mm_unpackhi_epi8(pixels, zero), factor);
+            _mm_storeu_si128(address, _mm_packus_epi16(low, high));
+        }
+#elif defined(SIMD_NEON)
+        uint8x8_t factor = vdup_n_u8(cast(keep, u8));
+        for (; x + 4 <= right; x += 4)
+        {
+            uint8x16_t pixels = vld1q_u8(row + x * 4);
+            uint16x8_t low    = vmull_u8(vget_low_u8(pixels),  factor);
+            uint16x8_t high   = vmull_u8(vget_high_u8(pixels), factor);
+            vst1q_u8(row + x * 4, vcombine_u8(vshrn_n_u16(vsraq_n_u16(low, low, 8), 8), vshrn_n_u16(vsraq_n_u16(high, high, 8), 8)));
+        }
+#endif
+        for (; x < right; ++x)
+        {
+            for (u32 c = 0; c < 4; ++c)
+            {
+                u32 t = row[x * 4 + c] * keep;
+                row[x * 4 + c] = cast((t + (t >> 8)) >> 8, u8);
+            }
+        }
+    }
+}
+
+
+// One decimal, like "%.1fM", but without formatting a float, which costs snprintf several times
+// as much as an integer.
+static void FormatBytes(char* result, u32 size, u64 bytes)
+{
+    u64         unit   = 1;
+    const char* suffix = "B";
+    if      (bytes >= GIGABYTES(1)) { unit = GIGABYTES(1); suffix = "G"; }
+    else if (bytes >= MEGABYTES(1)) { unit = MEGABYTES(1); suffix = "M"; }
+    else if (bytes >= KILOBYTES(1)) { unit = KILOBYTES(1); suffix = "K"; }
+
+    if (unit == 1)
+    {
+        snprintf(result, size, "%lluB", cast(bytes, unsigned long long));
+        return;
+    }
+    u64 tenths = (bytes * 10 + unit / 2) / unit;
+    snprintf(result, size, "%llu.%llu%s", cast(tenths / 10, unsigned long long), cast(tenths % 10, unsigned long long), suffix);
+}
+
+static void DrawArenaUsage(Overlay& overlay, FrameBuffer& framebuffer, s32 x, s32 y, const char* name, Buffer& arena, u32 color)
+{
+    char used[16], committed[16], size[16], line[96];
+    FormatBytes(used,      sizeof(used),      arena.used);
+    FormatBytes(committed, sizeof(committed), arena.committed);
+    FormatBytes(size,      sizeof(size),      arena.size);
+    snprintf(line, sizeof(line), "%-10s %7s / %7s / %s", name, used, committed, size);
+    DrawText(overlay, framebuffer, x, y, line, color);
+}
+
+
+// Draws the overlay on top of whatever the game rendered. Call right before presenting, on the
+// rows that are presented: a host that renders tiled draws it after linearizing.
+void DrawOverlay(Overlay& overlay, FrameBuffer& framebuffer, Memory& memory)
+{
+    if (!overlay.enabled || framebuffer.width <= 0 || framebuffer.height <= 0)
+        return;
+    ASSERT(framebuffer.layout == FRAMEBUFFER_LINEAR, "The overlay draws rows, the framebuffer's layout is %i.\n", framebuffer.layout);
+
+    u64 start = NanoTime();
+
+    u32 text = PackPixel(255, 255, 255);
+    u32 bars = PackPixel(80, 200, 255);
+    u32 over = PackPixel(255, 80, 80);
+
+    s32 margin = 4;
+    s32 y      = margin;
+
+    // ---- FRAME TIME GRAPH ----
+    // Oldest to the left. Scaled so the budget line is at two thirds of the height. Overruns are red.
+    {
+        s32 graph_width  = OVERLAY_GRAPH_SIZE * 2;  // Each bar is 2 pixels wide.
+        s32 graph_height = 48;
+        s32 bottom       = y + graph_height;
+        u64 scale        = overlay.budget_ns * 3 / 2;
+
+        ShadeRectangle(framebuffer, margin, y, margin + graph_width, bottom, 160);
+
+        u64 total = 0, maximum = 0;
+        u32 colors[OVERLAY_GRAPH_SIZE];
+        s32 heights[OVERLAY_GRAPH_SIZE];
+        for (u32 i = 0; i < OVERLAY_GRAPH_SIZE; ++i)
+        {
+            u64 time = overlay.frame_times[(overlay.frame_time_index + i) % OVERLAY_GRAPH_SIZE];
+            total  += time;
+            maximum = time > maximum ? time : maximum;
+
+            heights[i] = time < scale ? cast(time * graph_height / scale, s32) : graph_height;
+            colors[i]  = time > overlay.budget_ns ? over : bars;
+        }
+
+        // Bar by bar, so each pixel is only visited if it's drawn: deciding that per pixel of the
+        // graph costs more than the drawing, as the tops of the bars are all over the place.
+        if (margin + graph_width <= framebuffer.width && bottom <= framebuffer.height)
+        {
+            for (u32 i = 0; i < OVERLAY_GRAPH_SIZE; ++i)
+            {
+                u32* pixel = reinterpret_cast<u32*>(framebuffer.pixels + (bottom - 1) * framebuffer.width + margin + i * 2);
+                for (s32 level = 0; level < heights[i]; ++level, pixel -= framebuffer.width)
+                {
+                    pixel[0] = colors[i];
+                    pixel[1] = colors[i];
+                }
+            }
+        }
+
+        s32 budget_y = bottom - graph_height * 2 / 3;
+        FillRectangle(framebuffer, margin, budget_y, margin + graph_width, budget_y + 1, text);
+
+        // In hundredths of a millisecond, as integers are much cheaper to format than floats.
+        u64 mean = (total / OVERLAY_GRAPH_SIZE + 5000) / 10000;
+        u64 peak = (maximum + 5000) / 10000;
+        char line[96];
+        snprintf(line, sizeof(line), "frame %3llu.%02llu ms  max %3llu.%02llu ms",
+                 cast(mean / 100, unsigned long long), cast(mean % 100, unsigned long long),
+                 cast(peak / 100, unsigned long long), cast(peak % 100, unsigned long long));
+        DrawText(overlay, framebuffer, margin + 2, y + 2, line, text);
+
+        y = bottom + margin;
+    }
+
+    // ---- ARENAS ----
+    // Used / committed / reserved.
+    DrawArenaUsage(overlay, framebuffer, margin, y, "persistent", memory.persistent, text);
+    y += OVERLAY_LINE_HEIGHT;
+    DrawArenaUsage(overlay, framebuffer, margin, y, "temporary",  memory.temporary,  text);
+    y += OVERLAY_LINE_HEIGHT;
+
+    // ---- PROFILER ----
+    {
+        ProfileBlock blocks[OVERLAY_TOP_BLOCKS];
+        u32 count = ProfilerTopBlocks(blocks, OVERLAY_TOP_BLOCKS);
+
+        char line[96];
+        for (u32 i = 0; i < count; ++i)
+        {
+            snprintf(line, sizeof(line), "%-16.16s %12llu cy %4ux", blocks[i].name,
+                     cast(blocks[i].cycles, unsigned long long), blocks[i].hits);
+            DrawText(overlay, framebuffer, margin, y, line, text);
+            y += OVERLAY_LINE_HEIGHT;
+        }
+
+        u64 cost = (overlay.cost_ns + 50) / 100;  // Tenths of a microsecond.
+        snprintf(line, sizeof(line), "overlay %4llu.%llu us", cast(cost / 10, unsigned long long), cast(cost % 10, unsigned long long));
+        DrawText(overlay, framebuffer, margin, y, line, text);
+    }
+
+    overlay.cost_ns = NanoTime() - start;
+}
@@ -0,0 +1,227 @@
+// Hardware performance counters, to tell why a block of code is slow and not just that it is:
+// instructions per cycle, and cache, branch and TLB misses.
+//
+// On Linux every thread that samples them gets its own counters from perf_event_open, counting
+// only that thread in user space. They're opened in two groups of three (so each group fits in
+// the PMU at once and the counters within a group are comparable), and read with one system
+// call per group. Counters the CPU, kernel or permissions don't allow (a VM without a virtual
+// PMU, 'perf_event_paranoid' > 2, ...) are left out, and if hardware cycles are missing the
+// time stamp counter stands in for them. So at worst the numbers degrade to cycles only.
+// Elsewhere it's always cycles only.
+//
+// Samples are running totals: take one before and one after the code and subtract.
+//
+// Requires 'CycleCount' from the platform's clock.cpp.
+
+#include <string.h>
+
+
+enum PerfCounter
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,       // Level 1 data cache read misses.
+    PERF_LLC_MISSES,       // Last level cache misses.
+    PERF_DTLB_MISSES,      // Data TLB read misses.
+    PERF_COUNTER_COUNT
+};
+
+static const char* const perf_counter_names[PERF_COUNTER_COUNT] =
+{
+    "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses", "dtlb_misses",
+};
+
+struct PerfSample
+{
+    u64 values[PERF_COUNTER_COUNT];
+};
+
+#define PERF_GROUPS 2
+
+struct PerfGroup
+{
+    int leader;                           // -1 if none of the group's counters could be opened.
+    u32 count;
+    u32 counters[PERF_COUNTER_COUNT];     // Which counter each member is, in read order.
+};
+
+// Per thread, opened on the thread's first sample.
+struct PerfThread
+{
+    bool opened;
+    u32  available;                       // Bit per 'PerfCounter'.
+    bool tsc_cycles;                      // Cycles are time stamp counter ticks, not core cycles.
+    PerfGroup groups[PERF_GROUPS];
+};
+
+static bool perf_counters_enabled;
+static char perf_counters_status[128];    // Why counters are missing, for reports.
+
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+struct PerfEvent
+{
+    u32 type;
+    u64 config;
+    u32 group;
+};
+
+#define PERF_CACHE_READ_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const PerfEvent perf_events[PERF_COUNTER_COUNT] =
+{
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,                  0 },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,                0 },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,               0 },
+    { PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D),  1 },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,                1 },
+    { PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB), 1 },
+};
+
+static __thread PerfThread perf_thread;
+
+static int OpenPerfEvent(const PerfEvent& event, int group_leader)
+{
+    perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size           = sizeof(attributes);
+    attributes.type           = event.type;
+    attributes.config         = event.config;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv     = 1;
+    attributes.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    // This thread, any CPU.
+    return cast(syscall(SYS_perf_event_open, &attributes, 0, -1, group_leader, PERF_FLAG_FD_CLOEXEC), int);
+}
+
+static void OpenPerfCounters(PerfThread& thread)
+{
+    thread.opened    = true;
+    thread.available = 0;
+    int first_error  = 0;
+
+    for (u32 g = 0; g < PERF_GROUPS; ++g)
+    {
+        PerfGroup& group = thread.groups[g];
+        group.leader = -1;
+        group.count  = 0;
+        for (u32 i = 0; i < PERF_COUNTER_COUNT; ++i)
+        {
+            if (perf_events[i].group != g)
+                continue;
+
+            int fd = OpenPerfEvent(perf_events[i], group.leader);
+            if (fd < 0)
+            {
+                first_error = first_error ? first_error : errno;
+                continue;
+            }
+            if (group.leader < 0)
+                group.leader = fd;
+            group.counters[group.count++] = i;
+            thread.available |= 1u << i;
+        }
+    }
+
+    if (first_error && perf_counters_status[0] == '\0')
+    {
+        if (thread.available == 0)
+            snprintf(perf_counters_status, sizeof(perf_counters_status), "no hardware counters (%s), cycles only", strerror(first_error));
+        else
+            snprintf(perf_counters_status, sizeof(perf_counters_status), "some hardware counters are missing (%s)", strerror(first_error));
+    }
+
+    thread.tsc_cycles = !(thread.available & (1u << PERF_CYCLES));
+    thread.available |= 1u << PERF_CYCLES;
+}
+
+// Fills 'sample' with the running totals for this thread. Returns which counters are valid,
+// the rest are 0.
+u32 ReadPerfCounters(PerfSample& sample)
+{
+    PerfThread& thread = perf_thread;
+    if (!thread.opened)
+        OpenPerfCounters(thread);
+
+    memset(&sample, 0, sizeof(sample));
+    for (u32 g = 0; g < PERF_GROUPS; ++g)
+    {
+        const PerfGroup& group = thread.groups[g];
+        if (group.leader < 0)
+            continue;
+
+        // { count, time enabled, time running, value... }
+        u64 data[3 + PERF_COUNTER_COUNT];
+        ssize_t size = read(group.leader, data, sizeof(data));
+        if (size < cast(3 * sizeof(u64), ssize_t) || data[0] != group.count)
+            continue;
+
+        // Scale up if the kernel had to multiplex the group with others.
+        u64 enabled = data[1], running = data[2];
+        for (u32 i = 0; i < group.count; ++i)
+        {
+            u64 value = data[3 + i];
+            if (running > 0 && running < enabled)
+                value = cast(cast(value, f64) * enabled / running, u64);
+            sample.values[group.counters[i]] = value;
+        }
+    }
+
+    if (thread.tsc_cycles)
+        sample.values[PERF_CYCLES] = CycleCount();
+    return thread.available;
+}
+
+// Which counters 'ReadPerfCounters' returns on this thread, and whether cycles are time stamp
+// counter ticks.
+u32 PerfCountersAvailable(bool* tsc_cycles = 0)
+{
+    if (!perf_thread.opened)
+        OpenPerfCounters(perf_thread);
+    if (tsc_cycles)
+        *tsc_cycles = perf_thread.tsc_cycles;
+    return perf_thread.available;
+}
+
+#else
+
+u32 ReadPerfCounters(PerfSample& sample)
+{
+    memset(&sample, 0, sizeof(sample));
+    sample.values[PERF_CYCLES] = CycleCount();
+    return 1u << PERF_CYCLES;
+}
+
+u32 PerfCountersAvailable(bool* tsc_cycles = 0)
+{
+    if (perf_counters_status[0] == '\0')
+        snprintf(perf_counters_status, sizeof(perf_counters_status), "hardware counters are only read on Linux, cycles only");
+    if (tsc_cycles)
+        *tsc_cycles = true;
+    return 1u << PERF_CYCLES;
+}
+
+#endif
+
+
+// Makes 'TIMED_BLOCK's sample the counters too (see profiler.cpp). Off by default, as every
+// sample is a system call or two.
+void EnablePerfCounters()
+{
+    perf_counters_enabled = true;
+}
+
+// Describes what's missing, or "" if everything's there.
+const char* PerfCountersStatus()
+{
+    PerfCountersAvailable();
+    return perf_counters_status;
+}
@@ -0,0 +1,251 @@
+// Named timed blocks. Put 'TIMED_BLOCK("name");' at the top of a scope and the cycles spent
+// until the end of the scope are added to that name for the current frame. Call
+// 'ProfilerEndFrame' once per frame to publish the totals.
+//
+// With 'EnablePerfCounters' (see perf_counters.cpp) the blocks also sample the hardware
+// counters, for instructions per cycle and miss rates per block and frame. 'ProfilerExport'
+// writes those for every block and frame to a CSV file, and 'ProfilerPrintCounters' summarizes
+// them over the whole run.
+//
+// Every block's cycles per frame are also recorded into a metric of the same name (see
+// metrics.cpp), for percentiles of a block's cost over any stretch of frames.
+//
+// NOTE(ted): Not thread safe. Only time blocks on the main thread (the audio queue callback
+// runs on the main run loop, so it's fine).
+//
+// Requires 'CycleCount' from the platform's clock.cpp, perf_counters.cpp and metrics.cpp.
+
+#include <string.h>
+
+
+#define PROFILER_MAX_BLOCKS 64
+
+// Every block registers a metric.
+static_assert(PROFILER_MAX_BLOCKS + METRICS_RESERVED <= METRICS_MAX, "Not enough metrics for every profile block.");
+
+struct ProfileBlock
+{
+    const char* name;
+    u64 cycles;   // Total over the frame.
+    u32 hits;
+    u64 counters[PERF_COUNTER_COUNT];  // Total over the frame, if counters are enabled.
+};
+
+struct Profiler
+{
+    ProfileBlock blocks[PROFILER_MAX_BLOCKS];    // Being recorded.
+    ProfileBlock previous[PROFILER_MAX_BLOCKS];  // Last finished frame.
+    ProfileBlock totals[PROFILER_MAX_BLOCKS];    // Over all frames, for 'ProfilerPrintCounters'.
+    u32 metrics[PROFILER_MAX_BLOCKS];            // Cycles per frame, in frames the block was hit.
+    u32 count;
+
+    u32   counters_available;  // Bit per 'PerfCounter', from the blocks that sampled them.
+    u64   frame;
+    FILE* export_file;
+};
+static Profiler profiler;
+
+
+// Returns the index of the block with that name, adding it if needed.
+u32 RegisterProfileBlock(const char* name)
+{
+    for (u32 i = 0; i < profiler.count; ++i)
+    {
+        if (strcmp(profiler.blocks[i].name, name) == 0)
+            return i;
+    }
+
+    ASSERT(profiler.count < PROFILER_MAX_BLOCKS, "Too many profile blocks (max %i).\n", PROFILER_MAX_BLOCKS);
+    profiler.blocks[profiler.count].name   = name;
+    profiler.previous[profiler.count].name = name;
+    profiler.totals[profiler.count].name   = name;
+    profiler.metrics[profiler.count]       = RegisterMetric(name, "cycles");
+    return profiler.count++;
+}
+
+struct TimedBlock
+{
+    u32  index;
+    bool counting;
+    PerfSample counters;
+    u64  start;
+
+    TimedBlock(u32 index) : index(index), counting(perf_counters_enabled)
+    {
+        if (counting)
+            ReadPerfCounters(counters);
+        start = CycleCount();
+    }
+
+    ~TimedBlock()
+    {
+        u64 end = CycleCount();
+        ProfileBlock& block = profiler.blocks[index];
+        block.cycles += end - start;
+        block.hits   += 1;
+
+        if (counting)
+        {
+            PerfSample now;
+            profiler.counters_available |= ReadPerfCounters(now);
+            for (u32 i = 0; i < PERF_COUNTER_COUNT; ++i)
+                block.counters[i] += now.values[i] - counters.values[i];
+        }
+    }
+};
+
+// The index is looked up once per call site.
+#define TIMED_BLOCK_(name, line)                                          \
+    static u32 profile_block_index_##line = RegisterProfileBlock(name);   \
+    TimedBlock timed_block_##line(profile_block_index_##line)
+#define TIMED_BLOCK_LINE(name, line) TIMED_BLOCK_(name, line)
+#define TIMED_BLOCK(name) TIMED_BLOCK_LINE(name, __LINE__)
+
+
+// Writes a counter as a CSV field, empty if it wasn't counted.
+static void ExportCounter(FILE* file, u32 counter, u64 value)
+{
+    if (profiler.counters_available & (1u << counter))
+        fprintf(file, ",%llu", cast(value, unsigned long long));
+    else
+        fprintf(file, ",");
+}
+
+static void ExportFrame()
+{
+    FILE* file = profiler.export_file;
+    for (u32 i = 0; i < profiler.count; ++i)
+    {
+        const ProfileBlock& block = profiler.blocks[i];
+        if (block.hits == 0)
+            continue;
+
+        fprintf(file, "%llu,%s,%u,%llu", cast(profiler.frame, unsigned long long), block.name, block.hits,
+                cast(block.cycles, unsigned long long));
+        for (u32 counter = 0; counter < PERF_COUNTER_COUNT; ++counter)
+            ExportCounter(file, counter, block.counters[counter]);
+
+        bool have_ipc = (profiler.counters_available & (1u << PERF_INSTRUCTIONS)) && block.counters[PERF_CYCLES] > 0;
+        if (have_ipc)
+            fprintf(file, ",%.3f\n", cast(block.counters[PERF_INSTRUCTIONS], f64) / block.counters[PERF_CYCLES]);
+        else
+            fprintf(file, ",\n");
+    }
+}
+
+void ProfilerEndFrame()
+{
+    if (profiler.export_file)
+        ExportFrame();
+
+    for (u32 i = 0; i < profiler.count; ++i)
+    {
+        ProfileBlock& block = profiler.blocks[i];
+        ProfileBlock& total = profiler.totals[i];
+        total.cycles += block.cycles;
+        total.hits   += block.hits;
+        for (u32 counter = 0; counter < PERF_COUNTER_COUNT; ++counter)
+            total.counters[counter] += block.counters[counter];
+        if (block.hits > 0)
+            RecordMetric(profiler.metrics[i], block.cycles);
+
+        profiler.previous[i] = block;
+        block.cycles = 0;
+        block.hits   = 0;
+        memset(block.counters, 0, sizeof(block.counters));
+    }
+    ++profiler.frame;
+}
+
+// Writes every block of every frame from now on to 'path' as CSV:
+//     frame,block,hits,tsc_cycles,cycles,instructions,branch_misses,l1d_misses,llc_misses,dtlb_misses,ipc
+// Counters that aren't available are left empty. 'cycles' are core cycles (time stamp counter
+// ticks if those aren't available), 'tsc_cycles' always the time stamp counter.
+bool ProfilerExport(const char* path)
+{
+    profiler.export_file = fopen(path, "w");
+    if (!profiler.export_file)
+    {
+        REPORT_ERROR("Couldn't create '%s'.\n", path);
+        return false;
+    }
+
+    fprintf(profiler.export_file, "frame,block,hits,tsc_cycles");
+    for (u32 counter = 0; counter < PERF_COUNTER_COUNT; ++counter)
+        fprintf(profiler.export_file, ",%s", perf_counter_names[counter]);
+    fprintf(profiler.export_file, ",ipc\n");
+    return true;
+}
+
+void ProfilerCloseExport()
+{
+    if (profiler.export_file)
+        fclose(profiler.export_file);
+    profiler.export_file = 0;
+}
+
+// Per block over all frames so far: cycles per hit, instructions per cycle and misses per
+// thousand instructions (or per hit, without an instruction count).
+void ProfilerPrintCounters(FILE* file)
+{
+    u32 available = profiler.counters_available;
+    bool per_instruction = (available & (1u << PERF_INSTRUCTIONS)) != 0;
+
+    fprintf(file, "%-12s %10s %12s %6s", "block", "hits", "cycles/hit", "ipc");
+    for (u32 counter = PERF_BRANCH_MISSES; counter < PERF_COUNTER_COUNT; ++counter)
+        fprintf(file, " %14s", perf_counter_names[counter]);
+    fprintf(file, "   (misses per %s)\n", per_instruction ? "1000 instructions" : "hit");
+
+    for (u32 i = 0; i < profiler.count; ++i)
+    {
+        const ProfileBlock& block = profiler.totals[i];
+        if (block.hits == 0)
+            continue;
+
+        u64 cycles = (available & (1u << PERF_CYCLES)) ? block.counters[PERF_CYCLES] : block.cycles;
+        fprintf(file, "%-12s %10u %12.0f", block.name, block.hits, cast(cycles, f64) / block.hits);
+        if (per_instruction && cycles > 0)
+            fprintf(file, " %6.2f", cast(block.counters[PERF_INSTRUCTIONS], f64) / cycles);
+        else
+            fprintf(file, " %6s", "-");
+
+        for (u32 counter = PERF_BRANCH_MISSES; counter < PERF_COUNTER_COUNT; ++counter)
+        {
+            if (!(available & (1u << counter)))
+                fprintf(file, " %14s", "-");
+            else if (per_instruction)
+                fprintf(file, " %14.3f", block.counters[PERF_INSTRUCTIONS] ? 1000.0 * block.counters[counter] / block.counters[PERF_INSTRUCTIONS] : 0.0);
+            else
+                fprintf(file, " %14.1f", cast(block.counters[counter], f64) / block.hits);
+        }
+        fprintf(file, "\n");
+    }
+}
+
+// Fills 'result' with the most expensive blocks of the last frame, most expensive first.
+u32 ProfilerTopBlocks(ProfileBlock* result, u32 max_count)
+{
+    u32 count = 0;
+    for (u32 i = 0; i < profiler.count; ++i)
+    {
+        ProfileBlock block = profiler.previous[i];
+        if (block.hits == 0)
+            continue;
+
+        // Insertion into the sorted result.
+        u32 at = count < max_count ? count : max_count;
+        while (at > 0 && result[at - 1].cycles < block.cycles)
+        {
+            if (at < max_count)
+                result[at] = result[at - 1];
+            --at;
+        }
+        if (at < max_count)
+        {
+            result[at] = block;
+            if (count < max_count)
+                ++count;
+        }
+    }
+    return count;
+}
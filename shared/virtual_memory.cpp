@@ -0,0 +1,198 @@
+// Reserve-then-commit virtual memory for the game's arenas.
+//
+// All arenas are reserved as one big range of inaccessible address space up front, which costs
+// nothing but page table entries. Pages are only made accessible (committed) as 'PushSize' grows
+// into them, and the OS hands them out zeroed on first touch, so there's no up front clearing.
+//
+// Layout, with every part aligned to a huge page:
+//
+//     [guard][persistent .......][guard][temporary .......][guard]
+//
+// The guards are never committed, so running off the end of an arena faults immediately instead
+// of silently corrupting the next one.
+//
+// On Linux committed ranges are backed by explicit huge pages (MAP_HUGETLB) when the system has
+// some reserved, otherwise they're marked for transparent huge pages (MADV_HUGEPAGE). Either way
+// large working sets take far fewer TLB misses. Other systems get normal pages.
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+#define HUGE_PAGE_SIZE MEGABYTES(2)
+#define ARENA_GUARD_SIZE HUGE_PAGE_SIZE  // Keeps arenas huge page aligned. Address space is cheap.
+
+#if !defined(MAP_NORESERVE)
+#define MAP_NORESERVE 0
+#endif
+
+
+struct VirtualMemory
+{
+    u8* base;
+    u64 size;
+
+    bool explicit_huge_pages;   // Try MAP_HUGETLB when committing.
+    u64  commit_granularity;
+
+    u64  committed;             // Totals over all arenas. Arenas can commit from any thread,
+    u64  committed_huge;        // so these are written with __atomic_*.
+};
+static VirtualMemory virtual_memory;
+
+
+static u64 AlignUp(u64 value, u64 alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Reserves 'size' bytes of address space without backing it by memory. 'hint' is where we'd like
+// it to be, so pointers stay the same between runs (for recordings). Returns 0 on failure.
+u8* ReserveVirtualMemory(u64 size, u64 hint)
+{
+    void* wanted  = reinterpret_cast<void*>(hint);
+    void* address = mmap(wanted, size, PROT_NONE, MAP_PRIVATE|MAP_ANON|MAP_NORESERVE, -1, 0);
+    if (address == MAP_FAILED)
+    {
+        REPORT_ERROR("Couldn't reserve %llu bytes of address space. Error code: %d.\n", cast(size, unsigned long long), errno);
+        return 0;
+    }
+    if (wanted && address != wanted)
+        fprintf(stderr, "[Warning]: Memory reserved at %p instead of %p. Recordings from other runs won't replay.\n", address, wanted);
+
+    return cast(address, u8*);
+}
+
+// Backs [address, address + size) with memory. Both must be multiples of the page size.
+bool CommitVirtualMemory(void* address, u64 size)
+{
+#if defined(__linux__)
+    // Explicit huge pages have to be mapped as such, so replace the reservation.
+    if (virtual_memory.explicit_huge_pages && (size % HUGE_PAGE_SIZE) == 0)
+    {
+        void* result = mmap(address, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON|MAP_FIXED|MAP_HUGETLB, -1, 0);
+        if (result != MAP_FAILED)
+        {
+            __atomic_add_fetch(&virtual_memory.committed,      size, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&virtual_memory.committed_huge, size, __ATOMIC_RELAXED);
+            return true;
+        }
+
+        // The pool of huge pages is empty (or was never set up). Don't keep trying.
+        virtual_memory.explicit_huge_pages = false;
+    }
+#endif
+
+    if (mprotect(address, size, PROT_READ|PROT_WRITE) != 0)
+    {
+        REPORT_ERROR("Couldn't commit %llu bytes at %p. Error code: %d.\n", cast(size, unsigned long long), address, errno);
+        return false;
+    }
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    madvise(address, size, MADV_HUGEPAGE);
+#endif
+
+    __atomic_add_fetch(&virtual_memory.committed, size, __ATOMIC_RELAXED);
+    return true;
+}
+
+bool CommitArena(Buffer& arena, u64 minimum_size)
+{
+    if (minimum_size <= arena.committed)
+        return true;
+    if (minimum_size > arena.size)
+        return false;
+
+    u64 end = AlignUp(minimum_size, virtual_memory.commit_granularity);
+    if (end > arena.size)
+        end = arena.size;
+
+    if (!CommitVirtualMemory(cast(arena.data, u8*) + arena.committed, end - arena.committed))
+        return false;
+
+    arena.committed = end;
+    return true;
+}
+
+
+static Buffer CreateArena(u8* address, u64 size)
+{
+    Buffer arena;
+    arena.size      = size;
+    arena.used      = 0;
+    arena.committed = 0;
+    arena.data      = address;
+    arena.commit    = CommitArena;
+    return arena;
+}
+
+static void InitializeVirtualMemory()
+{
+    if (virtual_memory.commit_granularity != 0)
+        return;
+
+    virtual_memory.commit_granularity = KILOBYTES(64);
+
+#if defined(__linux__)
+    // Only bother with MAP_HUGETLB if the administrator has reserved huge pages.
+    FILE* file = fopen("/proc/sys/vm/nr_hugepages", "r");
+    if (file)
+    {
+        unsigned long long count = 0;
+        if (fscanf(file, "%llu", &count) == 1 && count > 0)
+            virtual_memory.explicit_huge_pages = true;
+        fclose(file);
+    }
+    // Transparent huge pages need 2MB of committed, aligned memory to kick in.
+    virtual_memory.commit_granularity = HUGE_PAGE_SIZE;
+#endif
+}
+
+// Reserves 'size' bytes plus an extra huge page, and returns the first huge page aligned address.
+static u8* ReserveAligned(u64 size, u64 hint)
+{
+    u8* reserved = ReserveVirtualMemory(size + HUGE_PAGE_SIZE, hint);
+    if (!reserved)
+        return 0;
+    return reinterpret_cast<u8*>(AlignUp(reinterpret_cast<u64>(reserved), HUGE_PAGE_SIZE));
+}
+
+// Reserves the game's arenas. Nothing is committed until the game starts pushing.
+bool AllocateGameMemory(Memory& memory, u64 persistent_size, u64 temporary_size, u64 hint)
+{
+    InitializeVirtualMemory();
+
+    persistent_size = AlignUp(persistent_size, HUGE_PAGE_SIZE);
+    temporary_size  = AlignUp(temporary_size,  HUGE_PAGE_SIZE);
+
+    u64 total = ARENA_GUARD_SIZE + persistent_size + ARENA_GUARD_SIZE + temporary_size + ARENA_GUARD_SIZE;
+    u8* base  = ReserveAligned(total, hint);
+    if (!base)
+        return false;
+
+    virtual_memory.base = base;
+    virtual_memory.size = total;
+
+    u8* persistent = base + ARENA_GUARD_SIZE;
+    u8* temporary  = persistent + persistent_size + ARENA_GUARD_SIZE;
+
+    memory.persistent  = CreateArena(persistent, persistent_size);
+    memory.temporary   = CreateArena(temporary,  temporary_size);
+    memory.initialized = false;
+    return true;
+}
+
+// Reserves a standalone arena, between guards, for the host's own long lived data.
+bool AllocateArena(Buffer& arena, u64 size)
+{
+    InitializeVirtualMemory();
+
+    size = AlignUp(size, HUGE_PAGE_SIZE);
+    u8* base = ReserveAligned(ARENA_GUARD_SIZE + size + ARENA_GUARD_SIZE, 0);
+    if (!base)
+        return false;
+
+    arena = CreateArena(base + ARENA_GUARD_SIZE, size);
+    return true;
+}
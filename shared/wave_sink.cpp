@@ -0,0 +1,137 @@
+// Audio backend that writes the exact stream the game produces to a WAV file.
+//
+// There's no sound card, so the playback cursor is derived from a clock the host passes in.
+// Pass 'NanoTime()' to run in real time (and measure the latency and glitches the game would
+// have on a real device), or a simulated time that advances faster, for offline rendering.
+//
+// Requires 'audio_latency.cpp'.
+
+
+struct WaveSink
+{
+    FILE* file;
+    AudioSettings settings;
+    AudioLatency  latency;
+
+    u64  start_time;       // When the simulated device started playing.
+    u32  glitches;         // Times silence had to be inserted because we fell behind.
+    s16* buffer;           // One backend buffer worth of samples.
+    u32  buffer_frames;
+};
+
+
+static void WriteWaveHeader(FILE* file, u32 samples_per_second, u64 frame_count)
+{
+    u64 data_size = frame_count * sizeof(Sample);
+    if (data_size > 0xFFFFFFFF - 36)  // RIFF can't describe more than 4GB. Readers clamp to the file size.
+        data_size = 0xFFFFFFFF - 36;
+
+    u32 riff_size   = cast(36 + data_size, u32);
+    u32 chunk_size  = cast(data_size, u32);
+    u32 format_size = 16;
+    u16 format      = 1;  // PCM.
+    u16 channels    = 2;
+    u32 byte_rate   = samples_per_second * sizeof(Sample);
+    u16 block_align = sizeof(Sample);
+    u16 bits        = 16;
+
+    fwrite("RIFF", 4, 1, file);
+    fwrite(&riff_size, 4, 1, file);
+    fwrite("WAVE", 4, 1, file);
+    fwrite("fmt ", 4, 1, file);
+    fwrite(&format_size, 4, 1, file);
+    fwrite(&format, 2, 1, file);
+    fwrite(&channels, 2, 1, file);
+    fwrite(&samples_per_second, 4, 1, file);
+    fwrite(&byte_rate, 4, 1, file);
+    fwrite(&block_align, 2, 1, file);
+    fwrite(&bits, 2, 1, file);
+    fwrite("data", 4, 1, file);
+    fwrite(&chunk_size, 4, 1, file);
+}
+
+
+bool OpenWaveSink(WaveSink& sink, const char* path, AudioSettings settings)
+{
+    sink.file = fopen(path, "wb");
+    if (!sink.file)
+    {
+        REPORT_ERROR("Couldn't create wave file '%s'.\n", path);
+        return false;
+    }
+
+    sink.settings      = settings;
+    sink.start_time    = 0;
+    sink.glitches      = 0;
+    sink.buffer_frames = AudioBufferFrames(settings);
+    sink.buffer        = cast(malloc(sink.buffer_frames * sizeof(Sample)), s16*);
+    InitializeAudioLatency(sink.latency, settings, sink.buffer_frames);
+
+    // Sizes are patched when closing. Until then they say "as large as possible", which readers
+    // clamp to the file size, so the file is usable even if we never get to close it.
+    WriteWaveHeader(sink.file, settings.samples_per_second, ~0ULL / sizeof(Sample));
+    return true;
+}
+
+// Acts as the device callback. Call it regularly (e.g. once per frame) with the current time.
+void UpdateWaveSink(WaveSink& sink, Memory& memory, SoundFunction sound, u64 now)
+{
+    // Like a real device, playback starts once the first buffers have been filled.
+    if (sink.latency.frames_written == 0)
+        sink.start_time = now;
+
+    // The simulated device consumes samples at exactly the sample rate.
+    u64 elapsed = now - sink.start_time;
+    u64 frames_played = cast(cast(elapsed, f64) * sink.settings.samples_per_second / 1000000000.0, u64);
+
+    u32 frames = AudioFramesToWrite(sink.latency, now, frames_played, sink.buffer_frames);
+
+    // If we fell behind, the device would've played silence in the meantime. Put it in the file,
+    // so it stays in sync with time and the glitch can be heard.
+    if (frames_played > sink.latency.frames_written && sink.latency.frames_written != 0)
+    {
+        u64 missing = frames_played - sink.latency.frames_written;
+        memset(sink.buffer, 0, sink.buffer_frames * sizeof(Sample));
+        for (u64 written = 0; written < missing; written += sink.buffer_frames)
+        {
+            u64 count = missing - written < sink.buffer_frames ? missing - written : sink.buffer_frames;
+            fwrite(sink.buffer, count * sizeof(Sample), 1, sink.file);
+        }
+        sink.latency.frames_written += missing;
+        ++sink.glitches;
+    }
+
+    // A real device keeps cycling its buffers, so keep filling until we're far enough ahead.
+    while (frames > 0)
+    {
+        SoundBuffer buffer;
+        buffer.size = frames * sizeof(Sample);
+        buffer.data = sink.buffer;
+        buffer.samples_per_second = sink.settings.samples_per_second;
+        sound(memory, buffer);
+
+        fwrite(sink.buffer, buffer.size, 1, sink.file);
+        AudioFramesWritten(sink.latency, frames);
+
+        u64 queued = sink.latency.frames_written - frames_played;
+        if (queued >= sink.latency.write_ahead_frames)
+            break;
+        frames = sink.latency.write_ahead_frames - cast(queued, u32);
+        if (frames > sink.buffer_frames)
+            frames = sink.buffer_frames;
+    }
+}
+
+void CloseWaveSink(WaveSink& sink)
+{
+    if (!sink.file)
+        return;
+
+    fseek(sink.file, 0, SEEK_SET);
+    WriteWaveHeader(sink.file, sink.settings.samples_per_second, sink.latency.frames_written);
+    fclose(sink.file);
+    free(sink.buffer);
+
+    sink.file   = 0;
+    sink.buffer = 0;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+// Minimal 4-wide float lanes. Uses SSE2 on x86, NEON on ARM and plain
+// scalar code everywhere else, so kernels only have to be written once.
+
+#include "main.h"
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+
+// Rounds to the nearest integer, ties to even like the SIMD conversions below, and saturates.
+// For the scalar ends of loops, so they give the same samples as the SIMD bodies.
+inline s16 SaturateS16(f32 x)
+{
+    x = x >= -32768.0f ? x : -32768.0f;  // NaN too.
+    x = x <=  32767.0f ? x :  32767.0f;
+    return cast(lrintf(x), s16);
+}
+
+struct f32x4
+{
+#if defined(SIMD_SSE2)
+    __m128 v;
+#elif defined(SIMD_NEON)
+    float32x4_t v;
+#else
+    f32 v[4];
+#endif
+};
+
+
+#if defined(SIMD_SSE2)
+
+inline f32x4 F32x4(f32 x)                           { f32x4 r; r.v = _mm_set1_ps(x);         return r; }
+inline f32x4 F32x4(f32 a, f32 b, f32 c, f32 d)      { f32x4 r; r.v = _mm_setr_ps(a, b, c, d); return r; }
+inline f32x4 LoadF32x4(const f32* p)                { f32x4 r; r.v = _mm_loadu_ps(p);        return r; }
+inline void  StoreF32x4(f32* p, f32x4 a)            { _mm_storeu_ps(p, a.v); }
+inline f32x4 operator+(f32x4 a, f32x4 b)            { f32x4 r; r.v = _mm_add_ps(a.v, b.v);   return r; }
+inline f32x4 operator-(f32x4 a, f32x4 b)            { f32x4 r; r.v = _mm_sub_ps(a.v, b.v);   return r; }
+inline f32x4 operator*(f32x4 a, f32x4 b)            { f32x4 r; r.v = _mm_mul_ps(a.v, b.v);   return r; }
+inline f32x4 Min(f32x4 a, f32x4 b)                  { f32x4 r; r.v = _mm_min_ps(a.v, b.v);   return r; }
+inline f32x4 Max(f32x4 a, f32x4 b)                  { f32x4 r; r.v = _mm_max_ps(a.v, b.v);   return r; }
+// (a0 b0 a1 b1) and (a2 b2 a3 b3).
+inline f32x4 InterleaveLow (f32x4 a, f32x4 b)       { f32x4 r; r.v = _mm_unpacklo_ps(a.v, b.v); return r; }
+inline f32x4 InterleaveHigh(f32x4 a, f32x4 b)       { f32x4 r; r.v = _mm_unpackhi_ps(a.v, b.v); return r; }
+
+// Rounds 'a' and 'b' to integers and stores them as 8 saturated s16.
+inline void StoreSaturatedS16(s16* p, f32x4 a, f32x4 b)
+{
+    __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(a.v), _mm_cvtps_epi32(b.v));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), packed);
+}
+
+#elif defined(SIMD_NEON)
+
+inline f32x4 F32x4(f32 x)                           { f32x4 r; r.v = vdupq_n_f32(x);          return r; }
+inline f32x4 F32x4(f32 a, f32 b, f32 c, f32 d)      { f32 t[4] = { a, b, c, d }; f32x4 r; r.v = vld1q_f32(t); return r; }
+inline f32x4 LoadF32x4(const f32* p)                { f32x4 r; r.v = vld1q_f32(p);            return r; }
+inline void  StoreF32x4(f32* p, f32x4 a)            { vst1q_f32(p, a.v); }
+inline f32x4 operator+(f32x4 a, f32x4 b)            { f32x4 r; r.v = vaddq_f32(a.v, b.v);     return r; }
+inline f32x4 operator-(f32x4 a, f32x4 b)            { f32x4 r; r.v = vsubq_f32(a.v, b.v);     return r; }
+inline f32x4 operator*(f32x4 a, f32x4 b)            { f32x4 r; r.v = vmulq_f32(a.v, b.v);     return r; }
+inline f32x4 Min(f32x4 a, f32x4 b)                  { f32x4 r; r.v = vminq_f32(a.v, b.v);     return r; }
+inline f32x4 Max(f32x4 a, f32x4 b)                  { f32x4 r; r.v = vmaxq_f32(a.v, b.v);     return r; }
+inline f32x4 InterleaveLow (f32x4 a, f32x4 b)       { f32x4 r; r.v = vzip1q_f32(a.v, b.v);    return r; }
+inline f32x4 InterleaveHigh(f32x4 a, f32x4 b)       { f32x4 r; r.v = vzip2q_f32(a.v, b.v);    return r; }
+
+inline void StoreSaturatedS16(s16* p, f32x4 a, f32x4 b)
+{
+    int16x8_t packed = vcombine_s16(vqmovn_s32(vcvtnq_s32_f32(a.v)), vqmovn_s32(vcvtnq_s32_f32(b.v)));
+    vst1q_s16(p, packed);
+}
+
+#else
+
+inline f32x4 F32x4(f32 x)                           { f32x4 r = {{ x, x, x, x }}; return r; }
+inline f32x4 F32x4(f32 a, f32 b, f32 c, f32 d)      { f32x4 r = {{ a, b, c, d }}; return r; }
+inline f32x4 LoadF32x4(const f32* p)                { f32x4 r = {{ p[0], p[1], p[2], p[3] }}; return r; }
+inline void  StoreF32x4(f32* p, f32x4 a)            { for (int i = 0; i < 4; ++i) p[i] = a.v[i]; }
+inline f32x4 operator+(f32x4 a, f32x4 b)            { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+inline f32x4 operator-(f32x4 a, f32x4 b)            { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+inline f32x4 operator*(f32x4 a, f32x4 b)            { for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i]; return a; }
+inline f32x4 Min(f32x4 a, f32x4 b)                  { for (int i = 0; i < 4; ++i) a.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]; return a; }
+inline f32x4 Max(f32x4 a, f32x4 b)                  { for (int i = 0; i < 4; ++i) a.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]; return a; }
+inline f32x4 InterleaveLow (f32x4 a, f32x4 b)       { f32x4 r = {{ a.v[0], b.v[0], a.v[1], b.v[1] }}; return r; }
+inline f32x4 InterleaveHigh(f32x4 a, f32x4 b)       { f32x4 r = {{ a.v[2], b.v[2], a.v[3], b.v[3] }}; return r; }
+
+inline void StoreSaturatedS16(s16* p, f32x4 a, f32x4 b)
+{
+    for (int i = 0; i < 8; ++i)
+        p[i] = SaturateS16((i < 4) ? a.v[i] : b.v[i - 4]);
+}
+
+#endif
+
+inline f32x4& operator+=(f32x4& a, f32x4 b) { a = a + b; return a; }
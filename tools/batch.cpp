@@ -0,0 +1,534 @@
+// Batch simulation. Loads the game library once and steps many independent instances of it,
+// each with its own Memory, FrameBuffer and KeyBoard, on a pool of threads. For soak tests and
+// tuning runs that need thousands of games rather than one in real time.
+//
+//     batch [--instances <n>] [--threads <n>] [--frames <n>] [--width <n> --height <n>] [--fps <n>]
+//           [--sound] [--input <script> | --random-input <seed>] [--game <path>] [--hashes <path>]
+//
+// Instances run on a simulated clock, as fast as they can, and each is stepped from start to
+// end by one thread (a thread takes the next instance when it's done with one). Rendering is off
+// by default: the framebuffer is 0x0, so the game's drawing loops don't run. Give a size to
+// render too. '--sound' also calls 'Sound' once per frame with a frame's worth of samples.
+//
+// Input is either a script, shared by every instance, or pseudo random 'wasd' presses seeded
+// per instance. A script has one line per frame that has input, '#' starts a comment:
+//
+//     # frame  keys pressed during that frame
+//     30       d
+//     31       dd
+//     90       ws
+//
+// The game is only allowed to keep state in the Memory it's given, otherwise instances would
+// share it. Two checks catch state kept elsewhere:
+//     1. The game library's writable segments (.data, .bss) are compared before and after the
+//        run. Any change means a global (or function local static) is written. Linux only.
+//     2. Instance 0 is run a second time, alone and from scratch in the same memory, and its
+//        final state (persistent memory and framebuffer) must hash the same as in the batch.
+//        Instances are reserved at fixed addresses, so hashes written with '--hashes' can also be
+//        compared between runs and builds.
+// Either failing makes the run fail, so it can gate a build.
+//
+// Build with CMake (see CMakeLists.txt), or from this directory:
+//     clang++ -O2 -I ../ -o batch batch.cpp -lpthread -ldl
+
+#include "main.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#if defined(__APPLE__) && defined(__MACH__)
+#include "macosx/source/clock.cpp"
+#elif defined(__linux__)
+#include "linux/source/clock.cpp"
+#include <link.h>  // dl_iterate_phdr
+#endif
+
+
+struct Game
+{
+    InitializeFunction initialize;
+    UpdateFunction     update;
+    SoundFunction      sound;
+};
+static Game game;
+
+#if defined(__APPLE__) && defined(__MACH__)
+#include "macosx/source/hotloader.cpp"
+#elif defined(__linux__)
+#include "linux/source/hotloader.cpp"
+#endif
+
+#include "shared/metrics.cpp"
+#include "shared/virtual_memory.cpp"
+#include "shared/async_io.cpp"
+#include "shared/mapped_file.cpp"
+
+
+#define BATCH_PERSISTENT_SIZE MEGABYTES(64)  // Reserved per instance, committed as it's used.
+#define BATCH_TEMPORARY_SIZE  MEGABYTES(64)
+#define BATCH_MEMORY_BASE     TERABYTES(4)    // Instance i is reserved at base + i * stride, so its
+#define BATCH_MEMORY_STRIDE   GIGABYTES(1)    // pointers (and so its hash) are the same every run.
+#define BATCH_SAMPLE_RATE     48000
+
+
+// ---- INPUT ----
+struct InputEvent
+{
+    u32 frame;
+    s8  character;
+};
+
+struct InputScript
+{
+    InputEvent* events;  // Sorted by frame.
+    u32 count;
+};
+
+static bool LoadInputScript(InputScript& script, const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        REPORT_ERROR("Couldn't open input script '%s'.\n", path);
+        return false;
+    }
+
+    u32 capacity = 256;
+    script.events = cast(malloc(capacity * sizeof(InputEvent)), InputEvent*);  // LEAK(ted): Lives until exit.
+    script.count  = 0;
+
+    char line[256];
+    u32 line_number = 0;
+    u32 last_frame  = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        ++line_number;
+        char* comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+
+        unsigned frame = 0;
+        char keys[128] = {0};
+        int fields = sscanf(line, "%u %127s", &frame, keys);
+        if (fields <= 0)
+            continue;  // Blank line.
+        if (fields != 2 || frame < last_frame)
+        {
+            REPORT_ERROR("%s:%u: Expected '<frame> <keys>', with frames in order.\n", path, line_number);
+            fclose(file);
+            return false;
+        }
+        last_frame = frame;
+
+        for (char* key = keys; *key; ++key)
+        {
+            if (script.count == capacity)
+            {
+                capacity *= 2;
+                script.events = cast(realloc(script.events, capacity * sizeof(InputEvent)), InputEvent*);
+            }
+            script.events[script.count].frame     = frame;
+            script.events[script.count].character = *key;
+            ++script.count;
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+static void PressKey(KeyBoard& keyboard, s8 character)
+{
+    if (keyboard.used == sizeof(keyboard.keys) / sizeof(keyboard.keys[0]))
+        return;
+    Key& key = keyboard.keys[keyboard.used++];
+    key.character     = character;
+    key.transitions   = 1;
+    key.ended_on_down = true;
+}
+
+
+// ---- INSTANCES ----
+struct Instance
+{
+    Memory      memory;
+    FrameBuffer framebuffer;
+    KeyBoard    keyboard;
+    SoundBuffer sound;
+
+    u32 next_event;   // In the script.
+    u32 random;       // State of the random input.
+
+    u64 hash;         // Of the final state.
+    u64 nanoseconds;  // Spent stepping it.
+};
+
+struct Batch
+{
+    Instance* instances;
+    u32 instance_count;
+    u32 frame_count;
+    u32 fps;
+    bool sound;
+
+    InputScript script;
+    bool random_input;
+    u32  random_seed;
+
+    u32 next_instance;  // Handed out to the threads with __atomic_*.
+};
+
+
+// 64-bit FNV-1a.
+static u64 Hash(u64 hash, const void* data, u64 size)
+{
+    const u8* bytes = cast(data, const u8*);
+    for (u64 i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    return hash;
+}
+
+static u64 HashInstance(const Instance& instance)
+{
+    u64 hash = 0xCBF29CE484222325ULL;
+    hash = Hash(hash, instance.memory.persistent.data, instance.memory.persistent.used);
+    hash = Hash(hash, instance.framebuffer.pixels, cast(instance.framebuffer.width, u64) * instance.framebuffer.height * sizeof(Pixel));
+    return hash;
+}
+
+// Different for every instance, never 0 (xorshift would get stuck).
+static u32 InputSeed(const Batch& batch, u32 index)
+{
+    u32 seed = batch.random_seed + index * 0x9E3779B9u;
+    return seed ? seed : 1;
+}
+
+static bool CreateInstance(Batch& batch, Instance& instance, u32 index, s32 width, s32 height, const Platform& platform)
+{
+    memset(&instance, 0, sizeof(instance));
+    if (!AllocateGameMemory(instance.memory, BATCH_PERSISTENT_SIZE, BATCH_TEMPORARY_SIZE, BATCH_MEMORY_BASE + index * BATCH_MEMORY_STRIDE))
+        return false;
+    instance.memory.platform = platform;
+
+    instance.framebuffer.width  = width;
+    instance.framebuffer.height = height;
+    if (width > 0 && height > 0)
+        instance.framebuffer.pixels = cast(calloc(cast(width, u64) * height, sizeof(Pixel)), Pixel*);
+
+    if (batch.sound)
+    {
+        u32 frames = BATCH_SAMPLE_RATE / batch.fps;
+        instance.sound.size = frames * sizeof(Sample);
+        instance.sound.data = cast(calloc(frames, sizeof(Sample)), s16*);
+        instance.sound.samples_per_second = BATCH_SAMPLE_RATE;
+    }
+
+    instance.random = InputSeed(batch, index);
+    return instance.framebuffer.pixels || width <= 0 || height <= 0;
+}
+
+// Puts the instance back to how 'CreateInstance' left it, reusing its memory, so it can be run
+// again from scratch.
+static void ResetInstance(Batch& batch, Instance& instance, u32 index)
+{
+    memset(instance.memory.persistent.data, 0, instance.memory.persistent.used);
+    memset(instance.memory.temporary.data,  0, instance.memory.temporary.used);
+    instance.memory.persistent.used = 0;
+    instance.memory.temporary.used  = 0;
+    instance.memory.initialized     = false;
+
+    if (instance.framebuffer.pixels)
+        memset(instance.framebuffer.pixels, 0, cast(instance.framebuffer.width, u64) * instance.framebuffer.height * sizeof(Pixel));
+
+    instance.next_event = 0;
+    instance.random     = InputSeed(batch, index);
+}
+
+static void RunInstance(Batch& batch, Instance& instance)
+{
+    u64 start = NanoTime();
+
+    game.initialize(instance.memory);
+    for (u32 frame = 0; frame < batch.frame_count; ++frame)
+    {
+        KeyBoard& keyboard = instance.keyboard;
+        keyboard.used = 0;
+        if (batch.random_input)
+        {
+            // xorshift32. A key every fourth frame or so.
+            u32 x = instance.random;
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            instance.random = x;
+            if ((x & 3) == 0)
+                PressKey(keyboard, "wasd"[(x >> 2) & 3]);
+        }
+        else
+        {
+            const InputScript& script = batch.script;
+            while (instance.next_event < script.count && script.events[instance.next_event].frame <= frame)
+            {
+                const InputEvent& event = script.events[instance.next_event++];
+                if (event.frame == frame)
+                    PressKey(keyboard, event.character);
+            }
+        }
+
+        game.update(instance.memory, instance.framebuffer, keyboard);
+        if (batch.sound)
+            game.sound(instance.memory, instance.sound);
+    }
+
+    instance.hash        = HashInstance(instance);
+    instance.nanoseconds = NanoTime() - start;
+}
+
+static void* BatchWorker(void* user_data)
+{
+    Batch& batch = *cast(user_data, Batch*);
+    while (true)
+    {
+        u32 index = __atomic_fetch_add(&batch.next_instance, 1, __ATOMIC_RELAXED);
+        if (index >= batch.instance_count)
+            break;
+        RunInstance(batch, batch.instances[index]);
+    }
+    return 0;
+}
+
+
+// ---- GLOBAL STATE CHECK ----
+// Copies of the game library's writable segments, taken right after loading it.
+struct WritableSegment
+{
+    u8* address;
+    u64 size;
+    u8* copy;
+};
+
+struct LibrarySnapshot
+{
+    const char*     name;
+    WritableSegment segments[8];
+    u32             count;
+};
+
+#if defined(__linux__)
+
+static int SnapshotSegments(dl_phdr_info* info, size_t, void* user_data)
+{
+    LibrarySnapshot& snapshot = *cast(user_data, LibrarySnapshot*);
+    if (!info->dlpi_name || strcmp(info->dlpi_name, snapshot.name) != 0)
+        return 0;
+
+    for (u32 i = 0; i < info->dlpi_phnum && snapshot.count < sizeof(snapshot.segments) / sizeof(snapshot.segments[0]); ++i)
+    {
+        const ElfW(Phdr)& header = info->dlpi_phdr[i];
+        if (header.p_type != PT_LOAD || !(header.p_flags & PF_W))
+            continue;
+
+        WritableSegment& segment = snapshot.segments[snapshot.count++];
+        segment.address = reinterpret_cast<u8*>(info->dlpi_addr + header.p_vaddr);
+        segment.size    = header.p_memsz;  // Includes .bss.
+        segment.copy    = cast(malloc(segment.size), u8*);  // LEAK(ted): Lives until exit.
+        memcpy(segment.copy, segment.address, segment.size);
+    }
+    return 1;
+}
+
+// Finds the library that 'function' is in and copies its writable segments.
+static bool TakeLibrarySnapshot(LibrarySnapshot& snapshot, void* function)
+{
+    Dl_info info;
+    if (!dladdr(function, &info) || !info.dli_fname)
+        return false;
+
+    snapshot.name  = info.dli_fname;
+    snapshot.count = 0;
+    dl_iterate_phdr(SnapshotSegments, &snapshot);
+    return true;
+}
+
+// Returns the number of bytes that changed, and prints where.
+static u64 CompareLibrarySnapshot(const LibrarySnapshot& snapshot, void* function)
+{
+    Dl_info info;
+    dladdr(function, &info);
+    u8* base = cast(info.dli_fbase, u8*);
+
+    u64 changed = 0;
+    for (u32 i = 0; i < snapshot.count; ++i)
+    {
+        const WritableSegment& segment = snapshot.segments[i];
+        u32 reported = 0;
+        for (u64 offset = 0; offset < segment.size; ++offset)
+        {
+            if (segment.address[offset] == segment.copy[offset])
+                continue;
+            ++changed;
+            if (reported++ < 8)
+                fprintf(stderr, "    Written: offset 0x%llx in %s (look it up with 'nm -C')\n",
+                        cast(segment.address + offset - base, unsigned long long), snapshot.name);
+        }
+    }
+    return changed;
+}
+
+#else
+
+static bool TakeLibrarySnapshot(LibrarySnapshot&, void*)            { return false; }
+static u64  CompareLibrarySnapshot(const LibrarySnapshot&, void*)   { return 0; }
+
+#endif
+
+
+int main(int argc, char* argv[])
+{
+    // ---- PARSE ARGUMENTS ----
+    Batch batch = {0};
+    batch.instance_count = 256;
+    batch.frame_count    = 600;
+    batch.fps            = 30;
+    u32 thread_count = cast(sysconf(_SC_NPROCESSORS_ONLN), u32);
+    s32 width  = 0;
+    s32 height = 0;
+    const char* game_path   = 0;
+    const char* input_path  = 0;
+    const char* hashes_path = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--sound") == 0)
+            batch.sound = true;
+        else if (i + 1 < argc && strcmp(argv[i], "--instances") == 0)
+            batch.instance_count = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--threads") == 0)
+            thread_count = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--frames") == 0)
+            batch.frame_count = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--width") == 0)
+            width = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--height") == 0)
+            height = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--fps") == 0)
+            batch.fps = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--input") == 0)
+            input_path = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--random-input") == 0)
+        {
+            batch.random_input = true;
+            batch.random_seed  = cast(strtoul(argv[++i], 0, 10), u32);
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "--game") == 0)
+            game_path = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--hashes") == 0)
+            hashes_path = argv[++i];
+        else
+            fprintf(stderr, "Unknown argument '%s'.\n", argv[i]);
+    }
+    if (batch.instance_count == 0 || batch.fps == 0 || width < 0 || height < 0)
+    {
+        fprintf(stderr, "Invalid instance count, size or frame rate.\n");
+        return 1;
+    }
+    if (thread_count == 0)
+        thread_count = 1;
+    if (thread_count > batch.instance_count)
+        thread_count = batch.instance_count;
+    if (input_path && !LoadInputScript(batch.script, input_path))
+        return 1;
+
+    // ---- LOAD GAME ----
+    // Once, for every instance.
+    if (!game_path)
+    {
+#if defined(__APPLE__) && defined(__MACH__)
+        game_path = GetNameByExecutable("libGame.A.dylib");  // LEAK(ted): Making static for now.
+#else
+        game_path = GetNameByExecutable("libGame.so");       // LEAK(ted): Making static for now.
+#endif
+    }
+    game = TryLoadGame(game_path);
+    if (game.update == DEFAULT_Update)
+    {
+        REPORT_ERROR("'%s' doesn't export the game.\n", game_path);
+        return 1;
+    }
+
+    LibrarySnapshot snapshot = {0};
+    bool snapshot_taken = TakeLibrarySnapshot(snapshot, reinterpret_cast<void*>(game.update));
+
+    // ---- CREATE INSTANCES ----
+    // Platform services are shared, they're thread safe.
+    Platform platform = {0};
+    InitializeAsyncIO(platform);
+    InitializeMappedFiles(platform);
+
+    batch.instances = cast(calloc(batch.instance_count, sizeof(Instance)), Instance*);  // LEAK(ted): Lives until exit.
+    for (u32 i = 0; i < batch.instance_count; ++i)
+    {
+        if (!CreateInstance(batch, batch.instances[i], i, width, height, platform))
+        {
+            REPORT_ERROR("Couldn't create instance %u.\n", i);
+            return 1;
+        }
+    }
+
+    // ---- RUN ----
+    u64 start = NanoTime();
+    pthread_t* threads = cast(malloc(thread_count * sizeof(pthread_t)), pthread_t*);  // LEAK(ted): Lives until exit.
+    for (u32 i = 0; i < thread_count; ++i)
+    {
+        int error = pthread_create(&threads[i], 0, BatchWorker, &batch);
+        ASSERT(error == 0, "Couldn't create batch thread. Error code %i.\n", error);
+    }
+    for (u32 i = 0; i < thread_count; ++i)
+        pthread_join(threads[i], 0);
+    u64 elapsed = NanoTime() - start;
+
+    // ---- CHECK ISOLATION ----
+    u64 written_globals = snapshot_taken ? CompareLibrarySnapshot(snapshot, reinterpret_cast<void*>(game.update)) : 0;
+
+    Instance& first = batch.instances[0];
+    u64 batch_hash = first.hash;
+    ResetInstance(batch, first, 0);
+    RunInstance(batch, first);
+    bool deterministic = first.hash == batch_hash;
+
+    // ---- REPORT ----
+    u64 total_frames = cast(batch.instance_count, u64) * batch.frame_count;
+    u64 busy = 0;
+    for (u32 i = 0; i < batch.instance_count; ++i)
+        busy += batch.instances[i].nanoseconds;
+
+    printf("Instances          : %u on %u threads, %u frames each (%dx%d%s)\n", batch.instance_count, thread_count,
+           batch.frame_count, width, height, batch.sound ? ", with sound" : "");
+    printf("Simulated frames   : %llu in %.3f s (%.0f frames per second, %.0f per thread)\n",
+           cast(total_frames, unsigned long long), elapsed / 1000000000.0,
+           total_frames * 1000000000.0 / elapsed, total_frames * 1000000000.0 / (busy ? busy : 1));
+    printf("Committed memory   : %.1f MB\n", virtual_memory.committed / (1024.0 * 1024.0));
+    if (snapshot_taken)
+        printf("Global state       : %s (%llu bytes of the library's data written)\n",
+               written_globals ? "WRITTEN" : "none", cast(written_globals, unsigned long long));
+    else
+        printf("Global state       : not checked on this platform\n");
+    printf("Determinism        : %s (instance 0 rerun alone: %016llx, in the batch: %016llx)\n",
+           deterministic ? "OK" : "DIFFERENT", cast(first.hash, unsigned long long), cast(batch_hash, unsigned long long));
+
+    if (hashes_path)
+    {
+        FILE* file = fopen(hashes_path, "w");
+        if (!file)
+        {
+            REPORT_ERROR("Couldn't create '%s'.\n", hashes_path);
+            return 1;
+        }
+        fprintf(file, "instance,hash\n");
+        for (u32 i = 0; i < batch.instance_count; ++i)
+            fprintf(file, "%u,%016llx\n", i, cast(batch.instances[i].hash, unsigned long long));
+        fclose(file);
+    }
+
+    return (written_globals == 0 && deterministic) ? 0 : 1;
+}
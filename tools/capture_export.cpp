@@ -0,0 +1,306 @@
+// Exports a frame capture (see shared/frame_capture.cpp) to a Y4M video or a series of PNGs.
+//
+//     capture_export <capture> --y4m <output.y4m> [--fps <n>] [--first <frame>] [--last <frame>]
+//     capture_export <capture> --png <prefix>                 [--first <frame>] [--last <frame>]
+//     capture_export <capture> --info
+//
+// PNGs are written as '<prefix>00000.png' and so on, uncompressed (stored deflate blocks), so
+// no zlib is needed. Y4M is 4:4:4 full range BT.601, which ffmpeg and most players read.
+//
+// Build from this directory:
+//     clang++ -O2 -I ../ -o capture_export capture_export.cpp
+
+#include "main.h"
+
+#include <string.h>
+#include <time.h>
+
+u64 NanoTime()
+{
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return cast(time.tv_sec, u64) * 1000000000ULL + time.tv_nsec;
+}
+
+#include "shared/lz.cpp"
+#include "shared/virtual_memory.cpp"
+#include "shared/frame_capture.cpp"
+
+
+// Byte offsets of red, green and blue in a captured pixel.
+static void ChannelOffsets(u32 pixel_format, u32* r, u32* g, u32* b)
+{
+    *g = 1;
+    *r = pixel_format == CAPTURE_BGRA ? 2 : 0;
+    *b = pixel_format == CAPTURE_BGRA ? 0 : 2;
+}
+
+
+// ---- Y4M ----
+static u8 ClampToByte(f32 x)
+{
+    return x <= 0.0f ? 0 : (x >= 255.0f ? 255 : cast(x + 0.5f, u8));
+}
+
+static void WriteY4MFrame(FILE* file, CaptureReader& reader, u8* planes)
+{
+    u32 r, g, b;
+    ChannelOffsets(reader.header.pixel_format, &r, &g, &b);
+
+    u64 count = cast(reader.width, u64) * reader.height;
+    u8* y_plane  = planes;
+    u8* cb_plane = planes + count;
+    u8* cr_plane = planes + count * 2;
+
+    const u8* pixels = reinterpret_cast<const u8*>(reader.pixels);
+    for (u64 i = 0; i < count; ++i)
+    {
+        f32 red = pixels[i * 4 + r], green = pixels[i * 4 + g], blue = pixels[i * 4 + b];
+        y_plane[i]  = ClampToByte( 0.299f    * red + 0.587f    * green + 0.114f    * blue);
+        cb_plane[i] = ClampToByte(-0.168736f * red - 0.331264f * green + 0.5f      * blue + 128.0f);
+        cr_plane[i] = ClampToByte( 0.5f      * red - 0.418688f * green - 0.081312f * blue + 128.0f);
+    }
+
+    fwrite("FRAME\n", 6, 1, file);
+    fwrite(planes, count * 3, 1, file);
+}
+
+
+// ---- PNG ----
+static u32 crc_table[256];
+
+static void InitializeCrcTable()
+{
+    for (u32 n = 0; n < 256; ++n)
+    {
+        u32 c = n;
+        for (u32 k = 0; k < 8; ++k)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[n] = c;
+    }
+}
+
+static u32 UpdateCrc(u32 crc, const u8* data, u64 size)
+{
+    for (u64 i = 0; i < size; ++i)
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static void WriteBigEndian32(u8* p, u32 x)
+{
+    p[0] = cast(x >> 24, u8);
+    p[1] = cast(x >> 16, u8);
+    p[2] = cast(x >> 8,  u8);
+    p[3] = cast(x,       u8);
+}
+
+static void WritePngChunk(FILE* file, const char* type, const u8* data, u32 size)
+{
+    u8 length[4], crc_bytes[4];
+    WriteBigEndian32(length, size);
+    u32 crc = UpdateCrc(0xFFFFFFFFu, reinterpret_cast<const u8*>(type), 4);
+    crc = UpdateCrc(crc, data, size) ^ 0xFFFFFFFFu;
+    WriteBigEndian32(crc_bytes, crc);
+
+    fwrite(length, 4, 1, file);
+    fwrite(type, 4, 1, file);
+    fwrite(data, size, 1, file);
+    fwrite(crc_bytes, 4, 1, file);
+}
+
+static bool WritePng(const char* path, CaptureReader& reader, u8* scratch)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+    {
+        REPORT_ERROR("Couldn't create '%s'.\n", path);
+        return false;
+    }
+
+    u32 r, g, b;
+    ChannelOffsets(reader.header.pixel_format, &r, &g, &b);
+
+    // Filter byte 0 (none) and RGB for every row.
+    u64 row_size = 1 + cast(reader.width, u64) * 3;
+    u64 raw_size = row_size * reader.height;
+    u8* raw      = scratch;
+    const u8* pixels = reinterpret_cast<const u8*>(reader.pixels);
+    for (u32 y = 0; y < reader.height; ++y)
+    {
+        u8* row = raw + y * row_size;
+        row[0] = 0;
+        for (u32 x = 0; x < reader.width; ++x)
+        {
+            const u8* pixel = pixels + (cast(y, u64) * reader.width + x) * 4;
+            row[1 + x * 3 + 0] = pixel[r];
+            row[1 + x * 3 + 1] = pixel[g];
+            row[1 + x * 3 + 2] = pixel[b];
+        }
+    }
+
+    // zlib stream of stored blocks, at most 65535 bytes each.
+    u8* zlib = raw + raw_size;
+    u8* out  = zlib;
+    *out++ = 0x78;
+    *out++ = 0x01;
+    u32 a = 1, s = 0;
+    for (u64 offset = 0; offset < raw_size || offset == 0; )
+    {
+        u64 remaining = raw_size - offset;
+        u16 size = cast(remaining < 65535 ? remaining : 65535, u16);
+        u16 complement = cast(~size, u16);
+        *out++ = offset + size == raw_size ? 1 : 0;  // Last block?
+        memcpy(out, &size, 2);       out += 2;
+        memcpy(out, &complement, 2); out += 2;
+        memcpy(out, raw + offset, size);
+        out += size;
+
+        for (u32 i = 0; i < size; ++i)
+        {
+            a = (a + raw[offset + i]) % 65521;
+            s = (s + a) % 65521;
+        }
+        offset += size;
+        if (raw_size == 0)
+            break;
+    }
+    WriteBigEndian32(out, (s << 16) | a);
+    out += 4;
+
+    u8 header[13];
+    WriteBigEndian32(header + 0, reader.width);
+    WriteBigEndian32(header + 4, reader.height);
+    header[8]  = 8;  // Bits per channel.
+    header[9]  = 2;  // RGB.
+    header[10] = 0;  // Deflate.
+    header[11] = 0;  // Adaptive filtering.
+    header[12] = 0;  // Not interlaced.
+
+    fwrite("\x89PNG\r\n\x1a\n", 8, 1, file);
+    WritePngChunk(file, "IHDR", header, sizeof(header));
+    WritePngChunk(file, "IDAT", zlib, cast(out - zlib, u32));
+    WritePngChunk(file, "IEND", 0, 0);
+    fclose(file);
+    return true;
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "Usage: %s <capture> (--y4m <file> | --png <prefix> | --info) [--fps <n>] [--first <frame>] [--last <frame>]\n", argv[0]);
+        return 1;
+    }
+
+    const char* y4m_path   = 0;
+    const char* png_prefix = 0;
+    bool info  = false;
+    u32  fps   = 0;
+    u32  first = 0;
+    u32  last  = ~0u;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--info") == 0)
+            info = true;
+        else if (i + 1 < argc && strcmp(argv[i], "--y4m") == 0)
+            y4m_path = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--png") == 0)
+            png_prefix = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "--fps") == 0)
+            fps = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--first") == 0)
+            first = atoi(argv[++i]);
+        else if (i + 1 < argc && strcmp(argv[i], "--last") == 0)
+            last = atoi(argv[++i]);
+        else
+            fprintf(stderr, "Unknown argument '%s'.\n", argv[i]);
+    }
+
+    CaptureReader reader;
+    if (!OpenCaptureReader(reader, argv[1]))
+        return 1;
+    if (reader.frame_count == 0)
+    {
+        fprintf(stderr, "No frames in '%s'.\n", argv[1]);
+        return 1;
+    }
+    if (last >= reader.frame_count)
+        last = reader.frame_count - 1;
+
+    // The frame rate isn't stored, so derive it from the timestamps unless given.
+    if (fps == 0)
+    {
+        u64 duration = reader.index[reader.frame_count - 1].timestamp - reader.index[0].timestamp;
+        fps = reader.frame_count > 1 && duration > 0 ? cast((reader.frame_count - 1) * 1000000000.0 / duration + 0.5, u32) : 30;
+        if (fps == 0)
+            fps = 1;
+    }
+
+    if (info)
+    {
+        u32 keyframes = 0;
+        for (u32 i = 0; i < reader.frame_count; ++i)
+            keyframes += (reader.index[i].flags & CAPTURE_KEYFRAME) ? 1 : 0;
+        printf("frames     %u (%u keyframes)\n", reader.frame_count, keyframes);
+        printf("frame rate %u\n", fps);
+        printf("format     %s\n", reader.header.pixel_format == CAPTURE_BGRA ? "BGRA" : "RGBA");
+    }
+
+    InitializeCrcTable();
+
+    FILE* y4m     = 0;
+    u8*   scratch = 0;
+    u32   width   = 0;
+    u32   height  = 0;
+    for (u32 frame = first; frame <= last; ++frame)
+    {
+        if (!ReadCaptureFrame(reader, frame))
+        {
+            fprintf(stderr, "Couldn't decode frame %u.\n", frame);
+            break;
+        }
+
+        if (reader.width != width || reader.height != height)
+        {
+            if (y4m)
+            {
+                // Y4M can't change size, so stop there.
+                fprintf(stderr, "Frame %u changes size to %ux%u. Stopping the video there.\n", frame, reader.width, reader.height);
+                break;
+            }
+            width  = reader.width;
+            height = reader.height;
+            u64 pixel_count = cast(width, u64) * height;
+            scratch = cast(realloc(scratch, pixel_count * 8 + (pixel_count * 3 / 65535 + 1) * 5 + 2 * height + 64), u8*);
+        }
+
+        if (y4m_path && !y4m)
+        {
+            y4m = fopen(y4m_path, "wb");
+            if (!y4m)
+            {
+                REPORT_ERROR("Couldn't create '%s'.\n", y4m_path);
+                return 1;
+            }
+            fprintf(y4m, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C444 XCOLORRANGE=FULL\n", width, height, fps);
+        }
+        if (y4m)
+            WriteY4MFrame(y4m, reader, scratch);
+
+        if (png_prefix)
+        {
+            char path[200];
+            snprintf(path, sizeof(path), "%s%05u.png", png_prefix, frame);
+            if (!WritePng(path, reader, scratch))
+                return 1;
+        }
+    }
+
+    if (y4m)
+        fclose(y4m);
+    free(scratch);
+    CloseCaptureReader(reader);
+    return 0;
+}
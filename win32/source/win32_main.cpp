@@ -119,6 +119,59 @@ static LRESULT CALLBACK Win32EventCallback(HWND window, UINT message, WPARAM wPa
 	return DefWindowProc(window, message, wParam, lParam);
 }
 
+// Pages are committed as the game pushes into an arena. Large pages would need the
+// 'SeLockMemoryPrivilege' and have to be committed together with the reservation, so we don't.
+static bool Win32CommitArena(Buffer& arena, u64 minimum_size)
+{
+	if (minimum_size <= arena.committed)
+		return true;
+	if (minimum_size > arena.size)
+		return false;
+
+	u64 granularity = KILOBYTES(64);
+	u64 end = (minimum_size + granularity - 1) / granularity * granularity;
+	if (end > arena.size)
+		end = arena.size;
+
+	u8* start = cast(arena.data, u8*) + arena.committed;
+	if (!VirtualAlloc(start, cast(end - arena.committed, SIZE_T), MEM_COMMIT, PAGE_READWRITE))
+	{
+		REPORT_ERROR("Couldn't commit arena memory. Error code %lu.\n", GetLastError())
+		return false;
+	}
+
+	arena.committed = end;
+	return true;
+}
+
+// Reserves [guard][persistent][guard][temporary][guard]. Guards are never committed, so running
+// off the end of an arena faults instead of corrupting the next one.
+static bool Win32AllocateGameMemory(Memory& memory, u64 persistent_size, u64 temporary_size)
+{
+	u64 guard = MEGABYTES(2);
+	u64 total = guard + persistent_size + guard + temporary_size + guard;
+
+	LPVOID start_up_location = (LPVOID)TERABYTES(2);
+	u8* base = cast(VirtualAlloc(start_up_location, cast(total, SIZE_T), MEM_RESERVE, PAGE_NOACCESS), u8*);
+	if (!base)
+		return false;
+
+	memory.persistent.size      = persistent_size;
+	memory.persistent.used      = 0;
+	memory.persistent.committed = 0;
+	memory.persistent.data      = base + guard;
+	memory.persistent.commit    = Win32CommitArena;
+
+	memory.temporary.size       = temporary_size;
+	memory.temporary.used       = 0;
+	memory.temporary.committed  = 0;
+	memory.temporary.data       = base + guard + persistent_size + guard;
+	memory.temporary.commit     = Win32CommitArena;
+
+	memory.initialized = false;
+	return true;
+}
+
 static void Win32LoadGame(Win32Game& game)
 {
 	HMODULE game_handle = LoadLibrary(L"main.dll");
@@ -178,18 +231,12 @@ int WINAPI wWinMain(HINSTANCE instance, HINSTANCE _, PWSTR command_line_argument
 
     ShowWindow(window, show_code);
 
-    LPVOID start_up_location = (LPVOID)TERABYTES(2);
-    SIZE_T memory_size = MEGABYTES(4);
-    u8* raw_memory = cast(VirtualAlloc(start_up_location, memory_size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE), u8*);
-
 	Memory memory = {0};
-	memory.persistent.size = memory_size / 2;
-	memory.persistent.used = 0;
-	memory.persistent.data = raw_memory;
-	memory.temporary.size = memory_size / 2;
-	memory.temporary.used = 0;
-	memory.temporary.data = raw_memory + memory_size / 2;
-	memory.initialized = false;
+	if (!Win32AllocateGameMemory(memory, GIGABYTES(8), GIGABYTES(8)))
+	{
+		REPORT_ERROR("Couldn't reserve game memory!\n")
+		return -1;
+	}
 
     Win32LoadGame(win32_game);
 